@@ -7,7 +7,13 @@
 int setup_cgroup(const char *cgroup_name);
 int set_memory_limit(const char *cgroup_name, long memory_bytes);
 int set_cpu_limit(const char *cgroup_name, int cpu_shares);
+int set_cpuset(const char *cgroup_name, const char *cpus, const char *mems, const char *partition);
+int reset_cpuset_partition(const char *cgroup_name);
 int add_pid_to_cgroup(const char *cgroup_name, pid_t pid);
 int cleanup_cgroup(const char *cgroup_name);
+int kill_cgroup(const char *cgroup_name, int timeout_ms);
+int freeze_cgroup(const char *cgroup_name, int frozen, int timeout_ms);
+int open_process_cgroup(pid_t pid);
+long cgroup_read_oom_kills(int events_fd);
 
 #endif
\ No newline at end of file
@@ -4,7 +4,25 @@
 #include <sys/types.h>
 #include <sched.h>
 #include <signal.h>
+#include <stdint.h>
 #include <time.h>
+#include <linux/limits.h>
+#include "cpuset.h"
+#include "network.h"
+#include "sha256.h"
+
+// What the supervisor does when a container's process exits
+typedef enum {
+    RESTART_NO,
+    RESTART_ON_FAILURE,      // After a non-zero exit, up to restart_max times
+    RESTART_ALWAYS,
+    RESTART_UNLESS_STOPPED
+} restart_policy_t;
+
+#define CONTAINER_NAME_MAX 64
+#define MAX_ALIASES 8
+
+struct sock_filter;
 
 // Container configuration
 typedef struct {
@@ -13,20 +31,69 @@ typedef struct {
     char **args;        // Command arguments
     int cpu_limit;      // CPU limit in shares (relative weight)
     int memory_limit;   // Memory limit in bytes
+    int cpus;           // CPUs to pin to (--cpus), 0 to share all of them
+    cpuset_policy_t cpuset_policy; // How those CPUs are picked
     pid_t pid;         // Container process ID
     char *id;          // Container unique identifier
     time_t created_at; // Creation timestamp
     char *status;      // Container status (created, running, stopped, exited)
+    port_mapping_t ports[MAX_PORT_MAPPINGS]; // Published ports
+    int num_ports;     // Number of published ports
+    network_mode_t network_mode;              // bridge, host, none, macvlan, ipvlan
+    char network_parent[NETWORK_PARENT_MAX];  // Parent NIC for macvlan/ipvlan
+    char *network_ip;  // Static address (CIDR) for macvlan/ipvlan
+    char bridge_ip[20]; // Address leased on the bridge, "" until allocated
+    int use_init;      // Run a minimal init as PID 1 (--init)
+    char *health_cmd;  // Health check command run inside the container
+    int health_interval_ms; // Time between health checks
+    int health_timeout_ms;  // Time before a running check counts as failed
+    int health_retries;     // Consecutive failures before unhealthy
+    restart_policy_t restart_policy; // --restart
+    int restart_max;        // on-failure restart limit, 0 for none
+    int run_argc;           // Arguments given to run, kept in the registry
+    char **run_argv;        // so the container can be rebuilt later
+    int sync_fd;            // Child waits for its ID here before setup, or -1
+    char lowerdir[PATH_MAX]; // Image as mounted on the host, set before clone
+    char *seccomp_profile;  // --security-opt seccomp=, NULL for the default
+    uint64_t cap_bset;      // Capabilities kept, one bit per CAP_* number
+    struct sock_filter *seccomp_filter; // Loaded program, set before clone
+    unsigned short seccomp_len;         // Instructions in seccomp_filter
+    char seccomp_digest[SHA256_HEX_SIZE]; // Cache key of that program, "" if unconfined
+    char *name;             // --name, resolvable by other containers
+    char *aliases[MAX_ALIASES]; // --alias, further names for the same address
+    int num_aliases;
+    int use_dns;            // Point /etc/resolv.conf at the daemon's resolver
+    int memory_dedup;       // Merge identical pages with other containers (--memory-dedup)
 } container_t;
 
+// Flat snapshot of a registry entry, shared by the registry and client API
+typedef struct {
+    pid_t pid;               // Container ID: the PID of its first process
+    pid_t process_pid;       // Current process; differs after a restart
+    int restarts;
+    time_t created_at;
+    char name[CONTAINER_NAME_MAX];
+    char status[16];
+    char health[16];
+    char network[16];
+    char ip[20];
+    char image[256];
+    char command[256];
+    char ports[128];
+    char restart[24];        // Restart policy, e.g. "on-failure:3"
+} container_info_t;
+
 // Function declarations
+int parse_run_args(int argc, char *argv[], container_t *container);
 int create_container(container_t *container);
 int start_container(container_t *container);
 int stop_container(pid_t pid);
 int list_containers(void);
 int container_init(void *arg);
-
-// Internal helper functions
-static int cleanup_container_resources(pid_t pid);
+int cleanup_container_resources(pid_t pid);
+pid_t respawn_container(container_t *container, int netns_fd, int cgroup_fd, int *pidfd);
+pid_t container_process_pid(pid_t id);
+int parse_restart_policy(const char *spec, restart_policy_t *policy, int *max);
+int format_restart_policy(restart_policy_t policy, int max, char *buf, size_t len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef CPUSET_H
+#define CPUSET_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define CPUSET_MAX_CPUS 1024
+
+// How --cpus are chosen from the host's topology. A domain is the set of
+// CPUs that share an L3 cache and a NUMA node.
+typedef enum {
+    CPUSET_PACK,       // Fill the fullest domain that fits, siblings together
+    CPUSET_SPREAD,     // One CPU per idle core, round-robin over domains
+    CPUSET_ISOLATE     // Whole cores in one domain, kept off the load balancer
+} cpuset_policy_t;
+
+// Picks CPUs for a container by policy, records them in the allocation map
+// and pins the container's cgroup to them; cpus_out lists them. Isolated
+// CPUs go to nobody else until cpuset_release(). Pack and spread draw from
+// a shared pool: unused CPUs first, then the least shared ones.
+int cpuset_assign(pid_t id, int cpus, cpuset_policy_t policy, char *cpus_out, size_t len);
+int cpuset_release(pid_t id);
+
+// The CPUs a container holds, or -1 if it holds none
+int cpuset_lookup(pid_t id, char *cpus, size_t len);
+
+int parse_cpuset_policy(const char *name, cpuset_policy_t *policy);
+const char *cpuset_policy_name(cpuset_policy_t policy);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+// Function declarations
+int daemon_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef DNS_H
+#define DNS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+// The embedded resolver answers on the bridge gateway, the address every
+// bridge-networked container can reach
+#define DNS_BRIDGE_ADDR "172.17.0.1"
+#define DNS_PORT 53
+
+// Binds the resolver. Names it does not know are forwarded to upstream
+// ("ip[:port]"), or to the host's first nameserver if upstream is NULL.
+int dns_start(const char *upstream);
+void dns_stop(void);
+int dns_active(void);
+
+// Readable when a query or an upstream reply is waiting
+int dns_fd(void);
+void dns_dispatch(void);
+
+// Container names and aliases; a name may map to several containers
+int dns_add(pid_t id, const char *name, struct in_addr addr);
+void dns_remove(pid_t id);
+int dns_lookup(const char *name, struct in_addr *addrs, int max);
+
+#endif
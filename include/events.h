@@ -0,0 +1,63 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Lifecycle events are kept in a ring in shared memory
+// (/dev/shm/minidocker-events). Producers never wait on readers; a reader
+// that falls more than EVENTS_RING_SLOTS behind loses the oldest events and
+// is told how many.
+#define EVENTS_SHM_NAME "/minidocker-events"
+#define EVENTS_RING_SLOTS 4096
+#define EVENT_DETAIL_MAX 36
+
+typedef enum {
+    EVENT_CREATE = 1,
+    EVENT_START,      // code holds the restart count
+    EVENT_EXIT,       // code holds the exit code, or 128+signal
+    EVENT_STOP,
+    EVENT_OOM,
+    EVENT_HEALTH      // detail holds the new health status
+} event_type_t;
+
+// One fixed-size record (64 bytes)
+typedef struct {
+    uint64_t seq;      // Position in the stream, starting at 1
+    int64_t time_ns;   // Wall-clock time
+    int32_t pid;       // Container PID
+    uint16_t type;     // event_type_t
+    uint16_t reserved;
+    int32_t code;
+    char detail[EVENT_DETAIL_MAX];
+} event_t;
+
+typedef struct events_ring events_ring_t;
+
+// Read cursor; one per consumer, nothing is shared between readers
+typedef struct {
+    events_ring_t *ring;
+    uint64_t next;     // Next sequence number to read
+    uint64_t lost;     // Events overwritten before they were read
+    int64_t since_ns;  // Older events are skipped
+} events_reader_t;
+
+// Function declarations
+int events_emit(event_type_t type, pid_t pid, int code, const char *detail);
+
+// since_ns < 0 starts at the next event, otherwise at the oldest retained
+// event no older than since_ns (wall clock). Returns 0 or -1.
+int events_reader_open(events_reader_t *reader, int64_t since_ns);
+void events_reader_close(events_reader_t *reader);
+
+// Returns 1 with the next event, 0 if there is none yet, -1 on error.
+// Never blocks; check reader->lost for overruns.
+int events_read(events_reader_t *reader, event_t *event);
+
+// Sleeps until an event may be available or timeout_ms passes (-1: forever)
+int events_wait(events_reader_t *reader, int timeout_ms);
+
+const char *event_type_name(event_type_t type);
+int parse_event_type(const char *name);
+
+#endif
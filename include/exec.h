@@ -0,0 +1,17 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include "container.h"
+#include <sys/types.h>
+
+// Function declarations
+int container_exec(pid_t id, char *const argv[], int use_tty);
+pid_t container_exec_spawn(const container_t *confine, pid_t target, char *const argv[],
+                           int *pidfd);
+
+// Reads the seccomp program and bounding set the container was started
+// with, so exec'd commands are held to the same limits. Release it with
+// security_release().
+int container_load_confinement(pid_t id, container_t *confine);
+
+#endif
@@ -5,16 +5,21 @@
 #include <sys/types.h>
 #include <sys/sysmacros.h>
 
+// Per-container state: the overlay's upper and work dirs and its mountpoint
+#define CONTAINERS_DIR "/var/lib/minidocker/containers"
+
 // Function declarations
-int setup_filesystem(const char *rootfs);
+int setup_filesystem(const char *lowerdir, const char *container_root);
 int mount_container_fs(void);
 int cleanup_filesystem(const char *container_root);
 
-// Helper functions
+// Helper functions. These and setup_filesystem() run in the cloned child,
+// so they log with log_child().
 int setup_rootfs(const char *new_root);
 int mount_proc(void);
 int mount_sys(void);
 int setup_chroot(const char *new_root);
 int setup_pivot_root(const char *new_root, const char *old_root);
+int write_resolv_conf(const char *nameserver);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef GC_H
+#define GC_H
+
+#include <stdint.h>
+
+// Host resources a container can leave behind
+typedef enum {
+    GC_CGROUP,       // /sys/fs/cgroup/minidocker_<id>
+    GC_VETH,         // veth<id>h on minidocker0
+    GC_NETNS,        // /var/run/netns/<id>
+    GC_ROOTFS,       // /var/lib/minidocker/containers/<id>
+    GC_KIND_COUNT
+} gc_kind_t;
+
+typedef struct {
+    uint32_t orphaned[GC_KIND_COUNT];  // Found with no container keeping them
+    uint32_t removed[GC_KIND_COUNT];
+    uint32_t reconciled;               // "running" entries whose process was gone
+} gc_stats_t;
+
+// Compares the registry with what exists on the host and removes what
+// belongs to no registered container, or to a stopped one. Returns 0, or
+// -1 if anything could not be removed.
+int gc_collect(gc_stats_t *stats);
+const char *gc_kind_name(gc_kind_t kind);
+
+#endif
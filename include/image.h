@@ -0,0 +1,24 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+
+#define IMAGES_DIR "/var/lib/minidocker/images"
+
+// Read-only single-file image formats
+typedef enum {
+    IMAGE_EROFS,
+    IMAGE_SQUASHFS
+} image_format_t;
+
+// Resolves an image to an overlay lowerdir. A directory is used as is; an
+// image file is loop-mounted read-only the first time it is used and the
+// mount is shared by every container started from it. A layer name yields
+// the layer stacked on its parents.
+int image_prepare(const char *image_path, char *lowerdir, size_t len);
+
+// Packs a root filesystem directory into a single image file
+int image_pack(const char *rootfs_dir, const char *image_file, image_format_t format);
+int parse_image_format(const char *name, image_format_t *format);
+
+#endif
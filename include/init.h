@@ -0,0 +1,7 @@
+#ifndef INIT_H
+#define INIT_H
+
+// Function declarations
+int run_init(const char *command, char *const args[]);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef KSM_H
+#define KSM_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define KSM_SYSFS "/sys/kernel/mm/ksm"
+
+// Kernel same-page merging as seen from one container's processes
+typedef struct {
+    int processes;             // Processes in the container's cgroup
+    int merge_any;             // Of those, opted in with PR_SET_MEMORY_MERGE
+    uint64_t merging_pages;    // Pages backed by a page shared through KSM
+    uint64_t zero_pages;       // Empty pages merged with the zero page
+    int64_t profit;            // Bytes saved, less KSM's own bookkeeping
+} ksm_usage_t;
+
+// Host-wide counters from KSM_SYSFS
+typedef struct {
+    int running;
+    uint64_t pages_shared;     // Shared pages in use
+    uint64_t pages_sharing;    // Further mappings of them: pages saved
+    uint64_t full_scans;
+    int64_t general_profit;
+} ksm_host_t;
+
+// Runs in the container before exec: marks all of its anonymous memory,
+// and that of everything it starts, as mergeable
+int ksm_enable_merge(void);
+
+// Starts ksmd; tuning values of 0 leave the kernel's setting alone
+int ksm_start(void);
+int ksm_tune(int pages_to_scan, int sleep_ms);
+
+int ksm_container_usage(pid_t id, ksm_usage_t *usage);
+int ksm_host_usage(ksm_host_t *host);
+
+#endif
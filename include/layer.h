@@ -0,0 +1,31 @@
+#ifndef LAYER_H
+#define LAYER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// A layer is a directory tree stacked on its parent image with overlayfs,
+// plus a manifest. Regular files are links to content-addressed blobs.
+#define LAYERS_DIR "/var/lib/minidocker/layers"
+#define BLOBS_DIR "/var/lib/minidocker/blobs/sha256"
+#define LAYER_NAME_MAX 64
+
+typedef struct {
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t whiteouts;        // Deleted paths and opaque directories
+    uint32_t blobs_reused;     // Files whose content was already stored
+    uint64_t bytes;            // Size of all files hashed
+    uint64_t bytes_stored;     // Size of the new blobs
+} layer_stats_t;
+
+// Snapshots the writable layer of a container into a new layer named name,
+// whose parent is the container's image
+int layer_commit(pid_t id, const char *name, layer_stats_t *stats);
+int layer_exists(const char *name);
+
+// Builds the overlay lowerdir for a layer: its tree, then its parents'
+int layer_lowerdir(const char *name, char *lowerdir, size_t len);
+
+#endif
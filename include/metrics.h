@@ -0,0 +1,43 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "protocol.h"
+#include <stdint.h>
+
+// Runtime metrics. Every thread counts into its own shard with plain
+// relaxed stores; a scrape sums the shards, so updates never contend.
+
+typedef enum {
+    METRIC_CONTAINERS_CREATED,
+    METRIC_CREATE_FAILURES,
+    METRIC_CONTAINERS_STOPPED,
+    METRIC_CONTAINERS_EXITED,
+    METRIC_OOM_KILLS,
+    METRIC_CONTAINER_RESTARTS,
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+// Phases timed into histograms
+typedef enum {
+    PHASE_CREATE_SETUP,        // Bridge and image mount
+    PHASE_CREATE_CLONE,        // Clone and cgroup
+    PHASE_CREATE_NETWORK,
+    PHASE_CREATE_REGISTRY,
+    PHASE_CREATE_TOTAL,
+    PHASE_STOP_WAIT,           // Stop request until the container has exited
+    PHASE_STOP_CLEANUP,
+    PHASE_STOP_TOTAL,
+    METRIC_PHASE_COUNT
+} metric_phase_t;
+
+// Function declarations
+void metrics_inc(metric_counter_t counter);
+void metrics_add(metric_counter_t counter, uint64_t value);
+void metrics_observe(metric_phase_t phase, uint64_t duration_ns);
+uint64_t metrics_now_ns(void);
+
+// Renders every series as Prometheus text (or OpenMetrics) into buf,
+// replacing its contents. Returns 0 or -1.
+int metrics_render(md_buffer_t *buf, int openmetrics);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef MINIDOCKER_CLIENT_H
+#define MINIDOCKER_CLIENT_H
+
+#include "container.h"
+#include "gc.h"
+#include "protocol.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Client for the minidockerd control socket. Functions return 0 on success,
+// a positive md_status_t if the daemon rejected the request and -1 on a
+// connection error.
+
+typedef struct mdc_client mdc_client_t;
+
+// Connection
+mdc_client_t *mdc_connect(const char *socket_path);
+void mdc_close(mdc_client_t *client);
+
+// Pipelining: queue any number of requests, flush once, then read the
+// responses, matching them by seq. Responses come back in request order,
+// except STOP, which is answered only once the container has exited.
+// A payload stays valid until the next mdc_recv().
+int mdc_send(mdc_client_t *client, uint16_t op, const void *payload, uint32_t len, uint32_t *seq);
+int mdc_flush(mdc_client_t *client);
+int mdc_recv(mdc_client_t *client, md_header_t *header, const char **payload);
+
+// One request, one response
+int mdc_ping(mdc_client_t *client);
+int mdc_ps(mdc_client_t *client, container_info_t **infos, size_t *count);
+int mdc_inspect(mdc_client_t *client, pid_t pid, container_info_t *info);
+int mdc_run(mdc_client_t *client, int argc, char *const argv[], pid_t *pid);
+int mdc_stop(mdc_client_t *client, pid_t pid);
+int mdc_gc(mdc_client_t *client, gc_stats_t *stats);
+
+#endif
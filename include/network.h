@@ -4,11 +4,53 @@
 #include <sys/types.h>
 #include <linux/limits.h>
 
+#define MAX_PORT_MAPPINGS 32
+
+#define BRIDGE_NAME "minidocker0"
+#define CONTAINER_NETNS_PATH "/var/run/netns"
+
+#define NETWORK_PARENT_MAX 16
+
+// Container network modes (--network)
+typedef enum {
+    NETWORK_BRIDGE,  // veth pair on minidocker0 with NAT (default)
+    NETWORK_HOST,    // share the host network namespace
+    NETWORK_NONE,    // private namespace with loopback only
+    NETWORK_MACVLAN, // macvlan interface on a parent NIC
+    NETWORK_IPVLAN   // ipvlan (L2) interface on a parent NIC
+} network_mode_t;
+
+// Published port (-p hostPort:containerPort[/proto])
+typedef struct {
+    unsigned short host_port;      // Port on the host
+    unsigned short container_port; // Port inside the container
+    char protocol[4];              // "tcp" or "udp"
+} port_mapping_t;
+
 // Function declarations
 int setup_network_namespace(pid_t pid);
+int relink_network_namespace(pid_t id, pid_t pid);
 int create_veth_pair(const char *veth_host, const char *veth_container);
 int setup_bridge(void);
-int configure_container_network(pid_t pid, const char *veth_host, const char *veth_container);
+int configure_container_network(pid_t pid, const char *veth_host, const char *veth_container,
+                                const char *ip);
 int cleanup_container_network(pid_t pid);
+int delete_links(char *const names[], size_t count);
+
+// Network modes
+int parse_network_mode(const char *spec, network_mode_t *mode, char *parent, size_t parent_len);
+const char *network_mode_name(network_mode_t mode);
+int configure_container_loopback(pid_t pid);
+int attach_container_to_parent(pid_t pid, network_mode_t mode, const char *parent,
+                               const char *ip_cidr);
+
+// Bridge addresses, leased from a map shared by every minidocker process
+int allocate_container_ip(pid_t id, char *buf, size_t len);
+int release_container_ip(pid_t id);
+
+// Port publishing
+int parse_port_mapping(const char *spec, port_mapping_t *mapping);
+int publish_port(const char *ip, const port_mapping_t *mapping);
+int unpublish_port(const port_mapping_t *mapping);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,57 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "container.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// minidockerd control protocol. Every message is a fixed header followed by
+// `length` payload bytes. Requests on one connection may be pipelined;
+// responses echo the request's sequence number. Integers are in host byte
+// order since the socket is local.
+#define MD_SOCKET_PATH "/run/minidocker/minidockerd.sock"
+#define MD_MAX_FRAME (1024 * 1024)
+
+typedef struct {
+    uint32_t length;   // Payload bytes following the header
+    uint32_t seq;      // Chosen by the client, echoed in the response
+    uint16_t op;       // md_op_t
+    uint16_t status;   // md_status_t, responses only
+} md_header_t;
+
+typedef enum {
+    MD_OP_PING = 1,    // -> empty
+    MD_OP_PS,          // -> u32 count, count encoded containers
+    MD_OP_INSPECT,     // i32 pid -> one encoded container
+    MD_OP_RUN,         // NUL-separated run arguments -> i32 pid
+    MD_OP_STOP,        // i32 pid -> empty, sent once the container is gone
+    MD_OP_GC           // -> gc_stats_t
+} md_op_t;
+
+typedef enum {
+    MD_OK = 0,
+    MD_ERR_INVALID,
+    MD_ERR_NOT_FOUND,
+    MD_ERR_FAILED,
+    MD_ERR_DENIED
+} md_status_t;
+
+// Growable byte buffer used for framing on both sides
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} md_buffer_t;
+
+// Function declarations
+int md_buffer_append(md_buffer_t *buf, const void *data, size_t len);
+void md_buffer_consume(md_buffer_t *buf, size_t len);
+void md_buffer_free(md_buffer_t *buf);
+size_t md_frame_begin(md_buffer_t *buf, uint32_t seq, uint16_t op, uint16_t status);
+void md_frame_end(md_buffer_t *buf, size_t frame_start);
+int md_frame_complete(const md_buffer_t *buf, md_header_t *header);
+int md_encode_info(md_buffer_t *buf, const container_info_t *info);
+int md_decode_info(const char *data, size_t len, size_t *offset, container_info_t *info);
+const char *md_status_name(int status);
+
+#endif
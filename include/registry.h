@@ -2,11 +2,22 @@
 #define REGISTRY_H
 
 #include "container.h"
+#include <stddef.h>
 #include <sys/types.h>
 
 // Function declarations
 int registry_add_container(container_t *container);
 int registry_update_container_status(pid_t pid, const char *status);
+int registry_update_container_health(pid_t pid, const char *health);
+int registry_update_container_restart(pid_t pid, pid_t process_pid, int restarts);
+char **registry_get_run_args(pid_t pid, int *argc);
 void registry_list_containers(void);
+int registry_get_ports(pid_t pid, port_mapping_t *ports, int max_ports);
+int registry_get_container(pid_t pid, container_info_t *info);
+int registry_get_security(pid_t pid, char *digest, size_t len, uint64_t *cap_bset);
+int registry_foreach(int (*callback)(const container_info_t *info, void *arg), void *arg);
+void registry_print_header(void);
+void registry_print_container(const container_info_t *info);
+int registry_enable_cache(void);
 
 #endif
\ No newline at end of file
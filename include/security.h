@@ -0,0 +1,28 @@
+#ifndef SECURITY_H
+#define SECURITY_H
+
+#include <stdint.h>
+#include "container.h"
+
+#define SECCOMP_CACHE_DIR "/var/lib/minidocker/seccomp"
+#define SECCOMP_UNCONFINED "unconfined"
+
+// Capabilities a container keeps by default, as a bounding set mask
+uint64_t default_capabilities(void);
+int parse_capability(const char *name, int *cap);
+
+// Runs in the parent: loads the container's seccomp filter, compiling its
+// profile only when no cached program matches the profile's hash
+int security_prepare(container_t *container);
+void security_release(container_t *container);
+
+// Loads a program already in the cache by its digest, as recorded in the
+// registry; an empty digest means unconfined
+int security_load(const char *digest, container_t *container);
+
+// Runs in the container just before exec: drops capabilities to the
+// bounding set and installs the prepared filter. It neither allocates nor
+// uses stdio, as the child is cloned from a multi-threaded daemon.
+int security_apply(const container_t *container);
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include "container.h"
+#include "timer_wheel.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+// Health of a supervised container
+typedef enum {
+    HEALTH_NONE,      // No health check configured
+    HEALTH_STARTING,  // No check has completed yet
+    HEALTH_HEALTHY,
+    HEALTH_UNHEALTHY
+} health_status_t;
+
+typedef struct supervised supervised_t;
+
+// epoll cookie; tells a container exit from a finished health check or
+// an OOM notification
+typedef struct {
+    int kind;
+    supervised_t *owner;
+} supervisor_watch_t;
+
+// A container watched by the supervisor
+struct supervised {
+    pid_t pid;                 // Container ID (PID of its first process)
+    pid_t process_pid;         // Current process, 0 while awaiting restart
+    int pidfd;                 // Readable once the process exits
+    char *health_cmd;          // Shell command run inside the container
+    int health_interval_ms;
+    int health_timeout_ms;
+    int health_retries;        // Consecutive failures before unhealthy
+    container_t confine;       // Seccomp program and bounding set checks
+    int confine_loaded;        // run under, loaded by the first check
+    health_status_t health;
+    int failures;              // Current run of failed checks
+    pid_t check_pid;           // Running check, 0 if none
+    int check_pidfd;
+    timer_entry_t health_timer; // Next check, or timeout of the running one
+    timer_entry_t stop_timer;  // SIGKILL deadline after a stop request
+    int stop_requested;
+    uint64_t stop_started_ns;
+    int cgroup_fd;             // Container cgroup directory, or -1
+    int oom_fd;                // Container cgroup's memory.events, or -1
+    long oom_kills;            // Last oom_kill count seen
+    int cpu_stat_fd;           // Read by the metrics exporter; -1 until
+    int memory_fd;             // first scraped, -2 if unavailable
+    int io_stat_fd;
+    restart_policy_t restart_policy;
+    int restart_max;
+    char **run_argv;           // Private copy of the run arguments
+    container_t config;        // Parsed from run_argv; used to respawn
+    int netns_fd;              // Network namespace kept across restarts
+    timer_entry_t restart_timer; // End of the current backoff
+    int restarts;
+    int quick_exits;           // Consecutive runs that ended too soon
+    int backoff_ms;            // Base delay before the next restart
+    uint64_t started_ms;       // When the current process started
+    uint32_t jitter_state;
+    supervisor_watch_t exit_watch;
+    supervisor_watch_t check_watch;
+    supervisor_watch_t oom_watch;
+    supervised_t *next;
+};
+
+// Counters for the supervisor's own cost
+typedef struct {
+    uint64_t checks_run;
+    uint64_t checks_failed;
+    uint64_t timers_fired;
+    uint64_t sched_cpu_ns;     // CPU time spent scheduling and dispatching
+} supervisor_stats_t;
+
+// Called after a supervised container exits; status is the exit code,
+// 128+signal, or -1 if it was not our child
+typedef void (*supervisor_exit_hook_t)(pid_t pid, int status);
+
+// Function declarations
+int supervisor_init(void);
+supervised_t *supervisor_watch(const container_t *container);
+int supervisor_fd(void);
+int supervisor_dispatch(int timeout_ms);
+int supervisor_run(void);
+int supervisor_stop(pid_t pid, int grace_ms);
+supervised_t *supervisor_find(pid_t pid);
+void supervisor_set_exit_hook(supervisor_exit_hook_t hook);
+size_t supervisor_count(void);
+void supervisor_foreach(void (*callback)(supervised_t *sc, void *arg), void *arg);
+void supervisor_get_stats(supervisor_stats_t *stats);
+const char *health_status_name(health_status_t health);
+
+#endif
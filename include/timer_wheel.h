@@ -0,0 +1,43 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hierarchical timing wheel: 4 levels of 64 slots. Adding, cancelling and
+// expiring a timer are O(1), so thousands of periodic timers cost the same
+// per tick as one.
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+typedef struct timer_entry timer_entry_t;
+typedef void (*timer_callback_t)(timer_entry_t *timer, void *data);
+
+// Embedded in the owning object; must not be freed while pending
+struct timer_entry {
+    timer_entry_t *next;
+    timer_entry_t *prev;
+    uint64_t expires;          // Expiry tick
+    timer_callback_t callback;
+    void *data;
+};
+
+typedef struct {
+    uint64_t current;          // Last processed tick
+    unsigned int tick_ms;      // Tick length in milliseconds
+    size_t count;              // Pending timers
+    timer_entry_t slots[WHEEL_LEVELS][WHEEL_SIZE]; // List heads
+} timer_wheel_t;
+
+// Function declarations
+void timer_wheel_init(timer_wheel_t *wheel, unsigned int tick_ms, uint64_t now_ms);
+void timer_init(timer_entry_t *timer, timer_callback_t callback, void *data);
+void timer_wheel_add(timer_wheel_t *wheel, timer_entry_t *timer, uint64_t expires_ms);
+void timer_wheel_cancel(timer_wheel_t *wheel, timer_entry_t *timer);
+int timer_pending(const timer_entry_t *timer);
+size_t timer_wheel_advance(timer_wheel_t *wheel, uint64_t now_ms);
+int timer_wheel_next_timeout(const timer_wheel_t *wheel, uint64_t now_ms);
+
+#endif
@@ -6,6 +6,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
 
 // Logging levels
 typedef enum {
@@ -17,8 +18,20 @@ typedef enum {
 
 // Function declarations
 void log_message(log_level_t level, const char *format, ...);
+
+// For code between clone() and exec in a child of the daemon, which is
+// multi-threaded: another thread may have held the stdio, locale or malloc
+// locks when it was cloned. Both keep to the stack and write(2), and only
+// understand %s, %d and %%; pair them with strerrordesc_np().
+int format_string(char *buf, size_t len, const char *format, ...);
+void log_child(log_level_t level, const char *format, ...);
 void die(const char *msg);
 int file_exists(const char *path);
 char *read_file_content(const char *path);
+int open_pidfd(pid_t pid);
+pid_t clone_into_cgroup(uint64_t flags, int cgroup_fd, int *pidfd);
+uint64_t monotonic_ms(void);
+char **copy_argv(int argc, const char *const argv[]);
+int parse_duration_ms(const char *str, int *duration_ms);
 
 #endif
\ No newline at end of file
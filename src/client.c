@@ -0,0 +1,229 @@
+#include "minidocker_client.h"
+#include "utils.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct mdc_client {
+    int fd;
+    uint32_t next_seq;
+    md_buffer_t out;
+    md_buffer_t in;
+    size_t pending_consume; // Size of the frame handed out by mdc_recv()
+};
+
+mdc_client_t *mdc_connect(const char *socket_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const char *path = socket_path ? socket_path : MD_SOCKET_PATH;
+    
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return NULL;
+    }
+    
+    mdc_client_t *client = calloc(1, sizeof(*client));
+    if (!client) {
+        close(fd);
+        return NULL;
+    }
+    client->fd = fd;
+    client->next_seq = 1;
+    return client;
+}
+
+void mdc_close(mdc_client_t *client) {
+    if (!client) {
+        return;
+    }
+    close(client->fd);
+    md_buffer_free(&client->out);
+    md_buffer_free(&client->in);
+    free(client);
+}
+
+int mdc_send(mdc_client_t *client, uint16_t op, const void *payload, uint32_t len, uint32_t *seq) {
+    if (!client || len > MD_MAX_FRAME) {
+        return -1;
+    }
+    
+    uint32_t this_seq = client->next_seq++;
+    size_t start = md_frame_begin(&client->out, this_seq, op, 0);
+    if (md_buffer_append(&client->out, payload, len) != 0) {
+        return -1;
+    }
+    md_frame_end(&client->out, start);
+    
+    if (seq) {
+        *seq = this_seq;
+    }
+    return 0;
+}
+
+int mdc_flush(mdc_client_t *client) {
+    size_t sent = 0;
+    
+    while (sent < client->out.len) {
+        ssize_t n = send(client->fd, client->out.data + sent, client->out.len - sent, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += (size_t)n;
+    }
+    
+    client->out.len = 0;
+    return 0;
+}
+
+int mdc_recv(mdc_client_t *client, md_header_t *header, const char **payload) {
+    md_buffer_consume(&client->in, client->pending_consume);
+    client->pending_consume = 0;
+    
+    if (client->out.len > 0 && mdc_flush(client) != 0) {
+        return -1;
+    }
+    
+    int complete;
+    while ((complete = md_frame_complete(&client->in, header)) == 0) {
+        char chunk[16384];
+        ssize_t n = recv(client->fd, chunk, sizeof(chunk), 0);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0 || md_buffer_append(&client->in, chunk, (size_t)n) != 0) {
+            return -1;
+        }
+    }
+    if (complete < 0) {
+        return -1;
+    }
+    
+    *payload = client->in.data + sizeof(md_header_t);
+    client->pending_consume = sizeof(md_header_t) + header->length;
+    return 0;
+}
+
+// Send one request and wait for its response
+static int mdc_call(mdc_client_t *client, uint16_t op, const void *payload, uint32_t len,
+                    md_header_t *header, const char **reply) {
+    if (mdc_send(client, op, payload, len, NULL) != 0 || mdc_flush(client) != 0 ||
+        mdc_recv(client, header, reply) != 0) {
+        return -1;
+    }
+    return header->status;
+}
+
+int mdc_ping(mdc_client_t *client) {
+    md_header_t header;
+    const char *reply;
+    
+    return mdc_call(client, MD_OP_PING, NULL, 0, &header, &reply);
+}
+
+int mdc_ps(mdc_client_t *client, container_info_t **infos, size_t *count) {
+    md_header_t header;
+    const char *reply;
+    uint32_t n;
+    
+    int ret = mdc_call(client, MD_OP_PS, NULL, 0, &header, &reply);
+    if (ret != 0) {
+        return ret;
+    }
+    if (header.length < sizeof(n)) {
+        return -1;
+    }
+    memcpy(&n, reply, sizeof(n));
+    
+    container_info_t *list = calloc(n ? n : 1, sizeof(*list));
+    if (!list) {
+        return -1;
+    }
+    
+    size_t offset = sizeof(n);
+    for (uint32_t i = 0; i < n; i++) {
+        if (md_decode_info(reply, header.length, &offset, &list[i]) != 0) {
+            free(list);
+            return -1;
+        }
+    }
+    
+    *infos = list;
+    *count = n;
+    return 0;
+}
+
+int mdc_inspect(mdc_client_t *client, pid_t pid, container_info_t *info) {
+    md_header_t header;
+    const char *reply;
+    int32_t id = (int32_t)pid;
+    size_t offset = 0;
+    
+    int ret = mdc_call(client, MD_OP_INSPECT, &id, sizeof(id), &header, &reply);
+    if (ret != 0) {
+        return ret;
+    }
+    return md_decode_info(reply, header.length, &offset, info);
+}
+
+int mdc_run(mdc_client_t *client, int argc, char *const argv[], pid_t *pid) {
+    md_buffer_t args = {0};
+    md_header_t header;
+    const char *reply;
+    int32_t id;
+    
+    for (int i = 0; i < argc; i++) {
+        if (md_buffer_append(&args, argv[i], strlen(argv[i]) + 1) != 0) {
+            md_buffer_free(&args);
+            return -1;
+        }
+    }
+    
+    int ret = mdc_call(client, MD_OP_RUN, args.data, (uint32_t)args.len, &header, &reply);
+    md_buffer_free(&args);
+    if (ret != 0) {
+        return ret;
+    }
+    if (header.length < sizeof(id)) {
+        return -1;
+    }
+    
+    memcpy(&id, reply, sizeof(id));
+    if (pid) {
+        *pid = (pid_t)id;
+    }
+    return 0;
+}
+
+int mdc_stop(mdc_client_t *client, pid_t pid) {
+    md_header_t header;
+    const char *reply;
+    int32_t id = (int32_t)pid;
+    
+    return mdc_call(client, MD_OP_STOP, &id, sizeof(id), &header, &reply);
+}
+
+int mdc_gc(mdc_client_t *client, gc_stats_t *stats) {
+    md_header_t header;
+    const char *reply;
+    
+    int ret = mdc_call(client, MD_OP_GC, NULL, 0, &header, &reply);
+    if (ret != 0) {
+        return ret;
+    }
+    if (header.length != sizeof(*stats)) {
+        return -1;
+    }
+    memcpy(stats, reply, sizeof(*stats));
+    return 0;
+}
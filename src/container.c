@@ -1,8 +1,21 @@
 #include "container.h"
 #include "filesystem.h"
 #include "cgroup.h"
+#include "cpuset.h"
+#include "dns.h"
+#include "events.h"
+#include "image.h"
+#include "init.h"
+#include "ksm.h"
+#include "metrics.h"
+#include "network.h"
+#include "registry.h"
+#include "security.h"
 #include "utils.h"
 #include <sys/wait.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -13,78 +26,441 @@ int container_init(void *arg) {
     container_t *container = (container_t *)arg;
     
     if (!container || !container->command) {
-        log_message(LOG_ERROR, "Invalid container configuration");
+        log_child(LOG_ERROR, "Invalid container configuration");
         return 1;
     }
     
+    // Hold until the parent has put us in our cgroup and set up the network;
+    // the parent kills us instead if that fails. It sends the container ID,
+    // which is our PID as the host sees it.
+    if (container->sync_fd != -1) {
+        pid_t id;
+        if (read(container->sync_fd, &id, sizeof(id)) != (ssize_t)sizeof(id)) {
+            return 1;
+        }
+        close(container->sync_fd);
+        container->pid = id;
+    }
+    
     // Setup filesystem isolation
-    log_message(LOG_DEBUG, "Setting up filesystem isolation");
-    if (setup_filesystem(container->image_path) != 0) {
-        log_message(LOG_ERROR, "Failed to setup filesystem isolation");
+    log_child(LOG_DEBUG, "Setting up filesystem isolation");
+    char container_root[PATH_MAX];
+    format_string(container_root, sizeof(container_root), "%s/%d", CONTAINERS_DIR, (int)container->pid);
+    if (setup_filesystem(container->lowerdir, container_root) != 0) {
+        log_child(LOG_ERROR, "Failed to setup filesystem isolation");
         return 1;
     }
     
+    // Container names resolve through the daemon's resolver on the bridge
+    if (container->use_dns && write_resolv_conf(DNS_BRIDGE_ADDR) != 0) {
+        log_child(LOG_WARN, "Failed to point /etc/resolv.conf at %s", DNS_BRIDGE_ADDR);
+    }
+    
     // Set hostname
     char hostname[256];
-    snprintf(hostname, sizeof(hostname), "minidocker-%d", (int)getpid());
+    format_string(hostname, sizeof(hostname), "minidocker-%d", (int)getpid());
     if (sethostname(hostname, strlen(hostname)) != 0) {
-        log_message(LOG_WARN, "Failed to set hostname");
+        log_child(LOG_WARN, "Failed to set hostname");
     }
     
-    // Drop capabilities (optional, uncomment if needed)
-    // if (drop_capabilities() != 0) {
-    //     log_message(LOG_WARN, "Failed to drop capabilities");
-    // }
+    // Identical pages across replicas of an image are merged by ksmd. The
+    // setting survives exec, so it covers the command and its children.
+    if (container->memory_dedup && ksm_enable_merge() != 0) {
+        log_child(LOG_WARN, "Memory deduplication unavailable: %s", strerrordesc_np(errno));
+    }
+    
+    // Last step before the command: anything after this runs confined
+    if (security_apply(container) != 0) {
+        log_child(LOG_ERROR, "Failed to apply security settings");
+        return 1;
+    }
+    
+    // Stay as PID 1 and run the command as a child
+    if (container->use_init) {
+        log_child(LOG_INFO, "Executing command under init: %s", container->command);
+        return run_init(container->command, container->args);
+    }
     
-    log_message(LOG_INFO, "Executing command: %s", container->command);
+    log_child(LOG_INFO, "Executing command: %s", container->command);
     execvp(container->command, container->args);
     
-    log_message(LOG_ERROR, "execvp failed: %s", strerror(errno));
+    log_child(LOG_ERROR, "execvp failed: %s", strerrordesc_np(errno));
     return 1;
 }
 
-int create_container(container_t *container) {
-    log_message(LOG_INFO, "Creating new container");
+static void setup_container_network(container_t *container) {
+    pid_t pid = container->pid;
     
-    // TODO: Setup cgroups for resource limits
-    char cgroup_name[256];
-    int ret = snprintf(cgroup_name, sizeof(cgroup_name), "minidocker_%d", (int)getpid());
-    if (ret >= (int)sizeof(cgroup_name) || ret < 0) {
-        log_message(LOG_ERROR, "Cgroup name too long");
+    if (container->network_mode == NETWORK_HOST) {
+        log_message(LOG_DEBUG, "Using host network for PID %d", pid);
+        return;
+    }
+    
+    if (setup_network_namespace(pid) != 0) {
+        log_message(LOG_WARN, "Failed to setup network namespace");
+        return;
+    }
+    
+    switch (container->network_mode) {
+    case NETWORK_NONE:
+        if (configure_container_loopback(pid) != 0) {
+            log_message(LOG_WARN, "Failed to configure container network");
+        }
+        break;
+        
+    case NETWORK_MACVLAN:
+    case NETWORK_IPVLAN:
+        if (attach_container_to_parent(pid, container->network_mode,
+                                       container->network_parent,
+                                       container->network_ip) != 0) {
+            log_message(LOG_WARN, "Failed to configure container network");
+        }
+        break;
+        
+    default: {
+        char veth_host[32], veth_container[32];
+        snprintf(veth_host, sizeof(veth_host), "veth%dh", pid);
+        snprintf(veth_container, sizeof(veth_container), "veth%dc", pid);
+        
+        if (allocate_container_ip(pid, container->bridge_ip, sizeof(container->bridge_ip)) != 0) {
+            log_message(LOG_WARN, "Failed to allocate container IP");
+            break;
+        }
+        
+        if (create_veth_pair(veth_host, veth_container) == 0) {
+            if (configure_container_network(pid, veth_host, veth_container,
+                                            container->bridge_ip) != 0) {
+                log_message(LOG_WARN, "Failed to configure container network");
+            }
+        } else {
+            log_message(LOG_WARN, "Failed to create veth pair");
+        }
+        
+        // Publish ports
+        for (int i = 0; i < container->num_ports; i++) {
+            if (publish_port(container->bridge_ip, &container->ports[i]) != 0) {
+                log_message(LOG_WARN, "Failed to publish port %u",
+                            container->ports[i].host_port);
+            }
+        }
+        break;
+    }
+    }
+}
+
+// A DNS name: letters, digits, '-', '_' and '.', starting with a letter
+// or digit
+static int valid_container_name(const char *name) {
+    size_t len = strlen(name);
+    
+    return len > 0 && len < CONTAINER_NAME_MAX && isalnum((unsigned char)name[0]) &&
+           strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_.") == len;
+}
+
+int parse_run_args(int argc, char *argv[], container_t *container) {
+    memset(container, 0, sizeof(*container));
+    container->cpu_limit = 100;  // Default CPU shares
+    container->memory_limit = 128 * 1024 * 1024;  // Default 128MB
+    container->health_interval_ms = 30 * 1000;
+    container->health_timeout_ms = 30 * 1000;
+    container->health_retries = 3;
+    container->sync_fd = -1;
+    container->cap_bset = default_capabilities();
+    
+    // Parse options preceding the image
+    int cpuset_policy_given = 0;
+    int i = 0;
+    while (i < argc && argv[i][0] == '-') {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            if (container->num_ports >= MAX_PORT_MAPPINGS) {
+                fprintf(stderr, "Error: Too many published ports\n");
+                return -1;
+            }
+            if (parse_port_mapping(argv[i + 1], &container->ports[container->num_ports]) != 0) {
+                fprintf(stderr, "Error: Invalid port mapping: %s\n", argv[i + 1]);
+                return -1;
+            }
+            container->num_ports++;
+            i += 2;
+        } else if (strcmp(argv[i], "--network") == 0 && i + 1 < argc) {
+            if (parse_network_mode(argv[i + 1], &container->network_mode,
+                                   container->network_parent,
+                                   sizeof(container->network_parent)) != 0) {
+                fprintf(stderr, "Error: Invalid network mode: %s\n", argv[i + 1]);
+                return -1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--health-cmd") == 0 && i + 1 < argc) {
+            container->health_cmd = argv[i + 1];
+            i += 2;
+        } else if ((strcmp(argv[i], "--health-interval") == 0 ||
+                    strcmp(argv[i], "--health-timeout") == 0) && i + 1 < argc) {
+            int *target = strcmp(argv[i], "--health-interval") == 0 ?
+                          &container->health_interval_ms : &container->health_timeout_ms;
+            if (parse_duration_ms(argv[i + 1], target) != 0 || *target <= 0) {
+                fprintf(stderr, "Error: Invalid duration: %s\n", argv[i + 1]);
+                return -1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--health-retries") == 0 && i + 1 < argc) {
+            container->health_retries = atoi(argv[i + 1]);
+            if (container->health_retries <= 0) {
+                fprintf(stderr, "Error: Invalid retry count: %s\n", argv[i + 1]);
+                return -1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--init") == 0) {
+            container->use_init = 1;
+            i++;
+        } else if (strcmp(argv[i], "--restart") == 0 && i + 1 < argc) {
+            if (parse_restart_policy(argv[i + 1], &container->restart_policy,
+                                     &container->restart_max) != 0) {
+                fprintf(stderr, "Error: Invalid restart policy: %s\n", argv[i + 1]);
+                return -1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            container->cpus = atoi(argv[i + 1]);
+            if (container->cpus <= 0 || container->cpus > CPUSET_MAX_CPUS) {
+                fprintf(stderr, "Error: Invalid CPU count: %s\n", argv[i + 1]);
+                return -1;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--cpuset-policy") == 0 && i + 1 < argc) {
+            if (parse_cpuset_policy(argv[i + 1], &container->cpuset_policy) != 0) {
+                fprintf(stderr, "Error: Invalid cpuset policy: %s\n", argv[i + 1]);
+                return -1;
+            }
+            cpuset_policy_given = 1;
+            i += 2;
+        } else if (strcmp(argv[i], "--security-opt") == 0 && i + 1 < argc) {
+            if (strncmp(argv[i + 1], "seccomp=", 8) != 0 || argv[i + 1][8] == '\0') {
+                fprintf(stderr, "Error: Invalid security option: %s\n", argv[i + 1]);
+                return -1;
+            }
+            container->seccomp_profile = argv[i + 1] + 8;
+            i += 2;
+        } else if ((strcmp(argv[i], "--cap-add") == 0 ||
+                    strcmp(argv[i], "--cap-drop") == 0) && i + 1 < argc) {
+            int cap;
+            if (parse_capability(argv[i + 1], &cap) != 0) {
+                fprintf(stderr, "Error: Unknown capability: %s\n", argv[i + 1]);
+                return -1;
+            }
+            uint64_t mask = cap == -1 ? ~0ULL : 1ULL << cap;
+            if (strcmp(argv[i], "--cap-add") == 0) {
+                container->cap_bset |= mask;
+            } else {
+                container->cap_bset &= ~mask;
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "--memory-dedup") == 0) {
+            container->memory_dedup = 1;
+            i++;
+        } else if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            if (!valid_container_name(argv[i + 1])) {
+                fprintf(stderr, "Error: Invalid container name: %s\n", argv[i + 1]);
+                return -1;
+            }
+            container->name = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--alias") == 0 && i + 1 < argc) {
+            if (!valid_container_name(argv[i + 1]) || container->num_aliases >= MAX_ALIASES) {
+                fprintf(stderr, "Error: Invalid or too many aliases: %s\n", argv[i + 1]);
+                return -1;
+            }
+            container->aliases[container->num_aliases++] = argv[i + 1];
+            i += 2;
+        } else if (strcmp(argv[i], "--ip") == 0 && i + 1 < argc) {
+            if (strspn(argv[i + 1], "0123456789./") != strlen(argv[i + 1])) {
+                fprintf(stderr, "Error: Invalid IP address: %s\n", argv[i + 1]);
+                return -1;
+            }
+            container->network_ip = argv[i + 1];
+            i += 2;
+        } else {
+            fprintf(stderr, "Error: Unknown option: %s\n", argv[i]);
+            return -1;
+        }
+    }
+    
+    if (container->num_ports > 0 && container->network_mode != NETWORK_BRIDGE) {
+        fprintf(stderr, "Error: Publishing ports requires bridge networking\n");
+        return -1;
+    }
+    if (container->network_ip && container->network_mode != NETWORK_MACVLAN &&
+        container->network_mode != NETWORK_IPVLAN) {
+        fprintf(stderr, "Error: --ip is only supported with macvlan/ipvlan networking\n");
+        return -1;
+    }
+    
+    if (container->num_aliases > 0 && container->network_mode != NETWORK_BRIDGE) {
+        fprintf(stderr, "Error: --alias requires bridge networking\n");
+        return -1;
+    }
+    
+    if (cpuset_policy_given && container->cpus == 0) {
+        fprintf(stderr, "Error: --cpuset-policy requires --cpus\n");
+        return -1;
+    }
+    
+    if (argc - i < 2) {
+        fprintf(stderr, "Usage: minidocker run [options] <image> <command> [args...]\n");
+        return -1;
+    }
+    
+    // Validate arguments
+    if (!argv[i] || !argv[i + 1]) {
+        fprintf(stderr, "Error: Invalid arguments\n");
         return -1;
     }
     
+    container->image_path = argv[i];
+    container->command = argv[i + 1];
+    container->args = &argv[i + 1];
+    container->run_argc = argc;
+    container->run_argv = argv;
+    
+    return 0;
+}
+
+// "no", "always", "unless-stopped", "on-failure" or "on-failure:N"
+int parse_restart_policy(const char *spec, restart_policy_t *policy, int *max) {
+    *max = 0;
+    
+    if (strcmp(spec, "no") == 0) {
+        *policy = RESTART_NO;
+    } else if (strcmp(spec, "always") == 0) {
+        *policy = RESTART_ALWAYS;
+    } else if (strcmp(spec, "unless-stopped") == 0) {
+        *policy = RESTART_UNLESS_STOPPED;
+    } else if (strncmp(spec, "on-failure", 10) == 0) {
+        *policy = RESTART_ON_FAILURE;
+        if (spec[10] == ':') {
+            char *end;
+            long value = strtol(spec + 11, &end, 10);
+            if (end == spec + 11 || *end != '\0' || value <= 0 || value > 1000000) {
+                return -1;
+            }
+            *max = (int)value;
+        } else if (spec[10] != '\0') {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    
+    return 0;
+}
+
+int format_restart_policy(restart_policy_t policy, int max, char *buf, size_t len) {
+    const char *name;
+    
+    switch (policy) {
+    case RESTART_ON_FAILURE:     name = "on-failure"; break;
+    case RESTART_ALWAYS:         name = "always"; break;
+    case RESTART_UNLESS_STOPPED: name = "unless-stopped"; break;
+    default:                     name = "no"; break;
+    }
+    
+    int ret = policy == RESTART_ON_FAILURE && max > 0 ?
+              snprintf(buf, len, "%s:%d", name, max) : snprintf(buf, len, "%s", name);
+    return ret < 0 || (size_t)ret >= len ? -1 : 0;
+}
+
+// Kill and reap a child that could not be set up
+static void abort_child(pid_t pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+int create_container(container_t *container) {
+    log_message(LOG_INFO, "Creating new container");
+    uint64_t start_ns = metrics_now_ns();
+    
     // TODO: Create namespaces (PID, UTS, Mount, IPC, Network)
     int flags = CLONE_NEWPID | CLONE_NEWUTS | CLONE_NEWNS | 
                 CLONE_NEWIPC | CLONE_NEWNET;
     
-    // Setup cgroups first
-    if (setup_cgroup(cgroup_name) != 0) {
-        log_message(LOG_ERROR, "Failed to setup cgroup");
-        return -1;
+    // Host networking shares the host network namespace
+    if (container->network_mode == NETWORK_HOST) {
+        flags &= ~CLONE_NEWNET;
     }
     
     // Setup network bridge
-    if (setup_bridge() != 0) {
+    if (container->network_mode == NETWORK_BRIDGE && setup_bridge() != 0) {
         log_message(LOG_ERROR, "Failed to setup network bridge");
-        cleanup_cgroup(cgroup_name);
+        metrics_inc(METRIC_CREATE_FAILURES);
+        return -1;
+    }
+    
+    // Mount the image here rather than in the child, so that it is mounted
+    // once on the host and every container's mount namespace inherits it
+    if (image_prepare(container->image_path, container->lowerdir, sizeof(container->lowerdir)) != 0) {
+        log_message(LOG_ERROR, "Failed to prepare image %s", container->image_path);
+        metrics_inc(METRIC_CREATE_FAILURES);
+        return -1;
+    }
+    
+    // Opting in does nothing unless ksmd is scanning
+    if (container->memory_dedup && ksm_start() != 0) {
+        log_message(LOG_WARN, "Failed to start kernel same-page merging");
+    }
+    
+    // Compiled or loaded from the cache here, so the child only has to
+    // install it
+    if (security_prepare(container) != 0) {
+        log_message(LOG_ERROR, "Failed to prepare seccomp filter");
+        metrics_inc(METRIC_CREATE_FAILURES);
+        return -1;
+    }
+    
+    uint64_t setup_ns = metrics_now_ns();
+    metrics_observe(PHASE_CREATE_SETUP, setup_ns - start_ns);
+    
+    // The cgroup is named after the container's PID, so it can only be
+    // created after the clone; the child waits on this pipe until then
+    int sync_pipe[2];
+    if (pipe2(sync_pipe, O_CLOEXEC) == -1) {
+        log_message(LOG_ERROR, "Failed to create sync pipe");
+        security_release(container);
+        metrics_inc(METRIC_CREATE_FAILURES);
         return -1;
     }
+    container->sync_fd = sync_pipe[0];
     
     // Allocate stack for child process
     char *stack = malloc(STACK_SIZE);
     if (!stack) {
         log_message(LOG_ERROR, "Failed to allocate stack memory");
-        cleanup_cgroup(cgroup_name);
+        close(sync_pipe[0]);
+        close(sync_pipe[1]);
+        security_release(container);
+        metrics_inc(METRIC_CREATE_FAILURES);
         return -1;
     }
     
     // Create child process with namespaces
     pid_t pid = clone(container_init, stack + STACK_SIZE, flags | SIGCHLD, container);
+    close(sync_pipe[0]);
+    container->sync_fd = -1;
+    security_release(container);  // The child has its own copy
     if (pid == -1) {
         log_message(LOG_ERROR, "Failed to create container process");
         free(stack);
-        cleanup_cgroup(cgroup_name);
+        close(sync_pipe[1]);
+        metrics_inc(METRIC_CREATE_FAILURES);
+        return -1;
+    }
+    
+    // Setup cgroups
+    char cgroup_name[256];
+    snprintf(cgroup_name, sizeof(cgroup_name), "minidocker_%d", (int)pid);
+    if (setup_cgroup(cgroup_name) != 0) {
+        log_message(LOG_ERROR, "Failed to setup cgroup");
+        abort_child(pid);
+        close(sync_pipe[1]);
+        metrics_inc(METRIC_CREATE_FAILURES);
         return -1;
     }
     
@@ -101,11 +477,16 @@ int create_container(container_t *container) {
         set_cpu_limit(cgroup_name, container->cpu_limit);
     }
     
-    // Wait for child to start before returning
-    int status;
-    pid_t wait_result = waitpid(pid, &status, WNOHANG);
-    if (wait_result == -1) {
-        log_message(LOG_WARN, "Failed to check child process status");
+    // Pinned CPUs; the map is keyed by the container ID
+    char cpus[1024];
+    if (container->cpus > 0 &&
+        cpuset_assign(pid, container->cpus, container->cpuset_policy, cpus, sizeof(cpus)) != 0) {
+        log_message(LOG_ERROR, "Failed to place container on %d CPUs", container->cpus);
+        abort_child(pid);
+        cleanup_cgroup(cgroup_name);
+        close(sync_pipe[1]);
+        metrics_inc(METRIC_CREATE_FAILURES);
+        return -1;
     }
     
     // Note: Stack memory will be cleaned up when child exits
@@ -113,32 +494,77 @@ int create_container(container_t *container) {
     
     container->pid = pid;
     log_message(LOG_INFO, "Container created with PID: %d", (int)pid);
+    events_emit(EVENT_CREATE, pid, 0, container->command);
+    uint64_t clone_ns = metrics_now_ns();
+    metrics_observe(PHASE_CREATE_CLONE, clone_ns - setup_ns);
     
     // Setup network for container
-    if (setup_network_namespace(pid) == 0) {
-        char veth_host[32], veth_container[32];
-        snprintf(veth_host, sizeof(veth_host), "veth%dh", pid);
-        snprintf(veth_container, sizeof(veth_container), "veth%dc", pid);
-        
-        if (create_veth_pair(veth_host, veth_container) == 0) {
-            if (configure_container_network(pid, veth_host, veth_container) != 0) {
-                log_message(LOG_WARN, "Failed to configure container network");
-            }
-        } else {
-            log_message(LOG_WARN, "Failed to create veth pair");
-        }
-    } else {
-        log_message(LOG_WARN, "Failed to setup network namespace");
+    setup_container_network(container);
+    uint64_t network_ns = metrics_now_ns();
+    metrics_observe(PHASE_CREATE_NETWORK, network_ns - clone_ns);
+    
+    // Let the container run
+    if (write(sync_pipe[1], &pid, sizeof(pid)) != (ssize_t)sizeof(pid)) {
+        log_message(LOG_WARN, "Failed to release container process");
     }
+    close(sync_pipe[1]);
     
     // Add container to registry
     if (registry_add_container(container) != 0) {
         log_message(LOG_WARN, "Failed to add container to registry");
     }
+    events_emit(EVENT_START, pid, 0, container->command);
+    
+    uint64_t done_ns = metrics_now_ns();
+    metrics_observe(PHASE_CREATE_REGISTRY, done_ns - network_ns);
+    metrics_observe(PHASE_CREATE_TOTAL, done_ns - start_ns);
+    metrics_inc(METRIC_CONTAINERS_CREATED);
     
     return 0;
 }
 
+// Starts a fresh process for an existing container. The cgroup and network
+// namespace outlive the old process, so only the clone and exec are redone;
+// addresses, routes and published ports stay as they were.
+pid_t respawn_container(container_t *container, int netns_fd, int cgroup_fd, int *pidfd) {
+    uint64_t flags = CLONE_NEWPID | CLONE_NEWUTS | CLONE_NEWNS | CLONE_NEWIPC;
+    
+    // Normally a no-op, unless the image was unmounted since the last start
+    if (image_prepare(container->image_path, container->lowerdir, sizeof(container->lowerdir)) != 0 ||
+        security_prepare(container) != 0) {
+        return -1;
+    }
+    
+    pid_t pid = clone_into_cgroup(flags, cgroup_fd, pidfd);
+    if (pid != 0) {
+        security_release(container);
+    }
+    if (pid == -1) {
+        log_message(LOG_ERROR, "Failed to respawn container process: %s", strerror(errno));
+        return -1;
+    }
+    
+    if (pid == 0) {
+        if (netns_fd != -1 && setns(netns_fd, CLONE_NEWNET) == -1) {
+            log_child(LOG_ERROR, "Failed to join container network namespace");
+            _exit(1);
+        }
+        _exit(container_init(container));
+    }
+    
+    return pid;
+}
+
+// The process currently running a container, which changes on restart
+pid_t container_process_pid(pid_t id) {
+    container_info_t info;
+    
+    if (registry_get_container(id, &info) == 0 && info.process_pid > 0) {
+        return info.process_pid;
+    }
+    return id;
+}
+
 int start_container(container_t *container) {
     // TODO: Implement container start logic
     if (!container) {
@@ -149,64 +575,111 @@ int start_container(container_t *container) {
     return 0;
 }
 
-int stop_container(pid_t pid) {
-    log_message(LOG_INFO, "Stopping container with PID: %d", (int)pid);
+// Wait for a process to exit, which works whether or not it is our child
+static int wait_for_exit(int pidfd, int timeout_ms) {
+    struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+    int ret;
+    
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret == -1 && errno == EINTR);
+    
+    return ret > 0 ? 0 : -1;
+}
+
+// SIGTERM, then SIGKILL after 10 seconds. Sets *code if the process was
+// our child and could be reaped, otherwise leaves it at -1.
+static int terminate_process(pid_t pid, int *code) {
+    int pidfd = open_pidfd(pid);
+    if (pidfd == -1) {
+        log_message(LOG_ERROR, "Failed to open pidfd for PID %d", (int)pid);
+        return -1;
+    }
     
     // First try graceful shutdown with SIGTERM
     if (kill(pid, SIGTERM) == -1) {
         log_message(LOG_ERROR, "Failed to send SIGTERM to PID %d", (int)pid);
+        close(pidfd);
         return -1;
     }
     
     // Wait up to 10 seconds for graceful shutdown
-    time_t start_time = time(NULL);
     int status;
-    while (time(NULL) - start_time < 10) {
-        pid_t result = waitpid(pid, &status, WNOHANG);
-        if (result == pid) {
-            log_message(LOG_INFO, "Container stopped gracefully");
-            registry_update_container_status(pid, "stopped");
-            cleanup_container_resources(pid);
-            return 0;
-        } else if (result == -1) {
-            log_message(LOG_ERROR, "Failed to wait for container PID %d", (int)pid);
+    if (wait_for_exit(pidfd, 10000) == 0) {
+        log_message(LOG_INFO, "Container stopped gracefully");
+    } else {
+        // If still running after timeout, force kill
+        log_message(LOG_WARN, "Container didn't stop gracefully, forcing kill");
+        if (kill(pid, SIGKILL) == -1) {
+            log_message(LOG_ERROR, "Failed to send SIGKILL to PID %d", (int)pid);
+            close(pidfd);
+            return -1;
+        }
+        
+        // Wait for the forced kill
+        if (wait_for_exit(pidfd, -1) != 0) {
+            log_message(LOG_ERROR, "Failed to wait for container after SIGKILL");
+            close(pidfd);
             return -1;
         }
-        usleep(100000); // Sleep for 100ms
     }
+    close(pidfd);
     
-    // If still running after timeout, force kill
-    log_message(LOG_WARN, "Container didn't stop gracefully, forcing kill");
-    if (kill(pid, SIGKILL) == -1) {
-        log_message(LOG_ERROR, "Failed to send SIGKILL to PID %d", (int)pid);
-        return -1;
+    // Reap it if it is ours; containers started by another CLI are not
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+        *code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
     }
+    return 0;
+}
+
+int stop_container(pid_t id) {
+    log_message(LOG_INFO, "Stopping container with PID: %d", (int)id);
     
-    // Wait for the forced kill
-    if (waitpid(pid, &status, 0) == -1) {
-        log_message(LOG_ERROR, "Failed to wait for container after SIGKILL");
-        return -1;
+    container_info_t info;
+    int found = registry_get_container(id, &info) == 0;
+    int between_restarts = found && (strcmp(info.status, "restarting") == 0 ||
+                                     strcmp(info.status, "crashloop") == 0);
+    
+    // Tells a supervisor watching the container not to restart it
+    registry_update_container_status(id, "stopping");
+    
+    // Waiting out a restart backoff there is no process to signal
+    if (!between_restarts) {
+        int code = -1;
+        if (terminate_process(container_process_pid(id), &code) != 0) {
+            if (found) {
+                registry_update_container_status(id, info.status);
+            }
+            return -1;
+        }
+        events_emit(EVENT_EXIT, id, code, NULL);
     }
     
-    registry_update_container_status(pid, "stopped");
-    cleanup_container_resources(pid);
+    registry_update_container_status(id, "stopped");
+    cleanup_container_resources(id);
+    events_emit(EVENT_STOP, id, 0, NULL);
     return 0;
 }
 
-static int cleanup_container_resources(pid_t pid) {
+int cleanup_container_resources(pid_t pid) {
     char cgroup_path[256];
     char container_root[PATH_MAX];
     
-    // Clean up cgroups
+    // Clean up cgroups, returning any pinned CPUs first
+    cpuset_release(pid);
     snprintf(cgroup_path, sizeof(cgroup_path), "minidocker_%d", (int)pid);
     cleanup_cgroup(cgroup_path);
     
-    // Clean up network
+    // Clean up published ports and network
+    port_mapping_t ports[MAX_PORT_MAPPINGS];
+    int num_ports = registry_get_ports(pid, ports, MAX_PORT_MAPPINGS);
+    for (int i = 0; i < num_ports; i++) {
+        unpublish_port(&ports[i]);
+    }
     cleanup_container_network(pid);
     
     // Clean up filesystem
-    snprintf(container_root, sizeof(container_root),
-             "/var/lib/minidocker/containers/%d", (int)pid);
+    snprintf(container_root, sizeof(container_root), "%s/%d", CONTAINERS_DIR, (int)pid);
     cleanup_filesystem(container_root);
     
     return 0;
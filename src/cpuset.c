@@ -0,0 +1,668 @@
+#include "cpuset.h"
+#include "cgroup.h"
+#include "registry.h"
+#include "utils.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define CPU_SYSFS "/sys/devices/system/cpu"
+#define NODE_SYSFS "/sys/devices/system/node"
+#define CPUSET_MAP "/var/lib/minidocker/cpuset.map"
+#define CPULIST_MAX 4096
+#define CACHE_INDEX_MAX 16
+
+typedef struct {
+    int cpu;
+    int core;                  // Lowest CPU of its SMT siblings
+    int domain;
+    int node;
+} cpu_info_t;
+
+// Online CPUs sorted by domain, then core, so that siblings and cache
+// neighbours are adjacent
+typedef struct {
+    cpu_info_t cpus[CPUSET_MAX_CPUS];
+    int count;
+    int domains;
+} topology_t;
+
+// Loaded once; CPU hotplug needs a daemon restart to be seen
+static topology_t topology;
+static int topology_loaded;
+
+// Allocation map, indexed by CPU number: the isolated container that owns
+// it or 0, and how many pack and spread containers share it
+static pid_t owner[CPUSET_MAX_CPUS];
+static int sharers[CPUSET_MAX_CPUS];
+
+// Pack and spread may use a CPU with at most this many sharers; raised one
+// step at a time until the request fits
+static int share_level;
+
+// Indexed by core: some CPU of the core is owned or being chosen
+static unsigned char core_busy[CPUSET_MAX_CPUS];
+
+static int parse_cpulist(const char *list, unsigned char set[CPUSET_MAX_CPUS]) {
+    memset(set, 0, CPUSET_MAX_CPUS);
+    
+    const char *p = list;
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) {
+                return -1;
+            }
+        }
+        if (first < 0 || last < first || last >= CPUSET_MAX_CPUS) {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            set[cpu] = 1;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    
+    return 0;
+}
+
+static int format_cpulist(const unsigned char set[CPUSET_MAX_CPUS], char *buf, size_t len) {
+    size_t used = 0;
+    
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < CPUSET_MAX_CPUS; cpu++) {
+        if (!set[cpu]) {
+            continue;
+        }
+        int last = cpu;
+        while (last + 1 < CPUSET_MAX_CPUS && set[last + 1]) {
+            last++;
+        }
+        int n = last == cpu ?
+                snprintf(buf + used, len - used, "%s%d", used ? "," : "", cpu) :
+                snprintf(buf + used, len - used, "%s%d-%d", used ? "," : "", cpu, last);
+        if (n < 0 || (size_t)n >= len - used) {
+            return -1;
+        }
+        used += (size_t)n;
+        cpu = last;
+    }
+    
+    return 0;
+}
+
+static int read_line(const char *path, char *buf, size_t len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+// The lowest CPU in a sysfs CPU list, which names the group it describes
+static int first_cpu(const char *path) {
+    char list[CPULIST_MAX];
+    unsigned char set[CPUSET_MAX_CPUS];
+    
+    if (read_line(path, list, sizeof(list)) != 0 || parse_cpulist(list, set) != 0) {
+        return -1;
+    }
+    for (int cpu = 0; cpu < CPUSET_MAX_CPUS; cpu++) {
+        if (set[cpu]) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+static int l3_group(int cpu) {
+    char path[256];
+    char level[16];
+    
+    for (int index = 0; index < CACHE_INDEX_MAX; index++) {
+        snprintf(path, sizeof(path), "%s/cpu%d/cache/index%d/level", CPU_SYSFS, cpu, index);
+        if (read_line(path, level, sizeof(level)) != 0) {
+            break;
+        }
+        if (strcmp(level, "3") == 0) {
+            snprintf(path, sizeof(path), "%s/cpu%d/cache/index%d/shared_cpu_list",
+                     CPU_SYSFS, cpu, index);
+            return first_cpu(path);
+        }
+    }
+    return -1;
+}
+
+static void read_nodes(int node_of[CPUSET_MAX_CPUS]) {
+    char path[512];
+    char list[CPULIST_MAX];
+    unsigned char set[CPUSET_MAX_CPUS];
+    
+    memset(node_of, 0, CPUSET_MAX_CPUS * sizeof(int));
+    DIR *dir = opendir(NODE_SYSFS);
+    if (!dir) {
+        return;
+    }
+    
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int node;
+        char extra;
+        if (sscanf(entry->d_name, "node%d%c", &node, &extra) != 1) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s/cpulist", NODE_SYSFS, entry->d_name);
+        if (read_line(path, list, sizeof(list)) != 0 || parse_cpulist(list, set) != 0) {
+            continue;
+        }
+        for (int cpu = 0; cpu < CPUSET_MAX_CPUS; cpu++) {
+            if (set[cpu]) {
+                node_of[cpu] = node;
+            }
+        }
+    }
+    
+    closedir(dir);
+}
+
+static int compare_cpu(const void *a, const void *b) {
+    const cpu_info_t *x = (const cpu_info_t *)a;
+    const cpu_info_t *y = (const cpu_info_t *)b;
+    
+    if (x->domain != y->domain) {
+        return x->domain - y->domain;
+    }
+    if (x->core != y->core) {
+        return x->core - y->core;
+    }
+    return x->cpu - y->cpu;
+}
+
+static int load_topology(void) {
+    char list[CPULIST_MAX];
+    unsigned char online[CPUSET_MAX_CPUS];
+    int node_of[CPUSET_MAX_CPUS];
+    int domain_l3[CPUSET_MAX_CPUS], domain_node[CPUSET_MAX_CPUS];
+    char path[256];
+    
+    if (topology_loaded) {
+        return 0;
+    }
+    if (read_line(CPU_SYSFS "/online", list, sizeof(list)) != 0 ||
+        parse_cpulist(list, online) != 0) {
+        log_message(LOG_ERROR, "Failed to read online CPUs");
+        return -1;
+    }
+    read_nodes(node_of);
+    
+    topology.count = 0;
+    topology.domains = 0;
+    for (int cpu = 0; cpu < CPUSET_MAX_CPUS; cpu++) {
+        if (!online[cpu]) {
+            continue;
+        }
+        cpu_info_t *info = &topology.cpus[topology.count++];
+        info->cpu = cpu;
+        info->node = node_of[cpu];
+    
+        snprintf(path, sizeof(path), "%s/cpu%d/topology/thread_siblings_list", CPU_SYSFS, cpu);
+        info->core = first_cpu(path);
+        if (info->core == -1) {
+            info->core = cpu;
+        }
+    
+        // With sub-NUMA clustering one L3 spans several nodes, so a domain
+        // is the pair
+        int l3 = l3_group(cpu);
+        int d;
+        for (d = 0; d < topology.domains; d++) {
+            if (domain_l3[d] == l3 && domain_node[d] == info->node) {
+                break;
+            }
+        }
+        if (d == topology.domains) {
+            domain_l3[d] = l3;
+            domain_node[d] = info->node;
+            topology.domains++;
+        }
+        info->domain = d;
+    }
+    
+    qsort(topology.cpus, (size_t)topology.count, sizeof(cpu_info_t), compare_cpu);
+    topology_loaded = 1;
+    log_message(LOG_DEBUG, "CPU topology: %d CPUs in %d domains", topology.count, topology.domains);
+    return 0;
+}
+
+// Isolated CPUs are never shared; the rest are open to pack and spread
+static int unavailable(int cpu) {
+    return owner[cpu] || sharers[cpu] > share_level;
+}
+
+static void mark_busy_cores(void) {
+    memset(core_busy, 0, sizeof(core_busy));
+    for (int i = 0; i < topology.count; i++) {
+        int cpu = topology.cpus[i].cpu;
+        if (owner[cpu] || sharers[cpu]) {
+            core_busy[topology.cpus[i].core] = 1;
+        }
+    }
+}
+
+static void choose(const cpu_info_t *c, unsigned char chosen[CPUSET_MAX_CPUS]) {
+    chosen[c->cpu] = 1;
+    core_busy[c->core] = 1;
+}
+
+static int free_in_domain(int d) {
+    int n = 0;
+    for (int i = 0; i < topology.count; i++) {
+        if (topology.cpus[i].domain == d && !unavailable(topology.cpus[i].cpu)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+// Domains ordered by free CPUs, most first
+static void order_domains(int order[CPUSET_MAX_CPUS]) {
+    int free_cpus[CPUSET_MAX_CPUS];
+    
+    for (int d = 0; d < topology.domains; d++) {
+        order[d] = d;
+        free_cpus[d] = free_in_domain(d);
+    }
+    for (int i = 1; i < topology.domains; i++) {
+        for (int j = i; j > 0 && free_cpus[order[j]] > free_cpus[order[j - 1]]; j--) {
+            int tmp = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = tmp;
+        }
+    }
+}
+
+// Takes up to want free CPUs from a domain, first the ones whose core is
+// already partly used, so whole cores stay free for others
+static int take_from_domain(int d, int want, unsigned char chosen[CPUSET_MAX_CPUS]) {
+    int taken = 0;
+    
+    for (int pass = 0; pass < 2 && taken < want; pass++) {
+        for (int i = 0; i < topology.count && taken < want; i++) {
+            const cpu_info_t *c = &topology.cpus[i];
+            if (c->domain != d || unavailable(c->cpu) || chosen[c->cpu]) {
+                continue;
+            }
+            if (pass == 0 && !core_busy[c->core]) {
+                continue;
+            }
+            choose(c, chosen);
+            taken++;
+        }
+    }
+    return taken;
+}
+
+static int place_pack(int want, unsigned char chosen[CPUSET_MAX_CPUS]) {
+    int best = -1, best_free = 0;
+    
+    // Best fit: the domain with the least room that still holds everything
+    for (int d = 0; d < topology.domains; d++) {
+        int n = free_in_domain(d);
+        if (n >= want && (best == -1 || n < best_free)) {
+            best = d;
+            best_free = n;
+        }
+    }
+    if (best != -1) {
+        return take_from_domain(best, want, chosen) == want ? 0 : -1;
+    }
+    
+    int order[CPUSET_MAX_CPUS];
+    int taken = 0;
+    order_domains(order);
+    for (int i = 0; i < topology.domains && taken < want; i++) {
+        taken += take_from_domain(order[i], want - taken, chosen);
+    }
+    return taken == want ? 0 : -1;
+}
+
+static int place_spread(int want, unsigned char chosen[CPUSET_MAX_CPUS]) {
+    int order[CPUSET_MAX_CPUS];
+    int taken = 0;
+    int shared_cores = 0;      // Set once no idle core is left anywhere
+    
+    order_domains(order);
+    while (taken < want) {
+        int progress = 0;
+        for (int i = 0; i < topology.domains && taken < want; i++) {
+            for (int j = 0; j < topology.count; j++) {
+                const cpu_info_t *c = &topology.cpus[j];
+                if (c->domain != order[i] || unavailable(c->cpu) || chosen[c->cpu] ||
+                    (!shared_cores && core_busy[c->core])) {
+                    continue;
+                }
+                choose(c, chosen);
+                taken++;
+                progress = 1;
+                break;
+            }
+        }
+        if (!progress) {
+            if (shared_cores) {
+                return -1;
+            }
+            shared_cores = 1;
+        }
+    }
+    return 0;
+}
+
+// Whole idle cores from one domain, so no other container shares their
+// caches or execution units; may return more CPUs than asked for. Cores
+// in the shared pool are busy, as a partition cannot overlap its siblings.
+static int place_isolate(int want, unsigned char chosen[CPUSET_MAX_CPUS]) {
+    int best = -1, best_cpus = 0;
+    
+    for (int d = 0; d < topology.domains; d++) {
+        int n = 0;
+        for (int i = 0; i < topology.count; i++) {
+            const cpu_info_t *c = &topology.cpus[i];
+            if (c->domain == d && !core_busy[c->core]) {
+                n++;
+            }
+        }
+        if (n >= want && (best == -1 || n < best_cpus)) {
+            best = d;
+            best_cpus = n;
+        }
+    }
+    if (best == -1) {
+        return -1;
+    }
+    
+    int taken = 0;
+    for (int i = 0; i < topology.count && taken < want; i++) {
+        const cpu_info_t *c = &topology.cpus[i];
+        if (c->domain != best || core_busy[c->core]) {
+            continue;
+        }
+        for (int j = i; j < topology.count && topology.cpus[j].core == c->core; j++) {
+            choose(&topology.cpus[j], chosen);
+            taken++;
+        }
+    }
+    return 0;
+}
+
+// A container keeps its CPUs while it is alive as gc sees it, or while its
+// cgroup has processes (it may not be registered yet)
+static int holds_cpus(pid_t id) {
+    container_info_t info;
+    
+    if (registry_get_container(id, &info) == 0) {
+        if (strcmp(info.status, "running") == 0) {
+            if (kill(info.process_pid, 0) == 0 || errno == EPERM) {
+                return 1;
+            }
+        } else if (strcmp(info.status, "exited") != 0 && strcmp(info.status, "stopped") != 0) {
+            return 1;
+        }
+    }
+    
+    char path[128];
+    char procs[32];
+    snprintf(path, sizeof(path), "/sys/fs/cgroup/minidocker_%d/cgroup.procs", (int)id);
+    return read_line(path, procs, sizeof(procs)) == 0 && procs[0] != '\0';
+}
+
+static void release_partition(pid_t id) {
+    char cgroup_name[64];
+    
+    snprintf(cgroup_name, sizeof(cgroup_name), "minidocker_%d", (int)id);
+    reset_cpuset_partition(cgroup_name);
+}
+
+// Opens and locks the map, fills owner[] from it and returns its lines
+// minus those of release_id and of containers that are gone. The caller
+// writes the lines back with save_map().
+static int load_map(pid_t release_id, int lock, char **lines_out) {
+    if (mkdir("/var/lib/minidocker", 0755) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    int fd = open(CPUSET_MAP, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 || flock(fd, lock) == -1) {
+        log_message(LOG_ERROR, "Failed to lock %s: %s", CPUSET_MAP, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    
+    struct stat st;
+    char *text = NULL, *lines = NULL;
+    if (fstat(fd, &st) == -1 || !(text = calloc(1, (size_t)st.st_size + 1)) ||
+        !(lines = calloc(1, (size_t)st.st_size + 1)) ||
+        pread(fd, text, (size_t)st.st_size, 0) != st.st_size) {
+        free(text);
+        free(lines);
+        close(fd);
+        return -1;
+    }
+    
+    memset(owner, 0, sizeof(owner));
+    memset(sharers, 0, sizeof(sharers));
+    char *save;
+    size_t kept = 0;
+    for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        int id;
+        char cpus[CPULIST_MAX], mode[16];
+        unsigned char set[CPUSET_MAX_CPUS];
+        if (sscanf(line, "%d %*s %4095s %*s %15s", &id, cpus, mode) != 3 ||
+            (strcmp(mode, "exclusive") != 0 && strcmp(mode, "shared") != 0) ||
+            parse_cpulist(cpus, set) != 0) {
+            continue;
+        }
+        int exclusive = strcmp(mode, "exclusive") == 0;
+        if ((pid_t)id == release_id || (lock == LOCK_EX && !holds_cpus((pid_t)id))) {
+            if (exclusive) {
+                release_partition((pid_t)id);
+            }
+            continue;
+        }
+        for (int cpu = 0; cpu < CPUSET_MAX_CPUS; cpu++) {
+            if (set[cpu] && exclusive) {
+                owner[cpu] = (pid_t)id;
+            } else if (set[cpu]) {
+                sharers[cpu]++;
+            }
+        }
+        size_t len = strlen(line);
+        memcpy(lines + kept, line, len);
+        lines[kept + len] = '\n';
+        kept += len + 1;
+    }
+    
+    free(text);
+    *lines_out = lines;
+    return fd;
+}
+
+static int save_map(int fd, const char *lines) {
+    size_t len = strlen(lines);
+    int ret = 0;
+    
+    if (ftruncate(fd, 0) == -1 || pwrite(fd, lines, len, 0) != (ssize_t)len) {
+        log_message(LOG_ERROR, "Failed to write %s: %s", CPUSET_MAP, strerror(errno));
+        ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
+int cpuset_assign(pid_t id, int cpus, cpuset_policy_t policy, char *cpus_out, size_t len) {
+    if (id <= 0 || cpus <= 0 || !cpus_out) {
+        log_message(LOG_ERROR, "Invalid CPU placement request");
+        return -1;
+    }
+    if (load_topology() != 0) {
+        return -1;
+    }
+    if (cpus > topology.count) {
+        log_message(LOG_ERROR, "Asked for %d CPUs but the host has %d", cpus, topology.count);
+        return -1;
+    }
+    
+    char *lines;
+    int fd = load_map(id, LOCK_EX, &lines);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    // Pack and spread first look for CPUs nobody uses, then accept ones
+    // shared with one more container each round
+    int max_sharers = 0;
+    for (int cpu = 0; cpu < CPUSET_MAX_CPUS; cpu++) {
+        if (sharers[cpu] > max_sharers) {
+            max_sharers = sharers[cpu];
+        }
+    }
+    unsigned char chosen[CPUSET_MAX_CPUS];
+    int ret;
+    for (share_level = 0; ; share_level++) {
+        memset(chosen, 0, sizeof(chosen));
+        mark_busy_cores();
+        switch (policy) {
+        case CPUSET_SPREAD:  ret = place_spread(cpus, chosen); break;
+        case CPUSET_ISOLATE: ret = place_isolate(cpus, chosen); break;
+        default:             ret = place_pack(cpus, chosen); break;
+        }
+        if (ret == 0 || policy == CPUSET_ISOLATE || share_level >= max_sharers) {
+            break;
+        }
+    }
+    share_level = 0;
+    if (ret != 0) {
+        log_message(LOG_ERROR, "No room for %d CPUs with the %s policy",
+                    cpus, cpuset_policy_name(policy));
+        goto out;
+    }
+    
+    unsigned char nodes[CPUSET_MAX_CPUS] = {0};
+    for (int i = 0; i < topology.count; i++) {
+        if (chosen[topology.cpus[i].cpu]) {
+            nodes[topology.cpus[i].node] = 1;
+        }
+    }
+    char mems[CPULIST_MAX];
+    if (format_cpulist(chosen, cpus_out, len) != 0 ||
+        format_cpulist(nodes, mems, sizeof(mems)) != 0) {
+        ret = -1;
+        goto out;
+    }
+    
+    // Only isolate gets a partition; pack and spread stay members, so their
+    // CPUs remain usable by the rest of the system
+    char cgroup_name[64];
+    int exclusive = policy == CPUSET_ISOLATE;
+    snprintf(cgroup_name, sizeof(cgroup_name), "minidocker_%d", (int)id);
+    ret = set_cpuset(cgroup_name, cpus_out, mems, exclusive ? "isolated" : "member");
+    if (ret == 1) {
+        log_message(LOG_WARN, "CPUs %s are reserved for container %d but not exclusive",
+                    cpus_out, (int)id);
+        ret = 0;
+    }
+    if (ret != 0) {
+        goto out;
+    }
+    
+    log_message(LOG_INFO, "Container %d placed on CPUs %s, memory nodes %s",
+                (int)id, cpus_out, mems);
+    char *grown = realloc(lines, strlen(lines) + strlen(cpus_out) + strlen(mems) + 64);
+    if (!grown) {
+        ret = -1;
+        goto out;
+    }
+    lines = grown;
+    sprintf(lines + strlen(lines), "%d %s %s %s %s\n", (int)id,
+            cpuset_policy_name(policy), cpus_out, mems, exclusive ? "exclusive" : "shared");
+    
+out:
+    if (save_map(fd, lines) != 0) {
+        ret = -1;
+    }
+    free(lines);
+    return ret;
+}
+
+int cpuset_release(pid_t id) {
+    char *lines;
+    int fd = load_map(id, LOCK_EX, &lines);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    int ret = save_map(fd, lines);
+    free(lines);
+    return ret;
+}
+
+int cpuset_lookup(pid_t id, char *cpus, size_t len) {
+    char *lines;
+    int fd = load_map(0, LOCK_SH, &lines);
+    if (fd == -1) {
+        return -1;
+    }
+    close(fd);
+    
+    int ret = -1;
+    char *save;
+    for (char *line = strtok_r(lines, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        int line_id;
+        char policy[16], list[CPULIST_MAX];
+        if (sscanf(line, "%d %15s %4095s", &line_id, policy, list) == 3 && (pid_t)line_id == id) {
+            ret = snprintf(cpus, len, "%s (%s)", list, policy) < (int)len ? 0 : -1;
+            break;
+        }
+    }
+    
+    free(lines);
+    return ret;
+}
+
+int parse_cpuset_policy(const char *name, cpuset_policy_t *policy) {
+    if (strcmp(name, "pack") == 0) {
+        *policy = CPUSET_PACK;
+    } else if (strcmp(name, "spread") == 0) {
+        *policy = CPUSET_SPREAD;
+    } else if (strcmp(name, "isolate") == 0) {
+        *policy = CPUSET_ISOLATE;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *cpuset_policy_name(cpuset_policy_t policy) {
+    switch (policy) {
+    case CPUSET_PACK:    return "pack";
+    case CPUSET_SPREAD:  return "spread";
+    case CPUSET_ISOLATE: return "isolate";
+    }
+    return "unknown";
+}
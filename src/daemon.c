@@ -0,0 +1,1050 @@
+#include "daemon.h"
+#include "container.h"
+#include "dns.h"
+#include "gc.h"
+#include "ksm.h"
+#include "metrics.h"
+#include "network.h"
+#include "protocol.h"
+#include "registry.h"
+#include "supervisor.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define MAX_EVENTS 128
+#define STOP_GRACE_MS (10 * 1000)
+#define MAX_RUN_ARGS 256
+#define HTTP_MAX_REQUEST 8192
+
+enum {
+    WATCH_LISTEN,
+    WATCH_METRICS_LISTEN,
+    WATCH_SIGNAL,
+    WATCH_SUPERVISOR,
+    WATCH_DNS,
+    WATCH_CREATOR,
+    WATCH_CLIENT
+};
+
+// epoll cookie; connection_t starts with one so both can share data.ptr
+typedef struct {
+    int kind;
+} daemon_watch_t;
+
+typedef struct connection {
+    daemon_watch_t watch;
+    int fd;
+    struct ucred cred;
+    md_buffer_t in;
+    md_buffer_t out;
+    int http;                  // Metrics scrape rather than control client
+    int writing;               // EPOLLOUT registered
+    int close_after_flush;     // HTTP/1.0 or "Connection: close"
+    int closed;                // Freed after the current epoll batch
+    struct connection *next;
+} connection_t;
+
+// A STOP request answered once the container has exited
+typedef struct pending_stop {
+    connection_t *conn;
+    uint32_t seq;
+    pid_t pid;
+    struct pending_stop *next;
+} pending_stop_t;
+
+// A RUN or GC request carried out on the creator thread and answered
+// from the loop once it is done
+typedef struct creator_job {
+    uint16_t op;               // MD_OP_RUN or MD_OP_GC
+    connection_t *conn;        // NULL once the client has gone
+    uint32_t seq;
+    char **argv;               // Owned copy the container's strings point into
+    container_t container;
+    gc_stats_t gc_stats;
+    int result;
+    struct creator_job *next;  // Jobs in flight; loop thread only
+    struct creator_job *link;  // Queued or done list, under creator_lock
+} creator_job_t;
+
+static int epoll_fd = -1;
+static connection_t *connections = NULL;
+static pending_stop_t *pending_stops = NULL;
+static creator_job_t *jobs = NULL;
+static daemon_watch_t listen_watch = { WATCH_LISTEN };
+static daemon_watch_t metrics_watch = { WATCH_METRICS_LISTEN };
+static daemon_watch_t signal_watch = { WATCH_SIGNAL };
+static daemon_watch_t supervisor_watch_tag = { WATCH_SUPERVISOR };
+static daemon_watch_t dns_watch = { WATCH_DNS };
+static daemon_watch_t creator_watch = { WATCH_CREATOR };
+
+// Container creation blocks for as long as pulling layers, the cgroup and
+// the network take, so it runs on one thread of its own. GC shares it, so
+// a half-created container is never mistaken for an orphan.
+static pthread_t creator_thread;
+static pthread_mutex_t creator_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t creator_wake = PTHREAD_COND_INITIALIZER;
+static creator_job_t *creator_queue = NULL;
+static creator_job_t **creator_queue_tail = &creator_queue;
+static creator_job_t *creator_done = NULL;
+static creator_job_t **creator_done_tail = &creator_done;
+static int creator_stopping = 0;
+static int creator_fd = -1;    // eventfd, bumped for every finished job
+
+static int flush_connection(connection_t *conn) {
+    while (conn->out.len > 0) {
+        ssize_t n = send(conn->fd, conn->out.data, conn->out.len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        md_buffer_consume(&conn->out, (size_t)n);
+    }
+    
+    // Reported like an error so the caller closes it
+    if (conn->out.len == 0 && conn->close_after_flush) {
+        return -1;
+    }
+    
+    // Only ask for EPOLLOUT while there is a backlog
+    int want = conn->out.len > 0;
+    if (want != conn->writing) {
+        struct epoll_event ev = {
+            .events = EPOLLIN | (want ? EPOLLOUT : 0),
+            .data.ptr = conn,
+        };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->writing = want;
+    }
+    return 0;
+}
+
+// Stops serving a connection; the memory is released by reap_connections()
+// because later events in the same batch may still point at it
+static void close_connection(connection_t *conn) {
+    if (conn->closed) {
+        return;
+    }
+    conn->closed = 1;
+    
+    pending_stop_t **stop = &pending_stops;
+    while (*stop) {
+        if ((*stop)->conn == conn) {
+            pending_stop_t *done = *stop;
+            *stop = done->next;
+            free(done);
+        } else {
+            stop = &(*stop)->next;
+        }
+    }
+    
+    // Their containers are still created, just not reported
+    for (creator_job_t *job = jobs; job; job = job->next) {
+        if (job->conn == conn) {
+            job->conn = NULL;
+        }
+    }
+    
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+}
+
+static void reap_connections(void) {
+    connection_t **link = &connections;
+    
+    while (*link) {
+        connection_t *conn = *link;
+        if (!conn->closed) {
+            link = &conn->next;
+            continue;
+        }
+        *link = conn->next;
+        md_buffer_free(&conn->in);
+        md_buffer_free(&conn->out);
+        free(conn);
+    }
+}
+
+static void reply(connection_t *conn, uint32_t seq, uint16_t op, uint16_t status,
+                  const void *payload, size_t len) {
+    size_t start = md_frame_begin(&conn->out, seq, op, status);
+    md_buffer_append(&conn->out, payload, len);
+    md_frame_end(&conn->out, start);
+}
+
+typedef struct {
+    md_buffer_t *buf;
+    uint32_t count;
+} ps_reply_t;
+
+static int encode_container(const container_info_t *info, void *arg) {
+    ps_reply_t *ps = (ps_reply_t *)arg;
+    
+    ps->count++;
+    return md_encode_info(ps->buf, info);
+}
+
+static void handle_ps(connection_t *conn, uint32_t seq) {
+    size_t start = md_frame_begin(&conn->out, seq, MD_OP_PS, MD_OK);
+    size_t count_at = conn->out.len;
+    ps_reply_t ps = { &conn->out, 0 };
+    
+    // Placeholder count, patched once the entries are encoded
+    md_buffer_append(&conn->out, &ps.count, sizeof(ps.count));
+    if (registry_foreach(encode_container, &ps) != 0) {
+        conn->out.len = start;
+        reply(conn, seq, MD_OP_PS, MD_ERR_FAILED, NULL, 0);
+        return;
+    }
+    memcpy(conn->out.data + count_at, &ps.count, sizeof(ps.count));
+    md_frame_end(&conn->out, start);
+}
+
+static void handle_inspect(connection_t *conn, uint32_t seq, const char *payload, uint32_t len) {
+    int32_t pid;
+    container_info_t info;
+    
+    if (len != sizeof(pid)) {
+        reply(conn, seq, MD_OP_INSPECT, MD_ERR_INVALID, NULL, 0);
+        return;
+    }
+    memcpy(&pid, payload, sizeof(pid));
+    
+    if (registry_get_container((pid_t)pid, &info) != 0) {
+        reply(conn, seq, MD_OP_INSPECT, MD_ERR_NOT_FOUND, NULL, 0);
+        return;
+    }
+    
+    size_t start = md_frame_begin(&conn->out, seq, MD_OP_INSPECT, MD_OK);
+    if (md_encode_info(&conn->out, &info) != 0) {
+        conn->out.len = start;
+        reply(conn, seq, MD_OP_INSPECT, MD_ERR_FAILED, NULL, 0);
+        return;
+    }
+    md_frame_end(&conn->out, start);
+}
+
+// Bridge-networked containers can be reached by name and alias through
+// the embedded resolver
+static void register_names(const container_t *container) {
+    struct in_addr addr;
+    
+    if (container->network_mode != NETWORK_BRIDGE ||
+        inet_pton(AF_INET, container->bridge_ip, &addr) != 1) {
+        return;
+    }
+    if (container->name) {
+        dns_add(container->pid, container->name, addr);
+    }
+    for (int i = 0; i < container->num_aliases; i++) {
+        dns_add(container->pid, container->aliases[i], addr);
+    }
+}
+
+static void *creator_main(void *arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&creator_lock);
+    while (!creator_stopping) {
+        creator_job_t *job = creator_queue;
+        if (!job) {
+            pthread_cond_wait(&creator_wake, &creator_lock);
+            continue;
+        }
+        creator_queue = job->link;
+        if (!creator_queue) {
+            creator_queue_tail = &creator_queue;
+        }
+        pthread_mutex_unlock(&creator_lock);
+    
+        if (job->op == MD_OP_RUN) {
+            job->result = create_container(&job->container);
+        } else {
+            job->result = gc_collect(&job->gc_stats);
+        }
+    
+        pthread_mutex_lock(&creator_lock);
+        job->link = NULL;
+        *creator_done_tail = job;
+        creator_done_tail = &job->link;
+        uint64_t one = 1;
+        if (write(creator_fd, &one, sizeof(one)) != sizeof(one)) {
+            log_message(LOG_WARN, "Failed to signal finished job: %s", strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&creator_lock);
+    return NULL;
+}
+
+static int start_creator(void) {
+    creator_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (creator_fd == -1) {
+        return -1;
+    }
+    if (pthread_create(&creator_thread, NULL, creator_main, NULL) != 0) {
+        close(creator_fd);
+        creator_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Waits for the job in hand; anything still queued is abandoned
+static void stop_creator(void) {
+    pthread_mutex_lock(&creator_lock);
+    creator_stopping = 1;
+    pthread_cond_signal(&creator_wake);
+    pthread_mutex_unlock(&creator_lock);
+    pthread_join(creator_thread, NULL);
+    close(creator_fd);
+}
+
+static void submit_job(creator_job_t *job) {
+    job->next = jobs;
+    jobs = job;
+    
+    pthread_mutex_lock(&creator_lock);
+    job->link = NULL;
+    *creator_queue_tail = job;
+    creator_queue_tail = &job->link;
+    pthread_cond_signal(&creator_wake);
+    pthread_mutex_unlock(&creator_lock);
+}
+
+static void finish_job(creator_job_t *job) {
+    connection_t *conn = job->conn;
+    
+    if (job->op == MD_OP_GC) {
+        if (conn) {
+            reply(conn, job->seq, MD_OP_GC, MD_OK, &job->gc_stats, sizeof(job->gc_stats));
+        }
+    } else if (job->result != 0) {
+        if (conn) {
+            reply(conn, job->seq, MD_OP_RUN, MD_ERR_FAILED, NULL, 0);
+        }
+    } else {
+        if (!supervisor_watch(&job->container)) {
+            log_message(LOG_WARN, "Failed to supervise container %d", (int)job->container.pid);
+        }
+        register_names(&job->container);
+        if (conn) {
+            int32_t pid = (int32_t)job->container.pid;
+            reply(conn, job->seq, MD_OP_RUN, MD_OK, &pid, sizeof(pid));
+        }
+    }
+    if (conn) {
+        flush_connection(conn);
+    }
+    
+    creator_job_t **link = &jobs;
+    while (*link != job) {
+        link = &(*link)->next;
+    }
+    *link = job->next;
+    free(job->argv);
+    free(job);
+}
+
+// Completes, in order, whatever the creator thread has finished
+static void finish_jobs(void) {
+    uint64_t count;
+    
+    if (read(creator_fd, &count, sizeof(count)) != sizeof(count)) {
+        return;
+    }
+    
+    pthread_mutex_lock(&creator_lock);
+    creator_job_t *done = creator_done;
+    creator_done = NULL;
+    creator_done_tail = &creator_done;
+    pthread_mutex_unlock(&creator_lock);
+    
+    while (done) {
+        creator_job_t *job = done;
+        done = job->link;
+        finish_job(job);
+    }
+}
+
+// Names of containers still being created are as taken as running ones
+static int name_in_use(const char *name) {
+    struct in_addr taken;
+    
+    if (dns_lookup(name, &taken, 1) > 0) {
+        return 1;
+    }
+    for (creator_job_t *job = jobs; job; job = job->next) {
+        if (job->op == MD_OP_RUN && job->container.name &&
+            strcasecmp(job->container.name, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Validated here, created on the creator thread and answered by finish_job()
+static void handle_run(connection_t *conn, uint32_t seq, const char *payload, uint32_t len) {
+    char *argv[MAX_RUN_ARGS + 1];
+    int argc = 0;
+    
+    // NUL-separated arguments; the payload is followed by the next frame,
+    // so the last one must be terminated inside it
+    if (len == 0 || payload[len - 1] != '\0') {
+        reply(conn, seq, MD_OP_RUN, MD_ERR_INVALID, NULL, 0);
+        return;
+    }
+    for (uint32_t off = 0; off < len && argc < MAX_RUN_ARGS; ) {
+        argv[argc++] = (char *)payload + off;
+        off += (uint32_t)strlen(payload + off) + 1;
+    }
+    argv[argc] = NULL;
+    
+    // The payload is consumed once this returns, so the job keeps a copy
+    creator_job_t *job = calloc(1, sizeof(*job));
+    if (job) {
+        job->argv = copy_argv(argc, (const char *const *)argv);
+    }
+    if (!job || !job->argv) {
+        free(job);
+        reply(conn, seq, MD_OP_RUN, MD_ERR_FAILED, NULL, 0);
+        return;
+    }
+    
+    container_t *container = &job->container;
+    if (parse_run_args(argc, job->argv, container) != 0) {
+        free(job->argv);
+        free(job);
+        reply(conn, seq, MD_OP_RUN, MD_ERR_INVALID, NULL, 0);
+        return;
+    }
+    if (container->name && name_in_use(container->name)) {
+        log_message(LOG_ERROR, "Container name %s is already in use", container->name);
+        free(job->argv);
+        free(job);
+        reply(conn, seq, MD_OP_RUN, MD_ERR_INVALID, NULL, 0);
+        return;
+    }
+    container->use_dns = dns_active() && container->network_mode == NETWORK_BRIDGE;
+    
+    log_message(LOG_INFO, "Creating container with image: %s for uid %d",
+                container->image_path, (int)conn->cred.uid);
+    job->op = MD_OP_RUN;
+    job->conn = conn;
+    job->seq = seq;
+    submit_job(job);
+}
+
+static void handle_stop(connection_t *conn, uint32_t seq, const char *payload, uint32_t len) {
+    int32_t pid;
+    
+    if (len != sizeof(pid)) {
+        reply(conn, seq, MD_OP_STOP, MD_ERR_INVALID, NULL, 0);
+        return;
+    }
+    memcpy(&pid, payload, sizeof(pid));
+    
+    if (pid <= 0 || registry_get_container((pid_t)pid, NULL) != 0) {
+        reply(conn, seq, MD_OP_STOP, MD_ERR_NOT_FOUND, NULL, 0);
+        return;
+    }
+    
+    pending_stop_t *stop = calloc(1, sizeof(*stop));
+    if (!stop || supervisor_stop((pid_t)pid, STOP_GRACE_MS) != 0) {
+        free(stop);
+        reply(conn, seq, MD_OP_STOP, MD_ERR_FAILED, NULL, 0);
+        return;
+    }
+    
+    stop->conn = conn;
+    stop->seq = seq;
+    stop->pid = (pid_t)pid;
+    stop->next = pending_stops;
+    pending_stops = stop;
+}
+
+// Queued behind any runs, as containers being created could otherwise
+// look orphaned
+static void handle_gc(connection_t *conn, uint32_t seq) {
+    creator_job_t *job = calloc(1, sizeof(*job));
+    
+    if (!job) {
+        reply(conn, seq, MD_OP_GC, MD_ERR_FAILED, NULL, 0);
+        return;
+    }
+    job->op = MD_OP_GC;
+    job->conn = conn;
+    job->seq = seq;
+    submit_job(job);
+}
+
+// Answer STOP requests waiting on this container
+static void container_exited(pid_t pid, int status) {
+    (void)status;
+    pending_stop_t **link = &pending_stops;
+    
+    dns_remove(pid);
+    
+    while (*link) {
+        pending_stop_t *stop = *link;
+        if (stop->pid != pid) {
+            link = &stop->next;
+            continue;
+        }
+        *link = stop->next;
+        reply(stop->conn, stop->seq, MD_OP_STOP, MD_OK, NULL, 0);
+        flush_connection(stop->conn);
+        free(stop);
+    }
+}
+
+// Process every complete frame in the input buffer, in order
+static void handle_requests(connection_t *conn) {
+    md_header_t header;
+    size_t offset = 0;
+    int complete;
+    
+    for (;;) {
+        md_buffer_t view = {
+            .data = conn->in.data + offset,
+            .len = conn->in.len - offset,
+        };
+        complete = md_frame_complete(&view, &header);
+        if (complete <= 0) {
+            break;
+        }
+    
+        const char *payload = view.data + sizeof(header);
+        switch (header.op) {
+        case MD_OP_PING:
+            reply(conn, header.seq, header.op, MD_OK, NULL, 0);
+            break;
+        case MD_OP_PS:
+            handle_ps(conn, header.seq);
+            break;
+        case MD_OP_INSPECT:
+            handle_inspect(conn, header.seq, payload, header.length);
+            break;
+        case MD_OP_RUN:
+            handle_run(conn, header.seq, payload, header.length);
+            break;
+        case MD_OP_STOP:
+            handle_stop(conn, header.seq, payload, header.length);
+            break;
+        case MD_OP_GC:
+            handle_gc(conn, header.seq);
+            break;
+        default:
+            reply(conn, header.seq, header.op, MD_ERR_INVALID, NULL, 0);
+            break;
+        }
+        offset += sizeof(header) + header.length;
+    }
+    
+    md_buffer_consume(&conn->in, offset);
+    
+    if (complete < 0) {
+        log_message(LOG_WARN, "Dropping client with oversized frame");
+        close_connection(conn);
+    } else if (flush_connection(conn) != 0) {
+        close_connection(conn);
+    }
+}
+
+// Scrape output, kept between scrapes so rendering allocates nothing
+static md_buffer_t metrics_body;
+
+// Value of a request header, NUL-terminated in place; NULL if absent
+static char *http_header(char *headers, const char *name) {
+    size_t name_len = strlen(name);
+    
+    for (char *line = headers; line && *line; ) {
+        char *next = strstr(line, "\r\n");
+        if (next) {
+            *next = '\0';
+        }
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            return line + name_len + 1 + strspn(line + name_len + 1, " \t");
+        }
+        if (next) {
+            *next = '\r';
+            line = next + 2;
+        } else {
+            line = NULL;
+        }
+    }
+    return NULL;
+}
+
+static void http_reply(connection_t *conn, const char *status, const char *type,
+                       const char *body, size_t len) {
+    char head[256];
+    
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s\r\n",
+                     status, type, len, conn->close_after_flush ? "Connection: close\r\n" : "");
+    md_buffer_append(&conn->out, head, (size_t)n);
+    md_buffer_append(&conn->out, body, len);
+}
+
+// Minimal HTTP/1.1 for Prometheus: GET /metrics, keep-alive by default
+static void handle_http(connection_t *conn) {
+    char request[HTTP_MAX_REQUEST + 1];
+    
+    while (!conn->close_after_flush) {
+        char *end = memmem(conn->in.data, conn->in.len, "\r\n\r\n", 4);
+        if (!end) {
+            if (conn->in.len > HTTP_MAX_REQUEST) {
+                close_connection(conn);
+                return;
+            }
+            break;
+        }
+    
+        size_t len = (size_t)(end - conn->in.data) + 4;
+        if (len > HTTP_MAX_REQUEST) {
+            close_connection(conn);
+            return;
+        }
+        memcpy(request, conn->in.data, len);
+        request[len] = '\0';
+        md_buffer_consume(&conn->in, len);
+    
+        char *headers = strstr(request, "\r\n") + 2;
+        headers[-2] = '\0';
+        char *method = request;
+        char *path = strchr(method, ' ');
+        char *version = path ? strchr(path + 1, ' ') : NULL;
+        if (!version) {
+            conn->close_after_flush = 1;
+            http_reply(conn, "400 Bad Request", "text/plain", "", 0);
+            break;
+        }
+        *path++ = '\0';
+        *version++ = '\0';
+        path[strcspn(path, "?")] = '\0';
+    
+        char *connection = http_header(headers, "Connection");
+        if (strcmp(version, "HTTP/1.1") != 0 ||
+            (connection && strcasecmp(connection, "close") == 0)) {
+            conn->close_after_flush = 1;
+        }
+    
+        if (strcmp(method, "GET") != 0) {
+            http_reply(conn, "405 Method Not Allowed", "text/plain", "", 0);
+            continue;
+        }
+        if (strcmp(path, "/metrics") != 0) {
+            http_reply(conn, "404 Not Found", "text/plain", "", 0);
+            continue;
+        }
+    
+        char *accept = http_header(headers, "Accept");
+        int openmetrics = accept && strstr(accept, "application/openmetrics-text") != NULL;
+    
+        uint64_t start_ns = metrics_now_ns();
+        if (metrics_render(&metrics_body, openmetrics) != 0) {
+            http_reply(conn, "500 Internal Server Error", "text/plain", "", 0);
+            continue;
+        }
+        log_message(LOG_DEBUG, "Rendered %zu bytes of metrics in %.3f ms", metrics_body.len,
+                    (metrics_now_ns() - start_ns) / 1e6);
+    
+        http_reply(conn, "200 OK",
+                   openmetrics ? "application/openmetrics-text; version=1.0.0; charset=utf-8"
+                               : "text/plain; version=0.0.4; charset=utf-8",
+                   metrics_body.data, metrics_body.len);
+    }
+    
+    if (flush_connection(conn) != 0) {
+        close_connection(conn);
+    }
+}
+
+static void read_connection(connection_t *conn) {
+    char chunk[16384];
+    
+    for (;;) {
+        ssize_t n = recv(conn->fd, chunk, sizeof(chunk), 0);
+        if (n > 0) {
+            md_buffer_append(&conn->in, chunk, (size_t)n);
+            continue;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        close_connection(conn); // EOF or error
+        return;
+    }
+    
+    if (conn->http) {
+        handle_http(conn);
+    } else {
+        handle_requests(conn);
+    }
+}
+
+static void accept_connections(int listen_fd, int http) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_message(LOG_WARN, "accept failed: %s", strerror(errno));
+            }
+            return;
+        }
+    
+        // Only root may drive the runtime; metrics are read-only
+        struct ucred cred = { .pid = 0, .uid = (uid_t)-1, .gid = (gid_t)-1 };
+        socklen_t cred_len = sizeof(cred);
+        if (!http && (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1 ||
+                      cred.uid != 0)) {
+            log_message(LOG_WARN, "Rejecting client uid %d", (int)cred.uid);
+            close(fd);
+            continue;
+        }
+    
+        connection_t *conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->watch.kind = WATCH_CLIENT;
+        conn->fd = fd;
+        conn->cred = cred;
+        conn->http = http;
+    
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->next = connections;
+        connections = conn;
+    }
+}
+
+static int open_listen_socket(const char *path, mode_t mode) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_message(LOG_ERROR, "Socket path too long: %s", path);
+        return -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    
+    // Create the parent directory of the default socket
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        log_message(LOG_ERROR, "Failed to create control socket: %s", strerror(errno));
+        return -1;
+    }
+    
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        chmod(path, mode) == -1 || listen(fd, SOMAXCONN) == -1) {
+        log_message(LOG_ERROR, "Failed to listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+// "/path" or "unix:/path" for a Unix socket, otherwise "[host]:port";
+// the host defaults to loopback
+static int open_metrics_socket(const char *addr) {
+    if (addr[0] == '/') {
+        return open_listen_socket(addr, 0666);
+    }
+    if (strncmp(addr, "unix:", 5) == 0) {
+        return open_listen_socket(addr + 5, 0666);
+    }
+    
+    char host[256];
+    const char *port = strrchr(addr, ':');
+    if (port) {
+        snprintf(host, sizeof(host), "%.*s", (int)(port - addr), addr);
+        port++;
+    } else {
+        host[0] = '\0';
+        port = addr;
+    }
+    
+    // Brackets around IPv6 literals
+    char *node = host;
+    if (node[0] == '[') {
+        node++;
+        node[strcspn(node, "]")] = '\0';
+    }
+    
+    struct addrinfo hints = {
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = AI_NUMERICHOST | AI_NUMERICSERV,
+    };
+    struct addrinfo *info;
+    int ret = getaddrinfo(*node ? node : "127.0.0.1", port, &hints, &info);
+    if (ret != 0) {
+        log_message(LOG_ERROR, "Invalid metrics address %s: %s", addr, gai_strerror(ret));
+        return -1;
+    }
+    
+    int one = 1;
+    int fd = socket(info->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+        bind(fd, info->ai_addr, info->ai_addrlen) == -1 ||
+        listen(fd, SOMAXCONN) == -1) {
+        log_message(LOG_ERROR, "Failed to listen on %s: %s", addr, strerror(errno));
+        if (fd != -1) close(fd);
+        fd = -1;
+    }
+    
+    freeaddrinfo(info);
+    return fd;
+}
+
+// Every supervised container holds a few descriptors (pidfd, cgroup files)
+static void raise_file_limit(void) {
+    struct rlimit limit;
+    
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// Pick up containers that were running before the daemon started
+static int adopt_container(const container_info_t *info, void *arg) {
+    (void)arg;
+    
+    // One that was waiting to restart lost its network namespace with the
+    // old daemon, and its last process ID may already have been reused
+    if (strcmp(info->status, "restarting") == 0 || strcmp(info->status, "crashloop") == 0) {
+        registry_update_container_status(info->pid, "exited");
+        return 0;
+    }
+    if (strcmp(info->status, "running") != 0) {
+        return 0;
+    }
+    
+    // Rebuild the configuration from the original run arguments so restart
+    // policies and health checks carry over
+    container_t container = { .pid = info->pid };
+    int argc = 0;
+    char **argv = registry_get_run_args(info->pid, &argc);
+    if (argv && parse_run_args(argc, argv, &container) != 0) {
+        memset(&container, 0, sizeof(container));
+    }
+    container.pid = info->pid;
+    if (container.network_mode == NETWORK_BRIDGE && strcmp(info->ip, "-") != 0) {
+        snprintf(container.bridge_ip, sizeof(container.bridge_ip), "%s", info->ip);
+    }
+    
+    if (kill(info->process_pid, 0) != 0 || !supervisor_watch(&container)) {
+        registry_update_container_status(info->pid, "exited");
+    } else {
+        register_names(&container);
+    }
+    free(argv);
+    return 0;
+}
+
+static int watch_fd(int fd, daemon_watch_t *watch) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = watch };
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int daemon_main(int argc, char *argv[]) {
+    const char *socket_path = MD_SOCKET_PATH;
+    const char *metrics_addr = NULL;
+    const char *dns_upstream = NULL;
+    int dns_enabled = 1;
+    int ksm_pages = 0;
+    int ksm_sleep_ms = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--metrics-addr") == 0 && i + 1 < argc) {
+            metrics_addr = argv[++i];
+        } else if (strcmp(argv[i], "--dns-upstream") == 0 && i + 1 < argc) {
+            dns_upstream = argv[++i];
+        } else if (strcmp(argv[i], "--no-dns") == 0) {
+            dns_enabled = 0;
+        } else if (strcmp(argv[i], "--ksm-pages-to-scan") == 0 && i + 1 < argc) {
+            ksm_pages = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ksm-sleep-ms") == 0 && i + 1 < argc) {
+            ksm_sleep_ms = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: minidockerd [--socket <path>] [--metrics-addr <addr>]\n"
+                            "                   [--dns-upstream <ip[:port]>] [--no-dns]\n"
+                            "                   [--ksm-pages-to-scan <n>] [--ksm-sleep-ms <ms>]\n");
+            return 1;
+        }
+    }
+    
+    raise_file_limit();
+    
+    // How hard ksmd works for --memory-dedup containers: pages per batch
+    // and the pause between batches
+    if ((ksm_pages > 0 || ksm_sleep_ms > 0) && ksm_tune(ksm_pages, ksm_sleep_ms) != 0) {
+        log_message(LOG_WARN, "Failed to tune kernel same-page merging");
+    }
+    
+    // Keep the registry parsed in memory for the daemon's lifetime
+    if (registry_enable_cache() != 0 || supervisor_init() != 0) {
+        log_message(LOG_ERROR, "Failed to initialise daemon state");
+        return 1;
+    }
+    supervisor_set_exit_hook(container_exited);
+    registry_foreach(adopt_container, NULL);
+    
+    // Whatever a crash or an earlier version leaked, now that the
+    // registry reflects what is actually running
+    gc_stats_t gc_stats;
+    gc_collect(&gc_stats);
+    for (int kind = 0; kind < GC_KIND_COUNT; kind++) {
+        if (gc_stats.removed[kind] > 0) {
+            log_message(LOG_INFO, "Removed %u orphaned %s", gc_stats.removed[kind],
+                        gc_kind_name((gc_kind_t)kind));
+        }
+    }
+    
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    
+    int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    int listen_fd = open_listen_socket(socket_path, 0600);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd == -1 || listen_fd == -1 || epoll_fd == -1 ||
+        watch_fd(listen_fd, &listen_watch) != 0 ||
+        watch_fd(signal_fd, &signal_watch) != 0 ||
+        watch_fd(supervisor_fd(), &supervisor_watch_tag) != 0 ||
+        start_creator() != 0 || watch_fd(creator_fd, &creator_watch) != 0) {
+        log_message(LOG_ERROR, "Failed to start daemon: %s", strerror(errno));
+        return 1;
+    }
+    
+    log_message(LOG_INFO, "minidockerd listening on %s", socket_path);
+    
+    // Metrics are opt-in
+    int metrics_fd = -1;
+    if (metrics_addr) {
+        metrics_fd = open_metrics_socket(metrics_addr);
+        if (metrics_fd == -1 || watch_fd(metrics_fd, &metrics_watch) != 0) {
+            log_message(LOG_ERROR, "Failed to start metrics endpoint");
+            return 1;
+        }
+        log_message(LOG_INFO, "Serving metrics on %s", metrics_addr);
+    }
+    
+    // Name resolution is a convenience; the daemon runs on without it
+    if (dns_enabled && (setup_bridge() != 0 || dns_start(dns_upstream) != 0 ||
+                        watch_fd(dns_fd(), &dns_watch) != 0)) {
+        log_message(LOG_WARN, "Embedded DNS disabled");
+        dns_stop();
+    }
+    
+    int running = 1;
+    while (running) {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_message(LOG_ERROR, "epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+    
+        for (int i = 0; i < n; i++) {
+            daemon_watch_t *watch = (daemon_watch_t *)events[i].data.ptr;
+    
+            switch (watch->kind) {
+            case WATCH_LISTEN:
+                accept_connections(listen_fd, 0);
+                break;
+            case WATCH_METRICS_LISTEN:
+                accept_connections(metrics_fd, 1);
+                break;
+            case WATCH_SIGNAL:
+                running = 0;
+                break;
+            case WATCH_SUPERVISOR:
+                supervisor_dispatch(0);
+                break;
+            case WATCH_DNS:
+                dns_dispatch();
+                break;
+            case WATCH_CREATOR:
+                finish_jobs();
+                break;
+            case WATCH_CLIENT: {
+                connection_t *conn = (connection_t *)watch;
+                if (conn->closed) {
+                    break;
+                }
+                if ((events[i].events & EPOLLOUT) && flush_connection(conn) != 0) {
+                    close_connection(conn);
+                    break;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    read_connection(conn);
+                }
+                break;
+            }
+            }
+        }
+    
+        reap_connections();
+    }
+    
+    log_message(LOG_INFO, "minidockerd shutting down");
+    stop_creator();
+    for (connection_t *conn = connections; conn; conn = conn->next) {
+        close_connection(conn);
+    }
+    reap_connections();
+    dns_stop();
+    close(listen_fd);
+    unlink(socket_path);
+    if (metrics_fd != -1) {
+        close(metrics_fd);
+        if (metrics_addr[0] == '/' || strncmp(metrics_addr, "unix:", 5) == 0) {
+            unlink(metrics_addr[0] == '/' ? metrics_addr : metrics_addr + 5);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,671 @@
+#include "dns.h"
+#include "container.h"
+#include "utils.h"
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#define DNS_HEADER_SIZE 12
+#define DNS_NAME_MAX 255
+#define DNS_MSG_MAX 4096
+#define DNS_BATCH 64             // Datagrams read per socket per dispatch
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_OPT 41
+#define DNS_TYPE_ANY 255
+#define DNS_CLASS_IN 1
+
+#define DNS_FLAG_QR 0x8000
+#define DNS_FLAG_OPCODE 0x7800
+#define DNS_FLAG_AA 0x0400
+#define DNS_FLAG_TC 0x0200
+#define DNS_FLAG_RD 0x0100
+#define DNS_FLAG_RA 0x0080
+
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_FORMERR 1
+#define DNS_RCODE_SERVFAIL 2
+#define DNS_RCODE_NXDOMAIN 3
+#define DNS_RCODE_NOTIMP 4
+
+#define LOCAL_TTL 0              // Container addresses change on every run
+#define MAX_ANSWERS 32
+
+// Queries in flight upstream. Each is sent from its own socket, so the
+// kernel picks a fresh random source port, with a random 16-bit ID; a
+// forged reply has to guess both. The socket identifies the slot.
+#define PENDING_MAX 256
+#define PENDING_TIMEOUT_MS 5000
+#define SERVER_TAG PENDING_MAX   // epoll tag of server_fd; slots use their index
+
+#define CACHE_SLOTS 4096         // Direct-mapped; a collision replaces the entry
+#define CACHE_MAX_TTL 300
+
+typedef struct dns_record {
+    char name[CONTAINER_NAME_MAX]; // Lower case
+    uint32_t hash;
+    pid_t id;
+    struct in_addr addr;
+    struct dns_record *next;
+} dns_record_t;
+
+typedef struct {
+    char name[DNS_NAME_MAX + 1]; // Lower case, without the trailing dot
+    uint16_t type;
+    uint16_t class;
+    size_t end;                  // Offset just past the question
+} question_t;
+
+typedef struct {
+    int fd;                      // Connected to the upstream, -1 if the slot is free
+    uint16_t id;                 // ID sent upstream
+    uint16_t client_id;
+    struct sockaddr_in client;
+    uint64_t sent_ms;
+    uint16_t qtype;
+    uint16_t qclass;
+    char qname[DNS_NAME_MAX + 1];
+} pending_t;
+
+typedef struct {
+    uint8_t *msg;                // Upstream reply, NULL if the slot is empty
+    size_t len;
+    size_t question_end;
+    char *qname;
+    uint16_t qtype;
+    uint16_t qclass;
+    uint64_t stored_ms;
+    uint64_t expires_ms;
+} cache_entry_t;
+
+// Chained hash table of names, grown to keep about one record per bucket
+static dns_record_t **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t record_count = 0;
+
+static int epoll_fd = -1;
+static int server_fd = -1;
+static struct sockaddr_in upstream_addr;
+static int have_upstream = 0;
+static pending_t pending[PENDING_MAX];
+static unsigned int next_pending = 0;
+static cache_entry_t cache[CACHE_SLOTS];
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    put16(p, (uint16_t)(value >> 16));
+    put16(p + 2, (uint16_t)value);
+}
+
+// FNV-1a, case-insensitive as DNS names are
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+    
+    for (; *name; name++) {
+        hash ^= (uint8_t)tolower((unsigned char)*name);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int grow_table(void) {
+    size_t count = bucket_count ? bucket_count * 2 : 256;
+    dns_record_t **table = calloc(count, sizeof(*table));
+    if (!table) {
+        return -1;
+    }
+    
+    for (size_t i = 0; i < bucket_count; i++) {
+        dns_record_t *rec = buckets[i];
+        while (rec) {
+            dns_record_t *next = rec->next;
+            size_t slot = rec->hash & (count - 1);
+            rec->next = table[slot];
+            table[slot] = rec;
+            rec = next;
+        }
+    }
+    
+    free(buckets);
+    buckets = table;
+    bucket_count = count;
+    return 0;
+}
+
+int dns_add(pid_t id, const char *name, struct in_addr addr) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= CONTAINER_NAME_MAX) {
+        return -1;
+    }
+    if (record_count >= bucket_count && grow_table() != 0) {
+        return -1;
+    }
+    
+    uint32_t hash = hash_name(name);
+    size_t slot = hash & (bucket_count - 1);
+    for (dns_record_t *rec = buckets[slot]; rec; rec = rec->next) {
+        if (rec->id == id && strcasecmp(rec->name, name) == 0) {
+            return 0;
+        }
+    }
+    
+    dns_record_t *rec = calloc(1, sizeof(*rec));
+    if (!rec) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        rec->name[i] = (char)tolower((unsigned char)name[i]);
+    }
+    rec->hash = hash;
+    rec->id = id;
+    rec->addr = addr;
+    rec->next = buckets[slot];
+    buckets[slot] = rec;
+    record_count++;
+    log_message(LOG_DEBUG, "DNS: %s -> %s", rec->name, inet_ntoa(addr));
+    return 0;
+}
+
+// Exits are rare next to lookups, so removal just scans the table
+void dns_remove(pid_t id) {
+    for (size_t i = 0; i < bucket_count; i++) {
+        dns_record_t **link = &buckets[i];
+        while (*link) {
+            dns_record_t *rec = *link;
+            if (rec->id == id) {
+                *link = rec->next;
+                free(rec);
+                record_count--;
+            } else {
+                link = &rec->next;
+            }
+        }
+    }
+}
+
+int dns_lookup(const char *name, struct in_addr *addrs, int max) {
+    int found = 0;
+    
+    if (bucket_count == 0) {
+        return 0;
+    }
+    uint32_t hash = hash_name(name);
+    for (dns_record_t *rec = buckets[hash & (bucket_count - 1)]; rec && found < max; rec = rec->next) {
+        if (rec->hash == hash && strcasecmp(rec->name, name) == 0) {
+            addrs[found++] = rec->addr;
+        }
+    }
+    return found;
+}
+
+// The question of a query or reply. Compression is not allowed here, so
+// the question always ends at the same offset for the same name.
+static int parse_question(const uint8_t *msg, size_t len, question_t *q) {
+    size_t off = DNS_HEADER_SIZE;
+    size_t used = 0;
+    
+    if (len < DNS_HEADER_SIZE || get16(msg + 4) != 1) {
+        return -1;
+    }
+    for (;;) {
+        if (off >= len) {
+            return -1;
+        }
+        uint8_t label = msg[off++];
+        if (label == 0) {
+            break;
+        }
+        if ((label & 0xC0) || off + label > len || used + label + 1 > DNS_NAME_MAX) {
+            return -1;
+        }
+        if (used > 0) {
+            q->name[used++] = '.';
+        }
+        for (uint8_t i = 0; i < label; i++) {
+            q->name[used++] = (char)tolower(msg[off + i]);
+        }
+        off += label;
+    }
+    q->name[used] = '\0';
+    
+    if (off + 4 > len) {
+        return -1;
+    }
+    q->type = get16(msg + off);
+    q->class = get16(msg + off + 2);
+    q->end = off + 4;
+    return 0;
+}
+
+// Offset just past a possibly compressed name, or 0 if it overruns
+static size_t skip_name(const uint8_t *msg, size_t len, size_t off) {
+    while (off < len) {
+        uint8_t label = msg[off];
+        if ((label & 0xC0) == 0xC0) {
+            return off + 2 <= len ? off + 2 : 0;
+        }
+        if (label & 0xC0) {
+            return 0;
+        }
+        off += 1 + (size_t)label;
+        if (label == 0) {
+            return off;
+        }
+    }
+    return 0;
+}
+
+// Lowers the TTL of every record after the question by age seconds and
+// returns the smallest TTL left: 0 if there are no records, -1 if the
+// message is malformed. OPT records keep flags in the TTL field.
+static long adjust_ttls(uint8_t *msg, size_t len, size_t off, uint32_t age) {
+    unsigned int count = (unsigned int)get16(msg + 6) + get16(msg + 8) + get16(msg + 10);
+    long min_ttl = -1;
+    
+    for (unsigned int i = 0; i < count; i++) {
+        off = skip_name(msg, len, off);
+        if (off == 0 || off + 10 > len) {
+            return -1;
+        }
+        uint32_t ttl = get32(msg + off + 4);
+        if (get16(msg + off) != DNS_TYPE_OPT) {
+            ttl = ttl > age ? ttl - age : 0;
+            put32(msg + off + 4, ttl);
+            if (min_ttl == -1 || ttl < (uint32_t)min_ttl) {
+                min_ttl = ttl;
+            }
+        }
+        off += 10 + (size_t)get16(msg + off + 8);
+        if (off > len) {
+            return -1;
+        }
+    }
+    return min_ttl == -1 ? 0 : min_ttl;
+}
+
+// Answers from the query's own header and question; question_end is the
+// header size when the question could not be parsed
+static void send_response(const uint8_t *query, size_t question_end, uint16_t rcode,
+                          int authoritative, const struct in_addr *addrs, int count,
+                          const struct sockaddr_in *client) {
+    uint8_t out[DNS_HEADER_SIZE + DNS_NAME_MAX + 6 + MAX_ANSWERS * 16];
+    uint16_t flags = get16(query + 2);
+    
+    memcpy(out, query, question_end);
+    flags = DNS_FLAG_QR | (flags & (DNS_FLAG_OPCODE | DNS_FLAG_RD)) | DNS_FLAG_RA | rcode;
+    if (authoritative) {
+        flags |= DNS_FLAG_AA;
+    }
+    put16(out + 2, flags);
+    put16(out + 4, question_end > DNS_HEADER_SIZE ? 1 : 0);
+    put16(out + 6, (uint16_t)count);
+    put16(out + 8, 0);
+    put16(out + 10, 0);
+    
+    size_t off = question_end;
+    for (int i = 0; i < count; i++) {
+        put16(out + off, 0xC000 | DNS_HEADER_SIZE);  // Points at the question's name
+        put16(out + off + 2, DNS_TYPE_A);
+        put16(out + off + 4, DNS_CLASS_IN);
+        put32(out + off + 6, LOCAL_TTL);
+        put16(out + off + 10, sizeof(addrs[i]));
+        memcpy(out + off + 12, &addrs[i], sizeof(addrs[i]));
+        off += 16;
+    }
+    
+    sendto(server_fd, out, off, 0, (const struct sockaddr *)client, sizeof(*client));
+}
+
+static int answer_local(const uint8_t *msg, const question_t *q, const struct sockaddr_in *client) {
+    struct in_addr addrs[MAX_ANSWERS];
+    
+    int count = dns_lookup(q->name, addrs, MAX_ANSWERS);
+    if (count == 0) {
+        return -1;
+    }
+    // The name exists but has no records of other types, e.g. AAAA
+    if (q->type != DNS_TYPE_A && q->type != DNS_TYPE_ANY) {
+        count = 0;
+    }
+    send_response(msg, q->end, DNS_RCODE_NOERROR, 1, addrs, count, client);
+    return 0;
+}
+
+static size_t cache_slot(const question_t *q) {
+    return (hash_name(q->name) ^ (q->type * 2654435761u)) & (CACHE_SLOTS - 1);
+}
+
+static cache_entry_t *cache_find(const question_t *q, uint64_t now) {
+    cache_entry_t *entry = &cache[cache_slot(q)];
+    
+    if (!entry->msg || entry->expires_ms <= now || entry->qtype != q->type ||
+        entry->qclass != q->class || strcmp(entry->qname, q->name) != 0) {
+        return NULL;
+    }
+    return entry;
+}
+
+static void cache_clear(cache_entry_t *entry) {
+    free(entry->msg);
+    free(entry->qname);
+    memset(entry, 0, sizeof(*entry));
+}
+
+// Keeps answers and negative answers for as long as their records live;
+// anything else is passed on without caching
+static void cache_store(const question_t *q, uint8_t *msg, size_t len) {
+    uint16_t flags = get16(msg + 2);
+    uint16_t rcode = flags & 0xF;
+    
+    if ((flags & DNS_FLAG_TC) || (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)) {
+        return;
+    }
+    long ttl = adjust_ttls(msg, len, q->end, 0);
+    if (ttl <= 0) {
+        return;
+    }
+    if (ttl > CACHE_MAX_TTL) {
+        ttl = CACHE_MAX_TTL;
+    }
+    
+    cache_entry_t *entry = &cache[cache_slot(q)];
+    cache_clear(entry);
+    entry->msg = malloc(len);
+    entry->qname = strdup(q->name);
+    if (!entry->msg || !entry->qname) {
+        cache_clear(entry);
+        return;
+    }
+    memcpy(entry->msg, msg, len);
+    entry->len = len;
+    entry->question_end = q->end;
+    entry->qtype = q->type;
+    entry->qclass = q->class;
+    entry->stored_ms = monotonic_ms();
+    entry->expires_ms = entry->stored_ms + (uint64_t)ttl * 1000;
+}
+
+static int answer_cached(const uint8_t *msg, const question_t *q, const struct sockaddr_in *client) {
+    uint64_t now = monotonic_ms();
+    cache_entry_t *entry = cache_find(q, now);
+    if (!entry) {
+        return -1;
+    }
+    
+    // The client's ID and question, so its spelling of the name is echoed
+    uint8_t out[DNS_MSG_MAX];
+    memcpy(out, entry->msg, entry->len);
+    memcpy(out, msg, 2);
+    memcpy(out + DNS_HEADER_SIZE, msg + DNS_HEADER_SIZE, q->end - DNS_HEADER_SIZE);
+    adjust_ttls(out, entry->len, entry->question_end, (uint32_t)((now - entry->stored_ms) / 1000));
+    
+    sendto(server_fd, out, entry->len, 0, (const struct sockaddr *)client, sizeof(*client));
+    return 0;
+}
+
+static void release_pending(pending_t *p) {
+    if (p->fd != -1) {
+        close(p->fd);  // Also drops it from the epoll set
+    }
+    p->fd = -1;
+}
+
+// A socket per query: connect() binds it to a random ephemeral port and
+// filters out datagrams from anyone but the upstream
+static int open_upstream_socket(unsigned int slot) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = slot };
+    
+    if (fd == -1 ||
+        connect(fd, (struct sockaddr *)&upstream_addr, sizeof(upstream_addr)) == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static void forward_query(uint8_t *msg, size_t len, const question_t *q,
+                          const struct sockaddr_in *client) {
+    uint64_t now = monotonic_ms();
+    pending_t *p = NULL;
+    unsigned int slot = 0;
+    
+    for (unsigned int i = 0; i < PENDING_MAX && have_upstream; i++) {
+        slot = (next_pending + i) % PENDING_MAX;
+        if (pending[slot].fd == -1 || now - pending[slot].sent_ms > PENDING_TIMEOUT_MS) {
+            p = &pending[slot];
+            break;
+        }
+    }
+    if (!p) {
+        send_response(msg, q->end, DNS_RCODE_SERVFAIL, 0, NULL, 0, client);
+        return;
+    }
+    next_pending = slot + 1;
+    
+    // A timed-out query gives up its socket, so a late reply is dropped
+    release_pending(p);
+    p->fd = open_upstream_socket(slot);
+    if (p->fd == -1) {
+        log_message(LOG_DEBUG, "DNS: no socket to forward %s: %s", q->name, strerror(errno));
+        send_response(msg, q->end, DNS_RCODE_SERVFAIL, 0, NULL, 0, client);
+        return;
+    }
+    
+    uint16_t id;
+    if (getrandom(&id, sizeof(id), GRND_NONBLOCK) != (ssize_t)sizeof(id)) {
+        id = (uint16_t)(now ^ (now >> 16) ^ slot);
+    }
+    p->id = id;
+    p->client_id = get16(msg);
+    p->client = *client;
+    p->sent_ms = now;
+    p->qtype = q->type;
+    p->qclass = q->class;
+    strcpy(p->qname, q->name);
+    
+    put16(msg, p->id);
+    if (send(p->fd, msg, len, 0) == -1) {
+        log_message(LOG_DEBUG, "DNS: forwarding %s failed: %s", q->name, strerror(errno));
+        release_pending(p);
+        put16(msg, p->client_id);
+        send_response(msg, q->end, DNS_RCODE_SERVFAIL, 0, NULL, 0, client);
+    }
+}
+
+static void handle_query(uint8_t *msg, size_t len, const struct sockaddr_in *client) {
+    question_t q;
+    
+    if (len < DNS_HEADER_SIZE || (get16(msg + 2) & DNS_FLAG_QR)) {
+        return;
+    }
+    if (parse_question(msg, len, &q) != 0) {
+        send_response(msg, DNS_HEADER_SIZE, DNS_RCODE_FORMERR, 0, NULL, 0, client);
+        return;
+    }
+    if (get16(msg + 2) & DNS_FLAG_OPCODE) {
+        send_response(msg, q.end, DNS_RCODE_NOTIMP, 0, NULL, 0, client);
+        return;
+    }
+    
+    if (q.class == DNS_CLASS_IN && answer_local(msg, &q, client) == 0) {
+        return;
+    }
+    if (answer_cached(msg, &q, client) == 0) {
+        return;
+    }
+    forward_query(msg, len, &q, client);
+}
+
+static void handle_upstream_reply(pending_t *p, uint8_t *msg, size_t len) {
+    question_t q;
+    
+    if (len < DNS_HEADER_SIZE || !(get16(msg + 2) & DNS_FLAG_QR) ||
+        parse_question(msg, len, &q) != 0) {
+        return;
+    }
+    
+    // Forged replies carry the wrong ID or question; the socket stays open
+    // for the real one until the query times out
+    if (p->fd == -1 || p->id != get16(msg) || p->qtype != q.type || p->qclass != q.class ||
+        strcmp(p->qname, q.name) != 0) {
+        return;
+    }
+    release_pending(p);
+    
+    cache_store(&q, msg, len);
+    put16(msg, p->client_id);
+    sendto(server_fd, msg, len, 0, (const struct sockaddr *)&p->client, sizeof(p->client));
+}
+
+void dns_dispatch(void) {
+    struct epoll_event events[DNS_BATCH];
+    
+    int n = epoll_wait(epoll_fd, events, DNS_BATCH, 0);
+    for (int i = 0; i < n; i++) {
+        uint32_t tag = events[i].data.u32;
+        uint8_t msg[DNS_MSG_MAX];
+    
+        if (tag != SERVER_TAG) {
+            // An earlier event in this batch may have closed the socket
+            pending_t *p = &pending[tag];
+            ssize_t len = p->fd == -1 ? -1 : recv(p->fd, msg, sizeof(msg), 0);
+            if (len >= 0) {
+                handle_upstream_reply(p, msg, (size_t)len);
+            }
+            continue;
+        }
+    
+        // Bounded, so a flood of queries cannot starve the rest of the
+        // daemon; epoll reports the socket again if more are queued
+        for (int j = 0; j < DNS_BATCH; j++) {
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t len = recvfrom(server_fd, msg, sizeof(msg), 0,
+                                   (struct sockaddr *)&from, &from_len);
+            if (len < 0) {
+                break;
+            }
+            handle_query(msg, (size_t)len, &from);
+        }
+    }
+}
+
+// "ip" or "ip:port"
+static int parse_upstream(const char *spec, struct sockaddr_in *addr) {
+    char host[INET_ADDRSTRLEN];
+    const char *colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+    int port = colon ? atoi(colon + 1) : DNS_PORT;
+    
+    if (len >= sizeof(host) || port <= 0 || port > 65535) {
+        return -1;
+    }
+    memcpy(host, spec, len);
+    host[len] = '\0';
+    
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((uint16_t)port);
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+// The host's first IPv4 nameserver, unless that is this resolver
+static int host_nameserver(struct sockaddr_in *addr) {
+    FILE *fp = fopen("/etc/resolv.conf", "r");
+    char line[256];
+    int ret = -1;
+    
+    if (!fp) {
+        return -1;
+    }
+    while (ret != 0 && fgets(line, sizeof(line), fp)) {
+        char server[INET_ADDRSTRLEN];
+        if (sscanf(line, "nameserver %15s", server) == 1 &&
+            strcmp(server, DNS_BRIDGE_ADDR) != 0 && strchr(server, ':') == NULL) {
+            ret = parse_upstream(server, addr);
+        }
+    }
+    fclose(fp);
+    return ret;
+}
+
+int dns_start(const char *upstream) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(DNS_PORT) };
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = SERVER_TAG };
+    int one = 1;
+    
+    for (size_t i = 0; i < PENDING_MAX; i++) {
+        pending[i].fd = -1;
+    }
+    inet_pton(AF_INET, DNS_BRIDGE_ADDR, &addr.sin_addr);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    
+    // Free-bind, so the resolver can start before the bridge has its address
+    if (epoll_fd == -1 || server_fd == -1 ||
+        setsockopt(server_fd, IPPROTO_IP, IP_FREEBIND, &one, sizeof(one)) == -1 ||
+        bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
+        log_message(LOG_ERROR, "Failed to start DNS on %s:%d: %s",
+                    DNS_BRIDGE_ADDR, DNS_PORT, strerror(errno));
+        dns_stop();
+        return -1;
+    }
+    
+    // Without an upstream only container names resolve
+    if ((upstream ? parse_upstream(upstream, &upstream_addr) : host_nameserver(&upstream_addr)) != 0) {
+        log_message(LOG_WARN, "No upstream DNS server%s%s; resolving container names only",
+                    upstream ? " at " : "", upstream ? upstream : "");
+    } else {
+        have_upstream = 1;
+        log_message(LOG_INFO, "DNS on %s:%d, forwarding to %s:%d", DNS_BRIDGE_ADDR, DNS_PORT,
+                    inet_ntoa(upstream_addr.sin_addr), ntohs(upstream_addr.sin_port));
+    }
+    return 0;
+}
+
+void dns_stop(void) {
+    if (server_fd != -1) {
+        close(server_fd);
+    }
+    // Pending slots are only set up once dns_start() has run
+    if (epoll_fd != -1) {
+        for (size_t i = 0; i < PENDING_MAX; i++) {
+            release_pending(&pending[i]);
+        }
+        close(epoll_fd);
+    }
+    server_fd = epoll_fd = -1;
+    have_upstream = 0;
+    
+    for (size_t i = 0; i < CACHE_SLOTS; i++) {
+        cache_clear(&cache[i]);
+    }
+}
+
+int dns_active(void) {
+    return server_fd != -1;
+}
+
+int dns_fd(void) {
+    return epoll_fd;
+}
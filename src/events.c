@@ -0,0 +1,271 @@
+#include "events.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define EVENTS_MAGIC 0x4d444556u   // "MDEV"
+#define EVENTS_VERSION 1
+#define SLOT_MASK (EVENTS_RING_SLOTS - 1)
+
+// Set in a slot's sequence while its record is being rewritten
+#define SLOT_WRITING (1ULL << 63)
+
+_Static_assert((EVENTS_RING_SLOTS & SLOT_MASK) == 0, "ring size must be a power of two");
+_Static_assert(sizeof(event_t) == 64, "event_t must stay 64 bytes");
+
+// Each slot is a small seqlock: readers copy the record and keep it only if
+// the slot's sequence was the one they wanted both before and after
+struct events_slot {
+    _Atomic uint64_t seq;
+    event_t event;
+};
+
+struct events_ring {
+    _Atomic uint32_t magic;    // Stored last, once the ring is initialized
+    uint32_t version;
+    uint32_t slots;
+    _Atomic uint32_t notify;   // Futex word, bumped after every event
+    _Atomic uint64_t head;     // Next sequence number to hand out
+    struct events_slot slot[EVENTS_RING_SLOTS];
+};
+
+// Mapping used by events_emit(), opened on first use by any thread
+static events_ring_t *producer = NULL;
+static pthread_once_t producer_once = PTHREAD_ONCE_INIT;
+
+static events_ring_t *map_ring(int writable) {
+    int fd = shm_open(EVENTS_SHM_NAME, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+    
+    // Whoever gets here first sizes and initializes the ring
+    if (writable) {
+        flock(fd, LOCK_EX);
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        goto fail;
+    }
+    // Anyone can create files in /dev/shm; don't write into someone else's
+    if (writable && st.st_uid != geteuid()) {
+        errno = EPERM;
+        goto fail;
+    }
+    if (writable && st.st_size == 0) {
+        if (ftruncate(fd, sizeof(events_ring_t)) == -1) {
+            goto fail;
+        }
+        fchmod(fd, 0644);
+        st.st_size = sizeof(events_ring_t);
+    }
+    if (st.st_size < (off_t)sizeof(events_ring_t)) {
+        errno = ENODATA;
+        goto fail;
+    }
+    
+    events_ring_t *ring = mmap(NULL, sizeof(events_ring_t),
+                               PROT_READ | (writable ? PROT_WRITE : 0),
+                               MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        goto fail;
+    }
+    
+    if (writable && atomic_load_explicit(&ring->magic, memory_order_acquire) != EVENTS_MAGIC) {
+        ring->version = EVENTS_VERSION;
+        ring->slots = EVENTS_RING_SLOTS;
+        atomic_store_explicit(&ring->head, 1, memory_order_relaxed);
+        atomic_store_explicit(&ring->magic, EVENTS_MAGIC, memory_order_release);
+    }
+    
+    // The mapping keeps the file open, so the lock would outlive close()
+    if (writable) {
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+    
+    if (atomic_load_explicit(&ring->magic, memory_order_acquire) != EVENTS_MAGIC ||
+        ring->version != EVENTS_VERSION || ring->slots != EVENTS_RING_SLOTS) {
+        munmap(ring, sizeof(events_ring_t));
+        errno = EPROTO;
+        return NULL;
+    }
+    return ring;
+    
+fail:
+    close(fd);
+    return NULL;
+}
+
+static void open_producer(void) {
+    producer = map_ring(1);
+    if (!producer) {
+        // Only reported once; events are best effort
+        log_message(LOG_WARN, "Event stream unavailable: %s", strerror(errno));
+    }
+}
+
+int events_emit(event_type_t type, pid_t pid, int code, const char *detail) {
+    pthread_once(&producer_once, open_producer);
+    if (!producer) {
+        return -1;
+    }
+    
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    
+    uint64_t seq = atomic_fetch_add_explicit(&producer->head, 1, memory_order_relaxed);
+    struct events_slot *slot = &producer->slot[seq & SLOT_MASK];
+    
+    atomic_store_explicit(&slot->seq, seq | SLOT_WRITING, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    event_t *event = &slot->event;
+    event->seq = seq;
+    event->time_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    event->pid = (int32_t)pid;
+    event->type = (uint16_t)type;
+    event->reserved = 0;
+    event->code = code;
+    snprintf(event->detail, sizeof(event->detail), "%s", detail ? detail : "");
+    
+    atomic_store_explicit(&slot->seq, seq, memory_order_release);
+    
+    // A wake with no sleepers is cheap, and events are rare
+    atomic_fetch_add_explicit(&producer->notify, 1, memory_order_release);
+    syscall(SYS_futex, &producer->notify, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    return 0;
+}
+
+int events_reader_open(events_reader_t *reader, int64_t since_ns) {
+    if (!reader) {
+        return -1;
+    }
+    memset(reader, 0, sizeof(*reader));
+    
+    // Root creates the ring if no producer has yet; anyone else maps it
+    // read-only
+    reader->ring = geteuid() == 0 ? map_ring(1) : map_ring(0);
+    if (!reader->ring) {
+        return -1;
+    }
+    
+    uint64_t head = atomic_load_explicit(&reader->ring->head, memory_order_acquire);
+    if (since_ns < 0) {
+        reader->next = head;
+    } else {
+        reader->next = head > EVENTS_RING_SLOTS ? head - EVENTS_RING_SLOTS : 1;
+    }
+    reader->since_ns = since_ns;
+    return 0;
+}
+
+void events_reader_close(events_reader_t *reader) {
+    if (reader && reader->ring) {
+        munmap(reader->ring, sizeof(events_ring_t));
+        reader->ring = NULL;
+    }
+}
+
+int events_read(events_reader_t *reader, event_t *event) {
+    if (!reader || !reader->ring || !event) {
+        return -1;
+    }
+    events_ring_t *ring = reader->ring;
+    
+    for (;;) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (reader->next >= head) {
+            return 0;
+        }
+    
+        // Lapped: skip to the oldest record that can still be intact
+        if (head - reader->next > EVENTS_RING_SLOTS) {
+            reader->lost += head - EVENTS_RING_SLOTS - reader->next;
+            reader->next = head - EVENTS_RING_SLOTS;
+        }
+    
+        struct events_slot *slot = &ring->slot[reader->next & SLOT_MASK];
+        uint64_t before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if ((before & ~SLOT_WRITING) < reader->next ||
+            before == (reader->next | SLOT_WRITING)) {
+            return 0; // Handed out but not yet written
+        }
+        if (before != reader->next) {
+            continue; // Already overwritten; head has moved on too
+        }
+    
+        memcpy(event, &slot->event, sizeof(*event));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != before) {
+            continue; // Overwritten while copying
+        }
+    
+        reader->next++;
+        if (event->time_ns >= reader->since_ns) {
+            return 1;
+        }
+    }
+}
+
+int events_wait(events_reader_t *reader, int timeout_ms) {
+    if (!reader || !reader->ring) {
+        return -1;
+    }
+    events_ring_t *ring = reader->ring;
+    
+    // Sample the futex word before checking, so an event published in
+    // between makes FUTEX_WAIT return immediately
+    uint32_t seen = atomic_load_explicit(&ring->notify, memory_order_acquire);
+    if (atomic_load_explicit(&ring->head, memory_order_acquire) > reader->next) {
+        return 0;
+    }
+    
+    struct timespec ts, *timeout = NULL;
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+        timeout = &ts;
+    }
+    
+    if (syscall(SYS_futex, &ring->notify, FUTEX_WAIT, seen, timeout, NULL, 0) == -1 &&
+        errno != EAGAIN && errno != ETIMEDOUT && errno != EINTR) {
+        return -1;
+    }
+    return 0;
+}
+
+const char *event_type_name(event_type_t type) {
+    switch (type) {
+    case EVENT_CREATE: return "create";
+    case EVENT_START:  return "start";
+    case EVENT_EXIT:   return "exit";
+    case EVENT_STOP:   return "stop";
+    case EVENT_OOM:    return "oom";
+    case EVENT_HEALTH: return "health_status";
+    }
+    return "unknown";
+}
+
+int parse_event_type(const char *name) {
+    int type;
+    
+    if (!name) {
+        return -1;
+    }
+    for (type = EVENT_CREATE; type <= EVENT_HEALTH; type++) {
+        if (strcmp(name, event_type_name((event_type_t)type)) == 0) {
+            return type;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,283 @@
+#include "exec.h"
+#include "cgroup.h"
+#include "container.h"
+#include "registry.h"
+#include "security.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+// Namespaces joined by exec, the same set create_container unshares
+#define EXEC_NAMESPACES (CLONE_NEWPID | CLONE_NEWUTS | CLONE_NEWNS | \
+                         CLONE_NEWIPC | CLONE_NEWNET)
+
+static int open_pty(int *master, int *slave) {
+    *master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (*master == -1) {
+        return -1;
+    }
+    
+    char *name = NULL;
+    if (grantpt(*master) == -1 || unlockpt(*master) == -1 ||
+        !(name = ptsname(*master))) {
+        close(*master);
+        return -1;
+    }
+    
+    *slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (*slave == -1) {
+        close(*master);
+        return -1;
+    }
+    
+    // Start with the caller's window size
+    struct winsize ws;
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) == 0) {
+        ioctl(*slave, TIOCSWINSZ, &ws);
+    }
+    
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, ssize_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void relay_pty(int master) {
+    struct termios orig, raw;
+    int restore = 0;
+    
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &orig) == 0) {
+        raw = orig;
+        cfmakeraw(&raw);
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0) {
+            restore = 1;
+        }
+    }
+    
+    struct pollfd fds[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = master, .events = POLLIN },
+    };
+    char buf[4096];
+    
+    for (;;) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+    
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0) {
+                fds[0].fd = -1; // Stop polling a closed stdin
+            } else if (write_all(master, buf, n) != 0) {
+                break;
+            }
+        }
+    
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            // EIO once the last slave descriptor is closed
+            ssize_t n = read(master, buf, sizeof(buf));
+            if (n <= 0 || write_all(STDOUT_FILENO, buf, n) != 0) {
+                break;
+            }
+        }
+    }
+    
+    if (restore) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &orig);
+    }
+}
+
+int container_load_confinement(pid_t id, container_t *confine) {
+    char digest[SHA256_HEX_SIZE];
+    
+    memset(confine, 0, sizeof(*confine));
+    if (registry_get_security(id, digest, sizeof(digest), &confine->cap_bset) == 0) {
+        return security_load(digest, confine);
+    }
+    
+    // Older registry entries get the defaults every container starts with
+    confine->cap_bset = default_capabilities();
+    return security_prepare(confine);
+}
+
+static int exec_in_container(const container_t *confine, pid_t target, char *const argv[],
+                             int use_tty, int kill_with_parent) {
+    if (target <= 0 || !argv || !argv[0]) {
+        log_message(LOG_ERROR, "Invalid exec parameters");
+        return -1;
+    }
+    
+    log_message(LOG_DEBUG, "Executing %s in container PID %d", argv[0], (int)target);
+    
+    int pidfd = open_pidfd(target);
+    if (pidfd == -1) {
+        log_message(LOG_ERROR, "Failed to open pidfd for PID %d: %s",
+                    (int)target, strerror(errno));
+        return -1;
+    }
+    
+    // Everything that needs a host path is opened before switching namespaces
+    char root_path[64];
+    snprintf(root_path, sizeof(root_path), "/proc/%d/root", (int)target);
+    int root_fd = open(root_path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        log_message(LOG_ERROR, "Failed to open container root: %s", strerror(errno));
+        close(pidfd);
+        return -1;
+    }
+    
+    int cgroup_fd = open_process_cgroup(target);
+    if (cgroup_fd == -1) {
+        log_message(LOG_WARN, "Container cgroup not found, exec stays in the caller's cgroup");
+    }
+    
+    int master = -1, slave = -1;
+    if (use_tty && open_pty(&master, &slave) != 0) {
+        log_message(LOG_ERROR, "Failed to allocate a pseudo-terminal");
+        close(root_fd);
+        if (cgroup_fd != -1) close(cgroup_fd);
+        close(pidfd);
+        return -1;
+    }
+    
+    int ret = -1;
+    
+    // Join all of the container's namespaces in one call
+    if (setns(pidfd, EXEC_NAMESPACES) == -1) {
+        log_message(LOG_ERROR, "Failed to enter container namespaces: %s", strerror(errno));
+        goto out;
+    }
+    
+    // The PID namespace only applies to children, so the command is cloned
+    // straight into the container's cgroup
+    int child_pidfd = -1;
+    pid_t child = clone_into_cgroup(0, cgroup_fd, &child_pidfd);
+    if (child == -1) {
+        log_message(LOG_ERROR, "Failed to create exec process: %s", strerror(errno));
+        goto out;
+    }
+    
+    if (child == 0) {
+        if (kill_with_parent) {
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+        }
+        if (use_tty) {
+            setsid();
+            ioctl(slave, TIOCSCTTY, 0);
+            dup2(slave, STDIN_FILENO);
+            dup2(slave, STDOUT_FILENO);
+            dup2(slave, STDERR_FILENO);
+        }
+        if (fchdir(root_fd) == -1 || chroot(".") == -1 || chdir("/") == -1) {
+            _exit(126);
+        }
+        if (security_apply(confine) != 0) {
+            _exit(126);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    
+    if (use_tty) {
+        close(slave);
+        slave = -1;
+        relay_pty(master);
+    }
+    
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    while (waitid((idtype_t)P_PIDFD, (id_t)child_pidfd, &info, WEXITED) == -1) {
+        if (errno != EINTR) {
+            log_message(LOG_ERROR, "Failed to wait for exec process: %s", strerror(errno));
+            close(child_pidfd);
+            goto out;
+        }
+    }
+    close(child_pidfd);
+    
+    ret = info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status;
+    
+out:
+    if (master != -1) close(master);
+    if (slave != -1) close(slave);
+    if (cgroup_fd != -1) close(cgroup_fd);
+    close(root_fd);
+    close(pidfd);
+    return ret;
+}
+
+int container_exec(pid_t id, char *const argv[], int use_tty) {
+    container_t confine;
+    
+    if (container_load_confinement(id, &confine) != 0) {
+        log_message(LOG_ERROR, "Failed to load seccomp filter for container %d", (int)id);
+        return -1;
+    }
+    int ret = exec_in_container(&confine, container_process_pid(id), argv, use_tty, 0);
+    security_release(&confine);
+    return ret;
+}
+
+pid_t container_exec_spawn(const container_t *confine, pid_t target, char *const argv[],
+                           int *pidfd) {
+    if (!confine || !pidfd) {
+        return -1;
+    }
+    
+    // setns() would move the caller for good, so a short-lived shim joins
+    // the container and exits with the command's status. Killing the shim
+    // kills the command too.
+    pid_t shim = fork();
+    if (shim == -1) {
+        log_message(LOG_ERROR, "Failed to fork exec shim: %s", strerror(errno));
+        return -1;
+    }
+    
+    if (shim == 0) {
+        int devnull = open("/dev/null", O_RDWR);
+        if (devnull != -1) {
+            dup2(devnull, STDIN_FILENO);
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+            close(devnull);
+        }
+        int ret = exec_in_container(confine, target, argv, 0, 1);
+        _exit(ret < 0 ? 126 : ret);
+    }
+    
+    *pidfd = open_pidfd(shim);
+    if (*pidfd == -1) {
+        log_message(LOG_ERROR, "Failed to open pidfd for exec shim");
+        kill(shim, SIGKILL);
+        waitpid(shim, NULL, 0);
+        return -1;
+    }
+    
+    return shim;
+}
@@ -1,20 +1,92 @@
 #include "filesystem.h"
 #include "utils.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#define OLD_ROOT_NAME ".oldroot"
+
+static int make_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        log_child(LOG_ERROR, "Failed to create %s: %s", path, strerrordesc_np(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Runs in the container's mount namespace. The image stays read-only and
+// shared; everything the container writes goes to its own upper dir.
+int setup_filesystem(const char *lowerdir, const char *container_root) {
+    if (!lowerdir || !container_root) {
+        log_child(LOG_ERROR, "Invalid filesystem parameters");
+        return -1;
+    }
+    
+    // Keep the mounts below from propagating back to the host
+    if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1) {
+        log_child(LOG_ERROR, "Failed to make mounts private: %s", strerrordesc_np(errno));
+        return -1;
+    }
+    
+    char upper[PATH_MAX], work[PATH_MAX], rootfs[PATH_MAX];
+    format_string(upper, sizeof(upper), "%s/upper", container_root);
+    format_string(work, sizeof(work), "%s/work", container_root);
+    format_string(rootfs, sizeof(rootfs), "%s/rootfs", container_root);
+    if (make_dir("/var/lib/minidocker") != 0 || make_dir(CONTAINERS_DIR) != 0 ||
+        make_dir(container_root) != 0 || make_dir(upper) != 0 ||
+        make_dir(work) != 0 || make_dir(rootfs) != 0) {
+        return -1;
+    }
+    
+    char options[3 * PATH_MAX + 64];
+    if (format_string(options, sizeof(options), "lowerdir=%s,upperdir=%s,workdir=%s",
+                      lowerdir, upper, work) >= (int)sizeof(options)) {
+        log_child(LOG_ERROR, "Overlay options too long");
+        return -1;
+    }
+    if (mount("overlay", rootfs, "overlay", MS_NODEV, options) == -1) {
+        log_child(LOG_ERROR, "Failed to mount overlay on %s: %s", rootfs, strerrordesc_np(errno));
+        return -1;
+    }
+    
+    if (setup_rootfs(rootfs) != 0 || setup_pivot_root(rootfs, OLD_ROOT_NAME) != 0) {
+        return -1;
+    }
+    
+    // /proc is required for the container to see its own processes; /sys is
+    // a convenience some images lack a mountpoint for
+    mkdir("/proc", 0555);
+    if (mount_proc() != 0) {
+        return -1;
+    }
+    if (access("/sys", F_OK) == 0) {
+        mount_sys();
+    }
+    
+    if (umount2("/" OLD_ROOT_NAME, MNT_DETACH) == -1) {
+        log_child(LOG_ERROR, "Failed to detach old root: %s", strerrordesc_np(errno));
+        return -1;
+    }
+    rmdir("/" OLD_ROOT_NAME);
+    
+    return 0;
+}
+
 int setup_rootfs(const char *new_root) {
     if (!new_root) {
-        log_message(LOG_ERROR, "Invalid new_root parameter");
+        log_child(LOG_ERROR, "Invalid new_root parameter");
         return -1;
     }
     
-    log_message(LOG_DEBUG, "Setting up rootfs: %s", new_root);
+    log_child(LOG_DEBUG, "Setting up rootfs: %s", new_root);
     
     // Check if new_root exists
     if (access(new_root, F_OK) != 0) {
-        log_message(LOG_ERROR, "Root filesystem path does not exist: %s", new_root);
+        log_child(LOG_ERROR, "Root filesystem path does not exist: %s", new_root);
         return -1;
     }
     
@@ -26,50 +98,50 @@ int setup_rootfs(const char *new_root) {
 
 int mount_proc(void) {
     // TODO: Mount /proc filesystem in container
-    log_message(LOG_DEBUG, "Mounting /proc");
+    log_child(LOG_DEBUG, "Mounting /proc");
     
     if (mount("proc", "/proc", "proc", 0, NULL) == -1) {
-        log_message(LOG_ERROR, "Failed to mount /proc filesystem");
+        log_child(LOG_ERROR, "Failed to mount /proc filesystem");
         return -1;
     }
-    log_message(LOG_DEBUG, "Successfully mounted /proc");
+    log_child(LOG_DEBUG, "Successfully mounted /proc");
     
     return 0;
 }
 
 int mount_sys(void) {
     // TODO: Mount /sys filesystem in container
-    log_message(LOG_DEBUG, "Mounting /sys");
+    log_child(LOG_DEBUG, "Mounting /sys");
     
     if (mount("sysfs", "/sys", "sysfs", 0, NULL) == -1) {
-        log_message(LOG_ERROR, "Failed to mount /sys filesystem");
+        log_child(LOG_ERROR, "Failed to mount /sys filesystem");
         return -1;
     }
-    log_message(LOG_DEBUG, "Successfully mounted /sys");
+    log_child(LOG_DEBUG, "Successfully mounted /sys");
     
     return 0;
 }
 
 int setup_chroot(const char *new_root) {
     if (!new_root) {
-        log_message(LOG_ERROR, "Invalid new_root parameter");
+        log_child(LOG_ERROR, "Invalid new_root parameter");
         return -1;
     }
     
-    log_message(LOG_DEBUG, "Setting up chroot: %s", new_root);
+    log_child(LOG_DEBUG, "Setting up chroot: %s", new_root);
     
     if (chdir(new_root) == -1) {
-        log_message(LOG_ERROR, "Failed to change directory to %s", new_root);
+        log_child(LOG_ERROR, "Failed to change directory to %s", new_root);
         return -1;
     }
     
     if (chroot(".") == -1) {
-        log_message(LOG_ERROR, "Failed to chroot to current directory");
+        log_child(LOG_ERROR, "Failed to chroot to current directory");
         return -1;
     }
     
     if (chdir("/") == -1) {
-        log_message(LOG_ERROR, "Failed to change directory to /");
+        log_child(LOG_ERROR, "Failed to change directory to /");
         return -1;
     }
     
@@ -78,14 +150,78 @@ int setup_chroot(const char *new_root) {
 
 int setup_pivot_root(const char *new_root, const char *old_root) {
     if (!new_root || !old_root) {
-        log_message(LOG_ERROR, "Invalid parameters for pivot_root");
+        log_child(LOG_ERROR, "Invalid parameters for pivot_root");
+        return -1;
+    }
+    
+    log_child(LOG_DEBUG, "Setting up pivot_root: %s -> %s", new_root, old_root);
+    
+    // old_root is relative to new_root, and new_root must be a mountpoint
+    char put_old[PATH_MAX];
+    format_string(put_old, sizeof(put_old), "%s/%s", new_root, old_root);
+    if (make_dir(put_old) != 0) {
         return -1;
     }
     
-    log_message(LOG_DEBUG, "Setting up pivot_root: %s -> %s", new_root, old_root);
+    if (syscall(SYS_pivot_root, new_root, put_old) == -1) {
+        log_child(LOG_ERROR, "Failed to pivot_root to %s: %s", new_root, strerrordesc_np(errno));
+        return -1;
+    }
     
-    // TODO: Implement pivot_root syscall
-    // This is more complex than chroot but more secure
+    if (chdir("/") == -1) {
+        log_child(LOG_ERROR, "Failed to change directory to /");
+        return -1;
+    }
     
     return 0;
-}
\ No newline at end of file
+}
+
+// Runs after pivot_root. Images often ship /etc/resolv.conf as a symlink
+// into the host's resolver state, so the entry is replaced, not followed.
+int write_resolv_conf(const char *nameserver) {
+    char content[64];
+    int len = format_string(content, sizeof(content), "nameserver %s\n", nameserver);
+    
+    mkdir("/etc", 0755);
+    unlink("/etc/resolv.conf");
+    int fd = open("/etc/resolv.conf", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        log_child(LOG_ERROR, "Failed to create /etc/resolv.conf: %s", strerrordesc_np(errno));
+        return -1;
+    }
+    int ret = write(fd, content, (size_t)len) == len ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    
+    if (remove(path) == -1 && errno != ENOENT) {
+        log_message(LOG_WARN, "Failed to remove %s: %s", path, strerror(errno));
+    }
+    return 0;
+}
+
+int cleanup_filesystem(const char *container_root) {
+    if (!container_root) {
+        log_message(LOG_ERROR, "Invalid container_root parameter");
+        return -1;
+    }
+    
+    log_message(LOG_DEBUG, "Cleaning up filesystem: %s", container_root);
+    
+    // Detach anything still mounted on it; FTW_MOUNT keeps the walk from
+    // descending into a mount that could not be detached
+    umount2(container_root, MNT_DETACH);
+    
+    if (nftw(container_root, remove_entry, 16, FTW_DEPTH | FTW_PHYS | FTW_MOUNT) == -1 &&
+        errno != ENOENT) {
+        log_message(LOG_ERROR, "Failed to remove %s", container_root);
+        return -1;
+    }
+    
+    return access(container_root, F_OK) == 0 ? -1 : 0;
+}
@@ -0,0 +1,407 @@
+#include "gc.h"
+#include "cgroup.h"
+#include "filesystem.h"
+#include "network.h"
+#include "registry.h"
+#include "utils.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define NET_CLASS_DIR "/sys/class/net"
+
+// Anything changed more recently may belong to a container that is still
+// being created and not yet in the registry
+#define GC_MIN_AGE_S 60
+#define GC_MAX_WORKERS 8
+#define GC_VETH_BATCH 256          // Links deleted per "ip -batch" process
+#define GC_KILL_TIMEOUT_MS 1000
+
+typedef struct {
+    gc_kind_t kind;
+    char name[32];                 // Cgroup, link or directory entry name
+} gc_item_t;
+
+// A slice of items handled by one worker: one item, or a batch of veths
+typedef struct {
+    size_t start;
+    size_t count;
+} gc_unit_t;
+
+typedef struct {
+    pid_t *pids;
+    size_t count;
+    size_t cap;
+} pid_list_t;
+
+typedef struct {
+    pid_list_t kept_ids;           // Registered and not stopped; sorted
+    pid_list_t live_procs;         // Their processes still running, sorted
+    pid_list_t dead_ids;           // "running" but the process is gone
+    gc_item_t *items;
+    size_t item_count;
+    size_t item_cap;
+    gc_unit_t *units;
+    size_t unit_count;
+    _Atomic size_t next_unit;
+    _Atomic uint32_t removed[GC_KIND_COUNT];
+} gc_state_t;
+
+const char *gc_kind_name(gc_kind_t kind) {
+    switch (kind) {
+    case GC_CGROUP: return "cgroups";
+    case GC_VETH:   return "veths";
+    case GC_NETNS:  return "netns entries";
+    case GC_ROOTFS: return "container directories";
+    default:        break;
+    }
+    return "unknown";
+}
+
+static int compare_pid(const void *a, const void *b) {
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int pid_in(const pid_list_t *list, pid_t pid) {
+    return bsearch(&pid, list->pids, list->count, sizeof(pid), compare_pid) != NULL;
+}
+
+static int pid_list_add(pid_list_t *list, pid_t pid) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        pid_t *pids = realloc(list->pids, cap * sizeof(pid_t));
+        if (!pids) {
+            return -1;
+        }
+        list->pids = pids;
+        list->cap = cap;
+    }
+    list->pids[list->count++] = pid;
+    return 0;
+}
+
+// A registered container keeps what it has until it is stopped: an exited
+// one can still be restarted or committed, so its upper dir must survive
+static int collect_registered(const container_info_t *info, void *arg) {
+    gc_state_t *state = (gc_state_t *)arg;
+    int live;
+    
+    if (strcmp(info->status, "stopped") == 0) {
+        return 0;
+    }
+    if (pid_list_add(&state->kept_ids, info->pid) != 0) {
+        return -1;
+    }
+    
+    // Between restarts or while being stopped there may be no process
+    if (strcmp(info->status, "running") == 0) {
+        live = kill(info->process_pid, 0) == 0 || errno == EPERM;
+        if (!live) {
+            return pid_list_add(&state->dead_ids, info->pid);
+        }
+    } else {
+        live = strcmp(info->status, "restarting") == 0 ||
+               strcmp(info->status, "crashloop") == 0 ||
+               strcmp(info->status, "stopping") == 0;
+    }
+    return live ? pid_list_add(&state->live_procs, info->process_pid) : 0;
+}
+
+static int add_item(gc_state_t *state, gc_kind_t kind, const char *name) {
+    if (state->item_count == state->item_cap) {
+        size_t cap = state->item_cap ? state->item_cap * 2 : 256;
+        gc_item_t *items = realloc(state->items, cap * sizeof(gc_item_t));
+        if (!items) {
+            return -1;
+        }
+        state->items = items;
+        state->item_cap = cap;
+    }
+    
+    gc_item_t *item = &state->items[state->item_count++];
+    item->kind = kind;
+    snprintf(item->name, sizeof(item->name), "%.31s", name);
+    return 0;
+}
+
+// The ID in "<prefix><digits><suffix>", or 0 if name has another form
+static pid_t parse_id(const char *name, const char *prefix, const char *suffix) {
+    size_t len = strlen(prefix);
+    
+    if (strncmp(name, prefix, len) != 0 || name[len] < '0' || name[len] > '9') {
+        return 0;
+    }
+    
+    char *end;
+    long id = strtol(name + len, &end, 10);
+    if (strcmp(end, suffix) != 0 || id <= 0 || id > INT32_MAX) {
+        return 0;
+    }
+    return (pid_t)id;
+}
+
+// Not changed for GC_MIN_AGE_S. Sysfs reports when the entry was first
+// looked up, which only ever makes an entry look younger than it is.
+static int settled(int dir_fd, const char *name, time_t now) {
+    struct stat st;
+    
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        return 0;
+    }
+    time_t changed = st.st_mtime > st.st_ctime ? st.st_mtime : st.st_ctime;
+    return now - changed >= GC_MIN_AGE_S;
+}
+
+// Cgroups from before they were named after the container hold a live
+// container under another name; never kill those
+static int holds_live_process(gc_state_t *state, const char *cgroup_name) {
+    char path[512];
+    
+    snprintf(path, sizeof(path), "%s/%s/cgroup.procs", CGROUP_ROOT, cgroup_name);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    
+    int pid, found = 0;
+    while (!found && fscanf(file, "%d", &pid) == 1) {
+        found = pid_in(&state->live_procs, (pid_t)pid);
+    }
+    
+    fclose(file);
+    return found;
+}
+
+static int on_bridge(const char *ifname) {
+    char path[PATH_MAX];
+    char target[PATH_MAX];
+    
+    snprintf(path, sizeof(path), "%s/%s/master", NET_CLASS_DIR, ifname);
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) {
+        return 0;
+    }
+    target[len] = '\0';
+    
+    const char *base = strrchr(target, '/');
+    return strcmp(base ? base + 1 : target, BRIDGE_NAME) == 0;
+}
+
+// Adds every entry of dir named <prefix><id><suffix> whose ID is not kept
+static void scan_dir(gc_state_t *state, gc_stats_t *stats, gc_kind_t kind,
+                     const char *dir, const char *prefix, const char *suffix) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return;
+    }
+    
+    time_t now = time(NULL);
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        pid_t id = parse_id(entry->d_name, prefix, suffix);
+        if (id == 0 || pid_in(&state->kept_ids, id) ||
+            !settled(dirfd(d), entry->d_name, now)) {
+            continue;
+        }
+    
+        if (kind == GC_CGROUP && holds_live_process(state, entry->d_name)) {
+            continue;
+        }
+        if (kind == GC_VETH && !on_bridge(entry->d_name)) {
+            continue;
+        }
+    
+        if (add_item(state, kind, entry->d_name) == 0) {
+            stats->orphaned[kind]++;
+        }
+    }
+    
+    closedir(d);
+}
+
+static int compare_kind(const void *a, const void *b) {
+    return (int)((const gc_item_t *)a)->kind - (int)((const gc_item_t *)b)->kind;
+}
+
+// Veths go to "ip -batch" in groups; everything else is one unit per item
+static int plan_units(gc_state_t *state) {
+    qsort(state->items, state->item_count, sizeof(gc_item_t), compare_kind);
+    
+    state->units = calloc(state->item_count + 1, sizeof(gc_unit_t));
+    if (!state->units) {
+        return -1;
+    }
+    
+    size_t i = 0;
+    while (i < state->item_count) {
+        gc_unit_t *unit = &state->units[state->unit_count++];
+        unit->start = i;
+        unit->count = 1;
+        if (state->items[i].kind == GC_VETH) {
+            while (i + unit->count < state->item_count && unit->count < GC_VETH_BATCH &&
+                   state->items[i + unit->count].kind == GC_VETH) {
+                unit->count++;
+            }
+        }
+        i += unit->count;
+    }
+    return 0;
+}
+
+static void remove_veths(gc_state_t *state, const gc_unit_t *unit) {
+    char *names[GC_VETH_BATCH];
+    char path[PATH_MAX];
+    
+    for (size_t i = 0; i < unit->count; i++) {
+        names[i] = state->items[unit->start + i].name;
+    }
+    delete_links(names, unit->count);
+    
+    // -force keeps going past failures, so count what is actually gone
+    for (size_t i = 0; i < unit->count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", NET_CLASS_DIR, names[i]);
+        if (access(path, F_OK) != 0) {
+            atomic_fetch_add(&state->removed[GC_VETH], 1);
+        }
+    }
+}
+
+static int remove_item(const gc_item_t *item) {
+    char path[PATH_MAX];
+    
+    switch (item->kind) {
+    case GC_CGROUP:
+        // Stray processes keep an orphaned cgroup populated
+        kill_cgroup(item->name, GC_KILL_TIMEOUT_MS);
+        return cleanup_cgroup(item->name);
+    
+    case GC_NETNS:
+        snprintf(path, sizeof(path), "%s/%s", CONTAINER_NETNS_PATH, item->name);
+        umount2(path, MNT_DETACH); // In case it is a bind mount, not a symlink
+        return unlink(path);
+    
+    case GC_ROOTFS:
+        snprintf(path, sizeof(path), "%s/%s", CONTAINERS_DIR, item->name);
+        return cleanup_filesystem(path);
+    
+    default:
+        return -1;
+    }
+}
+
+static void *gc_worker(void *arg) {
+    gc_state_t *state = (gc_state_t *)arg;
+    
+    for (;;) {
+        size_t u = atomic_fetch_add(&state->next_unit, 1);
+        if (u >= state->unit_count) {
+            break;
+        }
+    
+        const gc_unit_t *unit = &state->units[u];
+        const gc_item_t *item = &state->items[unit->start];
+        if (item->kind == GC_VETH) {
+            remove_veths(state, unit);
+        } else if (remove_item(item) == 0) {
+            atomic_fetch_add(&state->removed[item->kind], 1);
+        }
+    }
+    
+    return NULL;
+}
+
+static void run_workers(gc_state_t *state) {
+    pthread_t threads[GC_MAX_WORKERS];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = cpus > 0 ? (size_t)cpus : 1;
+    size_t started = 0;
+    
+    // Removal mostly waits on the kernel and on ip(8), so run a few even
+    // on one CPU
+    if (workers < 4) {
+        workers = 4;
+    }
+    if (workers > GC_MAX_WORKERS) {
+        workers = GC_MAX_WORKERS;
+    }
+    if (workers > state->unit_count) {
+        workers = state->unit_count;
+    }
+    
+    for (; started + 1 < workers; started++) {
+        if (pthread_create(&threads[started], NULL, gc_worker, state) != 0) {
+            break;
+        }
+    }
+    
+    // This thread works too, and finishes alone if no thread started
+    gc_worker(state);
+    
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int gc_collect(gc_stats_t *stats) {
+    gc_state_t state;
+    gc_stats_t local;
+    int ret = 0;
+    
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    memset(&state, 0, sizeof(state));
+    
+    if (registry_foreach(collect_registered, &state) != 0) {
+        log_message(LOG_ERROR, "Failed to read the container registry");
+        ret = -1;
+        goto out;
+    }
+    qsort(state.kept_ids.pids, state.kept_ids.count, sizeof(pid_t), compare_pid);
+    qsort(state.live_procs.pids, state.live_procs.count, sizeof(pid_t), compare_pid);
+    
+    for (size_t i = 0; i < state.dead_ids.count; i++) {
+        registry_update_container_status(state.dead_ids.pids[i], "exited");
+    }
+    stats->reconciled = (uint32_t)state.dead_ids.count;
+    
+    scan_dir(&state, stats, GC_CGROUP, CGROUP_ROOT, "minidocker_", "");
+    scan_dir(&state, stats, GC_VETH, NET_CLASS_DIR, "veth", "h");
+    scan_dir(&state, stats, GC_NETNS, CONTAINER_NETNS_PATH, "", "");
+    scan_dir(&state, stats, GC_ROOTFS, CONTAINERS_DIR, "", "");
+    
+    if (state.item_count > 0) {
+        if (plan_units(&state) != 0) {
+            log_message(LOG_ERROR, "Failed to allocate garbage collection work");
+            ret = -1;
+            goto out;
+        }
+        run_workers(&state);
+    }
+    
+    for (int kind = 0; kind < GC_KIND_COUNT; kind++) {
+        stats->removed[kind] = atomic_load(&state.removed[kind]);
+        if (stats->removed[kind] < stats->orphaned[kind]) {
+            log_message(LOG_WARN, "Could not remove %u of %u orphaned %s",
+                        stats->orphaned[kind] - stats->removed[kind],
+                        stats->orphaned[kind], gc_kind_name((gc_kind_t)kind));
+            ret = -1;
+        }
+    }
+    
+out:
+    free(state.kept_ids.pids);
+    free(state.live_procs.pids);
+    free(state.dead_ids.pids);
+    free(state.items);
+    free(state.units);
+    return ret;
+}
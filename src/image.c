@@ -0,0 +1,268 @@
+#include "image.h"
+#include "layer.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+#include <linux/loop.h>
+
+#define EROFS_SUPER_OFFSET 1024
+#define EROFS_MAGIC 0xE0F5E1E2u
+#define SQUASHFS_MAGIC 0x73717368u   // "hsqs" read little-endian
+
+// Attempts to find a free loop device when another process grabs ours first
+#define LOOP_ATTACH_TRIES 8
+
+static int make_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        log_message(LOG_ERROR, "Failed to create %s: %s", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int read_u32(int fd, off_t offset, uint32_t *value) {
+    return pread(fd, value, sizeof(*value), offset) == (ssize_t)sizeof(*value) ? 0 : -1;
+}
+
+static const char *detect_fs_type(int fd) {
+    uint32_t magic;
+    
+    if (read_u32(fd, EROFS_SUPER_OFFSET, &magic) == 0 && magic == EROFS_MAGIC) {
+        return "erofs";
+    }
+    if (read_u32(fd, 0, &magic) == 0 && magic == SQUASHFS_MAGIC) {
+        return "squashfs";
+    }
+    return NULL;
+}
+
+// Names the mount after the file's identity, so a rewritten image gets a
+// fresh mount instead of the stale one
+static void image_key(const struct stat *st, char *key, size_t len) {
+    uint64_t fields[] = { st->st_dev, st->st_ino, (uint64_t)st->st_size,
+                          (uint64_t)st->st_mtim.tv_sec, (uint64_t)st->st_mtim.tv_nsec };
+    uint64_t hash = 1469598103934665603ull;
+    
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        for (int b = 0; b < 8; b++) {
+            hash ^= (fields[i] >> (b * 8)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    }
+    snprintf(key, len, "%016llx", (unsigned long long)hash);
+}
+
+static int is_mounted(const char *mnt) {
+    char parent[PATH_MAX];
+    struct stat st, parent_st;
+    
+    snprintf(parent, sizeof(parent), "%s/..", mnt);
+    if (stat(mnt, &st) == -1 || stat(parent, &parent_st) == -1) {
+        return 0;
+    }
+    return st.st_dev != parent_st.st_dev;
+}
+
+// Binds the image to a free loop device. Direct I/O keeps the image file out
+// of the page cache, so only the filesystem's own pages are cached; the
+// device detaches itself once the filesystem is unmounted.
+static int attach_loop(int image_fd, const char *image_path, char *dev, size_t len) {
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl == -1) {
+        log_message(LOG_ERROR, "Failed to open /dev/loop-control: %s", strerror(errno));
+        return -1;
+    }
+    
+    struct loop_config config;
+    memset(&config, 0, sizeof(config));
+    config.fd = image_fd;
+    config.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO;
+    strncpy((char *)config.info.lo_file_name, image_path, LO_NAME_SIZE - 1);
+    
+    int loop_fd = -1;
+    for (int tries = 0; tries < LOOP_ATTACH_TRIES && loop_fd == -1; tries++) {
+        int num = ioctl(ctl, LOOP_CTL_GET_FREE);
+        if (num == -1) {
+            log_message(LOG_ERROR, "No free loop device: %s", strerror(errno));
+            break;
+        }
+    
+        snprintf(dev, len, "/dev/loop%d", num);
+        loop_fd = open(dev, O_RDWR | O_CLOEXEC);
+        if (loop_fd == -1) {
+            log_message(LOG_ERROR, "Failed to open %s: %s", dev, strerror(errno));
+            break;
+        }
+    
+        int ret = ioctl(loop_fd, LOOP_CONFIGURE, &config);
+        if (ret == -1 && errno == EINVAL && (config.info.lo_flags & LO_FLAGS_DIRECT_IO)) {
+            // The backing filesystem cannot do direct I/O
+            config.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+            ret = ioctl(loop_fd, LOOP_CONFIGURE, &config);
+        }
+        if (ret == -1) {
+            int err = errno;
+            close(loop_fd);
+            loop_fd = -1;
+            if (err != EBUSY) {
+                log_message(LOG_ERROR, "Failed to configure %s: %s", dev, strerror(err));
+                break;
+            }
+        }
+    }
+    
+    close(ctl);
+    return loop_fd;
+}
+
+static int mount_image(int image_fd, const char *image_path, const char *mnt) {
+    const char *fs_type = detect_fs_type(image_fd);
+    if (!fs_type) {
+        log_message(LOG_ERROR, "Not an EROFS or squashfs image: %s", image_path);
+        return -1;
+    }
+    
+    char dev[32];
+    int loop_fd = attach_loop(image_fd, image_path, dev, sizeof(dev));
+    if (loop_fd == -1) {
+        return -1;
+    }
+    
+    int ret = mount(dev, mnt, fs_type, MS_RDONLY | MS_NODEV | MS_NOSUID, NULL);
+    if (ret == -1) {
+        log_message(LOG_ERROR, "Failed to mount %s on %s: %s", image_path, mnt, strerror(errno));
+    } else {
+        log_message(LOG_INFO, "Mounted %s image %s on %s", fs_type, image_path, mnt);
+    }
+    
+    // Autoclear detaches the device on this close if the mount failed, and
+    // otherwise when the filesystem is unmounted
+    close(loop_fd);
+    return ret;
+}
+
+int image_prepare(const char *image_path, char *lowerdir, size_t len) {
+    if (!image_path || !lowerdir) {
+        log_message(LOG_ERROR, "Invalid image parameters");
+        return -1;
+    }
+    
+    // A committed layer, stacked on the image it was committed from
+    if (!strchr(image_path, '/') && layer_exists(image_path)) {
+        return layer_lowerdir(image_path, lowerdir, len);
+    }
+    
+    int image_fd = open(image_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (image_fd == -1 || fstat(image_fd, &st) == -1) {
+        log_message(LOG_ERROR, "Cannot open image %s: %s", image_path, strerror(errno));
+        if (image_fd != -1) {
+            close(image_fd);
+        }
+        return -1;
+    }
+    
+    // A plain root filesystem directory is the lower layer itself
+    if (S_ISDIR(st.st_mode)) {
+        close(image_fd);
+        char resolved[PATH_MAX];
+        if (!realpath(image_path, resolved) || strlen(resolved) >= len) {
+            log_message(LOG_ERROR, "Cannot resolve image path %s", image_path);
+            return -1;
+        }
+        strcpy(lowerdir, resolved);
+        return 0;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        log_message(LOG_ERROR, "Image must be a directory or an image file: %s", image_path);
+        close(image_fd);
+        return -1;
+    }
+    
+    char key[17];
+    char path[PATH_MAX];
+    image_key(&st, key, sizeof(key));
+    if (make_dir("/var/lib/minidocker") != 0 || make_dir(IMAGES_DIR) != 0) {
+        close(image_fd);
+        return -1;
+    }
+    
+    // Serialize against other runs mounting the same image
+    snprintf(path, sizeof(path), "%s/%s.lock", IMAGES_DIR, key);
+    int lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd == -1 || flock(lock_fd, LOCK_EX) == -1) {
+        log_message(LOG_ERROR, "Failed to lock image %s: %s", image_path, strerror(errno));
+        if (lock_fd != -1) {
+            close(lock_fd);
+        }
+        close(image_fd);
+        return -1;
+    }
+    
+    int ret = 0;
+    snprintf(path, sizeof(path), "%s/%s", IMAGES_DIR, key);
+    if (snprintf(lowerdir, len, "%s/mnt", path) >= (int)len) {
+        ret = -1;
+    } else if (make_dir(path) != 0 || make_dir(lowerdir) != 0) {
+        ret = -1;
+    } else if (!is_mounted(lowerdir)) {
+        ret = mount_image(image_fd, image_path, lowerdir);
+    }
+    
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    close(image_fd);
+    return ret;
+}
+
+int parse_image_format(const char *name, image_format_t *format) {
+    if (strcmp(name, "erofs") == 0) {
+        *format = IMAGE_EROFS;
+    } else if (strcmp(name, "squashfs") == 0) {
+        *format = IMAGE_SQUASHFS;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int image_pack(const char *rootfs_dir, const char *image_file, image_format_t format) {
+    if (!rootfs_dir || !image_file) {
+        log_message(LOG_ERROR, "Invalid pack parameters");
+        return -1;
+    }
+    
+    // EROFS with lz4hc decompresses fastest on the cold-start path; squashfs
+    // is the fallback where erofs-utils is missing
+    const char *erofs_argv[] = { "mkfs.erofs", "-zlz4hc", image_file, rootfs_dir, NULL };
+    const char *squashfs_argv[] = { "mksquashfs", rootfs_dir, image_file, "-comp", "zstd",
+                                    "-b", "64K", "-noappend", "-quiet", NULL };
+    const char *const *argv = format == IMAGE_EROFS ? erofs_argv : squashfs_argv;
+    
+    log_message(LOG_INFO, "Packing %s into %s", rootfs_dir, image_file);
+    pid_t pid = fork();
+    if (pid == -1) {
+        log_message(LOG_ERROR, "Failed to fork: %s", strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        execvp(argv[0], (char *const *)argv);
+        fprintf(stderr, "Failed to run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        log_message(LOG_ERROR, "%s failed", argv[0]);
+        return -1;
+    }
+    return 0;
+}
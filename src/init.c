@@ -0,0 +1,103 @@
+#include "init.h"
+#include "utils.h"
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+// Minimal PID 1 for containers started with --init. The user's command runs
+// as a child in its own process group; init forwards every catchable signal
+// to that group and reaps whatever gets reparented to it.
+
+static int reap_children(pid_t main_child, int *main_status) {
+    int exited = 0;
+    int status;
+    pid_t pid;
+    
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == main_child) {
+            *main_status = status;
+            exited = 1;
+        }
+    }
+    
+    return exited;
+}
+
+int run_init(const char *command, char *const args[]) {
+    if (!command || !args) {
+        log_child(LOG_ERROR, "Invalid init parameters");
+        return 1;
+    }
+    
+    // Block everything so signals are only seen through the signalfd
+    sigset_t all, orig;
+    sigfillset(&all);
+    if (sigprocmask(SIG_BLOCK, &all, &orig) == -1) {
+        log_child(LOG_ERROR, "Failed to block signals: %s", strerrordesc_np(errno));
+        return 1;
+    }
+    
+    int sfd = signalfd(-1, &all, SFD_CLOEXEC);
+    if (sfd == -1) {
+        log_child(LOG_ERROR, "Failed to create signalfd: %s", strerrordesc_np(errno));
+        return 1;
+    }
+    
+    // Not fork(): its atfork handlers take locks the daemon's other
+    // threads may have held when we were cloned
+    pid_t child = _Fork();
+    if (child == -1) {
+        log_child(LOG_ERROR, "Failed to fork init child: %s", strerrordesc_np(errno));
+        close(sfd);
+        return 1;
+    }
+    
+    if (child == 0) {
+        setpgid(0, 0);
+        // Take the terminal while SIGTTOU is still blocked
+        if (isatty(STDIN_FILENO)) {
+            tcsetpgrp(STDIN_FILENO, getpid());
+        }
+        sigprocmask(SIG_SETMASK, &orig, NULL);
+        execvp(command, args);
+        log_child(LOG_ERROR, "execvp failed: %s", strerrordesc_np(errno));
+        _exit(127);
+    }
+    
+    // Also set from the parent so forwarding never races the child's setpgid
+    setpgid(child, child);
+    
+    int status = 0;
+    for (;;) {
+        struct signalfd_siginfo si;
+        ssize_t n = read(sfd, &si, sizeof(si));
+        if (n != sizeof(si)) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            log_child(LOG_ERROR, "Failed to read signalfd");
+            kill(-child, SIGKILL);
+            break;
+        }
+        
+        if (si.ssi_signo == SIGCHLD) {
+            if (reap_children(child, &status)) {
+                break;
+            }
+            continue;
+        }
+        
+        // Forward to the whole group, falling back to the child itself if
+        // it has since moved to another group
+        if (kill(-child, (int)si.ssi_signo) == -1 && errno == ESRCH) {
+            kill(child, (int)si.ssi_signo);
+        }
+    }
+    
+    close(sfd);
+    
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,126 @@
+#include "ksm.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/prctl.h>
+
+#ifndef PR_SET_MEMORY_MERGE
+#define PR_SET_MEMORY_MERGE 67
+#endif
+
+int ksm_enable_merge(void) {
+    // Added in Linux 6.4; kept across fork and exec since 6.7
+    return prctl(PR_SET_MEMORY_MERGE, 1, 0, 0, 0) == 0 ? 0 : -1;
+}
+
+static int write_ksm_file(const char *name, int value) {
+    char path[128];
+    char text[16];
+    
+    snprintf(path, sizeof(path), "%s/%s", KSM_SYSFS, name);
+    int len = snprintf(text, sizeof(text), "%d", value);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        log_message(LOG_ERROR, "Failed to open %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (write(fd, text, (size_t)len) != len) {
+        log_message(LOG_ERROR, "Failed to write %s to %s: %s", text, path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static int64_t read_ksm_file(const char *name) {
+    char path[128];
+    
+    snprintf(path, sizeof(path), "%s/%s", KSM_SYSFS, name);
+    char *content = read_file_content(path);
+    int64_t value = content ? strtoll(content, NULL, 10) : -1;
+    free(content);
+    return value;
+}
+
+int ksm_start(void) {
+    // Leave it alone if it is already merging, or if an administrator
+    // chose 2 (unmerge everything)
+    if (read_ksm_file("run") != 0) {
+        return 0;
+    }
+    log_message(LOG_INFO, "Starting kernel same-page merging");
+    return write_ksm_file("run", 1);
+}
+
+int ksm_tune(int pages_to_scan, int sleep_ms) {
+    if (pages_to_scan > 0 && write_ksm_file("pages_to_scan", pages_to_scan) != 0) {
+        return -1;
+    }
+    if (sleep_ms > 0 && write_ksm_file("sleep_millisecs", sleep_ms) != 0) {
+        return -1;
+    }
+    return ksm_start();
+}
+
+// Adds one process's /proc/<pid>/ksm_stat; it may exit while we look
+static void add_process_usage(pid_t pid, ksm_usage_t *usage) {
+    char path[64];
+    char line[128];
+    
+    snprintf(path, sizeof(path), "/proc/%d/ksm_stat", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return;
+    }
+    usage->processes++;
+    while (fgets(line, sizeof(line), fp)) {
+        char key[64];
+        char value[32];
+        if (sscanf(line, "%63[^ :]%*[ :]%31s", key, value) != 2) {
+            continue;
+        }
+        if (strcmp(key, "ksm_merging_pages") == 0) {
+            usage->merging_pages += strtoull(value, NULL, 10);
+        } else if (strcmp(key, "ksm_zero_pages") == 0) {
+            usage->zero_pages += strtoull(value, NULL, 10);
+        } else if (strcmp(key, "ksm_process_profit") == 0) {
+            usage->profit += strtoll(value, NULL, 10);
+        } else if (strcmp(key, "ksm_merge_any") == 0 && strcmp(value, "yes") == 0) {
+            usage->merge_any++;
+        }
+    }
+    fclose(fp);
+}
+
+int ksm_container_usage(pid_t id, ksm_usage_t *usage) {
+    char path[128];
+    
+    memset(usage, 0, sizeof(*usage));
+    snprintf(path, sizeof(path), "/sys/fs/cgroup/minidocker_%d/cgroup.procs", (int)id);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    
+    int pid;
+    while (fscanf(fp, "%d", &pid) == 1) {
+        add_process_usage((pid_t)pid, usage);
+    }
+    fclose(fp);
+    return 0;
+}
+
+int ksm_host_usage(ksm_host_t *host) {
+    int64_t run = read_ksm_file("run");
+    
+    memset(host, 0, sizeof(*host));
+    if (run < 0) {
+        return -1;
+    }
+    host->running = run == 1;
+    host->pages_shared = (uint64_t)read_ksm_file("pages_shared");
+    host->pages_sharing = (uint64_t)read_ksm_file("pages_sharing");
+    host->full_scans = (uint64_t)read_ksm_file("full_scans");
+    host->general_profit = read_ksm_file("general_profit");
+    return 0;
+}
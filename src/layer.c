@@ -0,0 +1,597 @@
+#include "layer.h"
+#include "cgroup.h"
+#include "filesystem.h"
+#include "image.h"
+#include "registry.h"
+#include "sha256.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
+#include <linux/limits.h>
+
+#define LAYER_MAX_WORKERS 8
+#define LAYER_MAX_DEPTH 64         // Layers stacked under one container
+#define LAYER_READ_SIZE (1024 * 1024)
+#define LAYER_FREEZE_TIMEOUT_MS 5000
+#define OPAQUE_XATTR "trusted.overlay.opaque"
+
+// One path in the upper dir, in walk order. Workers fill in the digest.
+typedef struct {
+    char kind;                     // 'd'ir, 'f'ile, 'l'ink, 'w'hiteout, 'n'ode
+    int opaque;                    // Directory hides the layers below
+    char *path;                    // Relative to the upper dir
+    char *target;                  // Symlink target
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    dev_t rdev;
+    off_t size;
+    char digest[SHA256_HEX_SIZE];
+} layer_entry_t;
+
+typedef struct {
+    const char *upper;
+    char diff[PATH_MAX];
+    layer_entry_t *entries;
+    size_t count;
+    size_t capacity;
+    atomic_size_t next_entry;
+    atomic_uint blob_seq;          // Names temporary blob files
+    atomic_int failed;
+    atomic_uint blobs_reused;
+    atomic_uint_least64_t bytes_stored;
+} commit_state_t;
+
+// nftw() takes no user pointer
+static commit_state_t *walk_state;
+
+static int make_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        log_message(LOG_ERROR, "Failed to create %s: %s", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int valid_name(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len > LAYER_NAME_MAX || name[0] == '.') {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int layer_exists(const char *name) {
+    char path[PATH_MAX];
+    
+    if (!name || !valid_name(name)) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%s/%.*s/manifest", LAYERS_DIR, LAYER_NAME_MAX, name);
+    return access(path, F_OK) == 0;
+}
+
+// The first manifest line names the image the layer was committed on
+static int read_parent(const char *name, char *parent, size_t len) {
+    char path[PATH_MAX];
+    char line[PATH_MAX + 16];
+    
+    snprintf(path, sizeof(path), "%s/%.*s/manifest", LAYERS_DIR, LAYER_NAME_MAX, name);
+    FILE *fp = fopen(path, "re");
+    if (!fp) {
+        log_message(LOG_ERROR, "Failed to open layer %s: %s", name, strerror(errno));
+        return -1;
+    }
+    int ok = fgets(line, sizeof(line), fp) && strncmp(line, "parent\t", 7) == 0;
+    fclose(fp);
+    
+    if (!ok) {
+        log_message(LOG_ERROR, "Corrupt manifest for layer %s", name);
+        return -1;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    if (snprintf(parent, len, "%s", line + 7) >= (int)len) {
+        return -1;
+    }
+    return 0;
+}
+
+int layer_lowerdir(const char *name, char *lowerdir, size_t len) {
+    char current[PATH_MAX];
+    size_t used = 0;
+    
+    snprintf(current, sizeof(current), "%s", name);
+    for (int depth = 0; layer_exists(current); depth++) {
+        if (depth == LAYER_MAX_DEPTH) {
+            log_message(LOG_ERROR, "Layer %s is stacked more than %d deep", name, LAYER_MAX_DEPTH);
+            return -1;
+        }
+        // Overlay lists lowerdirs top first, separated by ':'
+        int n = snprintf(lowerdir + used, len - used, "%s/%s/diff:", LAYERS_DIR, current);
+        if (n < 0 || (size_t)n >= len - used) {
+            log_message(LOG_ERROR, "Layer stack for %s is too long", name);
+            return -1;
+        }
+        used += (size_t)n;
+        if (read_parent(current, current, sizeof(current)) != 0) {
+            return -1;
+        }
+    }
+    
+    return image_prepare(current, lowerdir + used, len - used);
+}
+
+static layer_entry_t *add_entry(commit_state_t *state, char kind, const char *path,
+                                const struct stat *st) {
+    if (state->count == state->capacity) {
+        size_t capacity = state->capacity ? state->capacity * 2 : 256;
+        layer_entry_t *entries = realloc(state->entries, capacity * sizeof(*entries));
+        if (!entries) {
+            return NULL;
+        }
+        state->entries = entries;
+        state->capacity = capacity;
+    }
+    
+    layer_entry_t *entry = &state->entries[state->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->path = strdup(path);
+    if (!entry->path) {
+        return NULL;
+    }
+    entry->kind = kind;
+    entry->mode = st->st_mode;
+    entry->uid = st->st_uid;
+    entry->gid = st->st_gid;
+    entry->rdev = st->st_rdev;
+    entry->size = st->st_size;
+    state->count++;
+    return entry;
+}
+
+// Recreates everything but regular file contents in the new tree as the
+// walk goes, so parent directories exist before the workers link files
+static int walk_upper(const char *fpath, const struct stat *st, int flag, struct FTW *ftw) {
+    commit_state_t *state = walk_state;
+    const char *rel = fpath + strlen(state->upper);
+    
+    (void)ftw;
+    if (*rel == '\0') {
+        return 0;
+    }
+    rel++;
+    
+    char dst[PATH_MAX];
+    if (snprintf(dst, sizeof(dst), "%s/%s", state->diff, rel) >= (int)sizeof(dst)) {
+        log_message(LOG_ERROR, "Path too long: %s", fpath);
+        return -1;
+    }
+    
+    if (flag == FTW_DNR || flag == FTW_NS) {
+        log_message(LOG_ERROR, "Cannot read %s", fpath);
+        return -1;
+    }
+    
+    layer_entry_t *entry;
+    if (S_ISREG(st->st_mode)) {
+        return add_entry(state, 'f', rel, st) ? 0 : -1;
+    } else if (S_ISDIR(st->st_mode)) {
+        if (!(entry = add_entry(state, 'd', rel, st)) || mkdir(dst, st->st_mode & 07777) == -1) {
+            goto fail;
+        }
+        char value[2];
+        entry->opaque = getxattr(fpath, OPAQUE_XATTR, value, sizeof(value)) == 1 && value[0] == 'y';
+        if (entry->opaque && setxattr(dst, OPAQUE_XATTR, "y", 1, 0) == -1) {
+            goto fail;
+        }
+    } else if (S_ISLNK(st->st_mode)) {
+        char target[PATH_MAX];
+        ssize_t n = readlink(fpath, target, sizeof(target) - 1);
+        if (n == -1 || !(entry = add_entry(state, 'l', rel, st))) {
+            goto fail;
+        }
+        target[n] = '\0';
+        if (!(entry->target = strdup(target)) || symlink(target, dst) == -1) {
+            goto fail;
+        }
+    } else {
+        // A 0:0 character device is how overlayfs records a deletion
+        int whiteout = S_ISCHR(st->st_mode) && st->st_rdev == makedev(0, 0);
+        if (!add_entry(state, whiteout ? 'w' : 'n', rel, st) ||
+            mknod(dst, st->st_mode, st->st_rdev) == -1) {
+            goto fail;
+        }
+    }
+    
+    if (lchown(dst, st->st_uid, st->st_gid) == -1) {
+        goto fail;
+    }
+    if (S_ISDIR(st->st_mode) && chmod(dst, st->st_mode & 07777) == -1) {
+        goto fail;
+    }
+    return 0;
+    
+fail:
+    log_message(LOG_ERROR, "Failed to copy %s: %s", fpath, strerror(errno));
+    return -1;
+}
+
+static int hash_file(int fd, char *buf, char digest[SHA256_HEX_SIZE]) {
+    sha256_ctx_t ctx;
+    uint8_t raw[SHA256_DIGEST_SIZE];
+    ssize_t n;
+    
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    sha256_init(&ctx);
+    while ((n = read(fd, buf, LAYER_READ_SIZE)) > 0) {
+        sha256_update(&ctx, buf, (size_t)n);
+    }
+    if (n == -1) {
+        return -1;
+    }
+    sha256_final(&ctx, raw);
+    sha256_hex(raw, digest);
+    return 0;
+}
+
+// Shares extents where the filesystem supports reflinks, and otherwise
+// copies in the kernel
+static int copy_data(int src, int dst, char *buf) {
+    if (ioctl(dst, FICLONE, src) == 0) {
+        return 0;
+    }
+    
+    loff_t in = 0, out = 0;
+    ssize_t n;
+    while ((n = copy_file_range(src, &in, dst, &out, 1 << 30, 0)) > 0) {
+    }
+    if (n == 0) {
+        return 0;
+    }
+    if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP) {
+        return -1;
+    }
+    
+    if (lseek(src, 0, SEEK_SET) == -1 || ftruncate(dst, 0) == -1 || lseek(dst, 0, SEEK_SET) == -1) {
+        return -1;
+    }
+    while ((n = read(src, buf, LAYER_READ_SIZE)) > 0) {
+        if (write(dst, buf, (size_t)n) != n) {
+            return -1;
+        }
+    }
+    return n == 0 ? 0 : -1;
+}
+
+// Writes a copy of src with the entry's ownership and mode to path,
+// through a temporary name so that path never holds a partial file
+static int store_copy(commit_state_t *state, int src, const layer_entry_t *entry,
+                      const char *path, char *buf) {
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.%u.tmp", path, atomic_fetch_add(&state->blob_seq, 1));
+    
+    int dst = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (dst == -1) {
+        return -1;
+    }
+    int ret = copy_data(src, dst, buf);
+    if (ret == 0 && (fchown(dst, entry->uid, entry->gid) == -1 ||
+                     fchmod(dst, entry->mode & 07777) == -1)) {
+        ret = -1;
+    }
+    close(dst);
+    
+    if (ret == 0 && rename(tmp, path) == -1) {
+        ret = -1;
+    }
+    if (ret != 0) {
+        unlink(tmp);
+    }
+    return ret;
+}
+
+static int same_owner_and_mode(const struct stat *st, const layer_entry_t *entry) {
+    return st->st_uid == entry->uid && st->st_gid == entry->gid &&
+           (st->st_mode & 07777) == (entry->mode & 07777);
+}
+
+// Hashes one file, stores its content as a blob unless an identical one
+// exists, and links the blob into the layer. A hardlink needs the blob to
+// carry the same owner and mode; otherwise the layer gets its own copy,
+// which is still a reflink where the filesystem allows.
+static int commit_file(commit_state_t *state, layer_entry_t *entry, char *buf) {
+    char src_path[PATH_MAX], dst_path[PATH_MAX], blob_path[PATH_MAX];
+    int src = -1;
+    if (snprintf(src_path, sizeof(src_path), "%s/%s", state->upper, entry->path) >= (int)sizeof(src_path) ||
+        snprintf(dst_path, sizeof(dst_path), "%s/%s", state->diff, entry->path) >= (int)sizeof(dst_path)) {
+        errno = ENAMETOOLONG;
+        goto fail;
+    }
+    
+    src = open(src_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (src == -1 || hash_file(src, buf, entry->digest) == -1) {
+        goto fail;
+    }
+    snprintf(blob_path, sizeof(blob_path), "%s/%s", BLOBS_DIR, entry->digest);
+    
+    struct stat st;
+    if (stat(blob_path, &st) == 0) {
+        atomic_fetch_add(&state->blobs_reused, 1);
+    } else if (store_copy(state, src, entry, blob_path, buf) == 0) {
+        atomic_fetch_add(&state->bytes_stored, (uint64_t)entry->size);
+        if (stat(blob_path, &st) == -1) {
+            goto fail;
+        }
+    } else {
+        goto fail;
+    }
+    
+    if (same_owner_and_mode(&st, entry) && link(blob_path, dst_path) == 0) {
+        close(src);
+        return 0;
+    }
+    
+    int blob = open(blob_path, O_RDONLY | O_CLOEXEC);
+    if (blob == -1) {
+        goto fail;
+    }
+    int ret = store_copy(state, blob, entry, dst_path, buf);
+    close(blob);
+    if (ret == 0) {
+        close(src);
+        return 0;
+    }
+    
+fail:
+    log_message(LOG_ERROR, "Failed to commit %s: %s", src_path, strerror(errno));
+    if (src != -1) {
+        close(src);
+    }
+    return -1;
+}
+
+static void *commit_worker(void *arg) {
+    commit_state_t *state = (commit_state_t *)arg;
+    char *buf = malloc(LAYER_READ_SIZE);
+    
+    if (!buf) {
+        atomic_store(&state->failed, 1);
+        return NULL;
+    }
+    
+    for (;;) {
+        size_t i = atomic_fetch_add(&state->next_entry, 1);
+        if (i >= state->count || atomic_load(&state->failed)) {
+            break;
+        }
+        if (state->entries[i].kind == 'f' && commit_file(state, &state->entries[i], buf) != 0) {
+            atomic_store(&state->failed, 1);
+        }
+    }
+    
+    free(buf);
+    return NULL;
+}
+
+static void run_workers(commit_state_t *state, size_t files) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = cpus > 0 ? (size_t)cpus : 1;
+    pthread_t threads[LAYER_MAX_WORKERS];
+    size_t started = 0;
+    
+    if (workers > LAYER_MAX_WORKERS) {
+        workers = LAYER_MAX_WORKERS;
+    }
+    if (workers > files) {
+        workers = files;
+    }
+    
+    // The calling thread is one of the workers
+    for (size_t i = 1; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, commit_worker, state) == 0) {
+            started++;
+        }
+    }
+    commit_worker(state);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static int write_manifest(const commit_state_t *state, const char *dir,
+                          const char *parent, pid_t id) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/manifest", dir) >= (int)sizeof(path)) {
+        return -1;
+    }
+    FILE *fp = fopen(path, "we");
+    if (!fp) {
+        return -1;
+    }
+    
+    // Tab-separated; the path is always the last field
+    fprintf(fp, "parent\t%s\n", parent);
+    fprintf(fp, "container\t%d\n", (int)id);
+    fprintf(fp, "created\t%ld\n", (long)time(NULL));
+    for (size_t i = 0; i < state->count; i++) {
+        const layer_entry_t *e = &state->entries[i];
+        switch (e->kind) {
+        case 'f':
+            fprintf(fp, "f\t%o\t%d\t%d\t%lld\t%s\t%s\n", e->mode & 07777, (int)e->uid,
+                    (int)e->gid, (long long)e->size, e->digest, e->path);
+            break;
+        case 'd':
+            fprintf(fp, "%c\t%o\t%d\t%d\t%s\n", e->opaque ? 'o' : 'd', e->mode & 07777,
+                    (int)e->uid, (int)e->gid, e->path);
+            break;
+        case 'l':
+            fprintf(fp, "l\t%d\t%d\t%s\t%s\n", (int)e->uid, (int)e->gid, e->target, e->path);
+            break;
+        case 'w':
+            fprintf(fp, "w\t%s\n", e->path);
+            break;
+        default:
+            fprintf(fp, "n\t%o\t%d\t%d\t%u:%u\t%s\n", e->mode, (int)e->uid, (int)e->gid,
+                    major(e->rdev), minor(e->rdev), e->path);
+            break;
+        }
+    }
+    
+    int ret = ferror(fp) ? -1 : 0;
+    if (fclose(fp) != 0) {
+        ret = -1;
+    }
+    return ret;
+}
+
+// Resolves the image the container runs on to something that stays valid
+// as a parent: a layer name, or an absolute path
+static int commit_parent(const container_info_t *info, char *parent, size_t len) {
+    if (layer_exists(info->image) || info->image[0] == '/') {
+        return snprintf(parent, len, "%s", info->image) < (int)len ? 0 : -1;
+    }
+    
+    char resolved[PATH_MAX];
+    if (!realpath(info->image, resolved) || strlen(resolved) >= len) {
+        log_message(LOG_ERROR, "Cannot resolve image %s of container %d",
+                    info->image, (int)info->pid);
+        return -1;
+    }
+    strcpy(parent, resolved);
+    return 0;
+}
+
+int layer_commit(pid_t id, const char *name, layer_stats_t *stats) {
+    layer_stats_t local;
+    if (!stats) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    
+    if (!name || !valid_name(name)) {
+        log_message(LOG_ERROR, "Invalid layer name: %s", name ? name : "(null)");
+        return -1;
+    }
+    if (layer_exists(name)) {
+        log_message(LOG_ERROR, "Layer %s already exists", name);
+        return -1;
+    }
+    
+    container_info_t info;
+    if (registry_get_container(id, &info) != 0) {
+        log_message(LOG_ERROR, "Container %d not found", (int)id);
+        return -1;
+    }
+    char parent[PATH_MAX];
+    if (commit_parent(&info, parent, sizeof(parent)) != 0) {
+        return -1;
+    }
+    
+    char upper[PATH_MAX];
+    snprintf(upper, sizeof(upper), "%s/%d/upper", CONTAINERS_DIR, (int)id);
+    if (access(upper, F_OK) != 0) {
+        log_message(LOG_ERROR, "Container %d has no writable layer", (int)id);
+        return -1;
+    }
+    
+    if (make_dir("/var/lib/minidocker") != 0 || make_dir(LAYERS_DIR) != 0 ||
+        make_dir("/var/lib/minidocker/blobs") != 0 || make_dir(BLOBS_DIR) != 0) {
+        return -1;
+    }
+    
+    // Built under a hidden name and renamed into place when complete
+    char tmp_dir[PATH_MAX];
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/.%s.%d", LAYERS_DIR, name, (int)getpid());
+    
+    commit_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.upper = upper;
+    if (snprintf(state.diff, sizeof(state.diff), "%s/diff", tmp_dir) >= (int)sizeof(state.diff) ||
+        make_dir(tmp_dir) != 0 || make_dir(state.diff) != 0) {
+        return -1;
+    }
+    
+    // Keep a running container from writing while its files are read
+    char cgroup_name[64];
+    snprintf(cgroup_name, sizeof(cgroup_name), "minidocker_%d", (int)id);
+    int frozen = strcmp(info.status, "running") == 0 &&
+                 freeze_cgroup(cgroup_name, 1, LAYER_FREEZE_TIMEOUT_MS) == 0;
+    if (strcmp(info.status, "running") == 0 && !frozen) {
+        log_message(LOG_WARN, "Could not freeze container %d; committing it live", (int)id);
+    }
+    
+    // Only the upper dir is walked, so the cost follows what the container
+    // changed rather than the size of its image
+    int ret = 0;
+    walk_state = &state;
+    if (nftw(upper, walk_upper, 64, FTW_PHYS) != 0) {
+        ret = -1;
+    }
+    walk_state = NULL;
+    
+    size_t files = 0;
+    for (size_t i = 0; i < state.count; i++) {
+        switch (state.entries[i].kind) {
+        case 'f':
+            files++;
+            stats->bytes += (uint64_t)state.entries[i].size;
+            break;
+        case 'd':
+            stats->dirs++;
+            stats->whiteouts += state.entries[i].opaque ? 1 : 0;
+            break;
+        case 'w':
+            stats->whiteouts++;
+            break;
+        }
+    }
+    stats->files = (uint32_t)files;
+    
+    if (ret == 0 && files > 0) {
+        run_workers(&state, files);
+        ret = atomic_load(&state.failed) ? -1 : 0;
+    }
+    
+    if (frozen) {
+        freeze_cgroup(cgroup_name, 0, 0);
+    }
+    stats->blobs_reused = atomic_load(&state.blobs_reused);
+    stats->bytes_stored = atomic_load(&state.bytes_stored);
+    
+    if (ret == 0 && write_manifest(&state, tmp_dir, parent, id) != 0) {
+        log_message(LOG_ERROR, "Failed to write manifest for layer %s", name);
+        ret = -1;
+    }
+    
+    char layer_dir[PATH_MAX];
+    snprintf(layer_dir, sizeof(layer_dir), "%s/%s", LAYERS_DIR, name);
+    if (ret == 0 && rename(tmp_dir, layer_dir) == -1) {
+        log_message(LOG_ERROR, "Failed to create layer %s: %s", name, strerror(errno));
+        ret = -1;
+    }
+    if (ret != 0) {
+        cleanup_filesystem(tmp_dir);
+    }
+    
+    for (size_t i = 0; i < state.count; i++) {
+        free(state.entries[i].path);
+        free(state.entries[i].target);
+    }
+    free(state.entries);
+    return ret;
+}
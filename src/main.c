@@ -1,43 +1,102 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "container.h"
+#include "daemon.h"
+#include "events.h"
+#include "exec.h"
+#include "gc.h"
+#include "image.h"
+#include "ksm.h"
+#include "layer.h"
+#include "minidocker_client.h"
+#include "registry.h"
+#include "supervisor.h"
 #include "utils.h"
 
 void print_usage(const char *prog_name) {
     printf("Usage: %s <command> [options]\n", prog_name);
     printf("Commands:\n");
-    printf("  run <image> <command>    Run a new container\n");
-    printf("  stop <container_id>      Stop a running container\n");
-    printf("  ps                       List running containers\n");
-    printf("  help                     Show this help message\n");
+    printf("  run [options] <image> <command>    Run a new container\n");
+    printf("    -p hostPort:ctrPort[/proto]      Publish a container port (tcp/udp)\n");
+    printf("    --network <mode>                 bridge (default), host, none,\n");
+    printf("                                     macvlan:<parent>, ipvlan:<parent>\n");
+    printf("    --ip <addr/prefix>               Static address for macvlan/ipvlan\n");
+    printf("    --init                           Run a minimal init as PID 1\n");
+    printf("    --health-cmd <cmd>               Command run in the container to check health\n");
+    printf("    --health-interval <duration>     Time between checks (default 30s)\n");
+    printf("    --health-timeout <duration>      Time before a check fails (default 30s)\n");
+    printf("    --health-retries <n>             Failures before unhealthy (default 3)\n");
+    printf("    --restart <policy>               no (default), on-failure[:max], always,\n");
+    printf("                                     unless-stopped\n");
+    printf("    --cpus <n>                       Dedicate n CPUs to the container\n");
+    printf("    --cpuset-policy <policy>         pack (default), spread or isolate\n");
+    printf("    --security-opt seccomp=<profile> Seccomp profile (JSON file) or unconfined\n");
+    printf("    --cap-add <cap>, --cap-drop <cap> Change the capability set (name or ALL)\n");
+    printf("    --name <name>                    Name other containers can resolve\n");
+    printf("    --alias <name>                   Another resolvable name (repeatable)\n");
+    printf("    --memory-dedup                   Share identical memory pages with other containers\n");
+    printf("  stop <container_id>                Stop a running container\n");
+    printf("  exec [-t] <container_id> <command> Run a command in a running container\n");
+    printf("  ps                                 List running containers\n");
+    printf("  inspect <container_id>             Show details of a container\n");
+    printf("  stats [container_id...]            Show memory use and same-page merging savings\n");
+    printf("  gc                                 Remove resources leaked by dead containers\n");
+    printf("  commit <container_id> <name>       Save a container's changes as a new layer\n");
+    printf("  image pack <rootfs_dir> <file>     Pack a root filesystem into a single image file\n");
+    printf("    --format <fmt>                   erofs (default) or squashfs\n");
+    printf("  events [options]                   Stream container lifecycle events\n");
+    printf("    --since <time>                   Replay from a Unix time or duration ago (10m)\n");
+    printf("    --filter container=<id>          Only this container (repeatable)\n");
+    printf("    --filter event=<type>            create, start, exit, stop, oom, health_status\n");
+    printf("  daemon [options]                   Run minidockerd in the foreground\n");
+    printf("    --socket <path>                  Control socket path\n");
+    printf("    --metrics-addr <addr>            Serve Prometheus metrics on [host]:port or a socket path\n");
+    printf("    --dns-upstream <ip[:port]>       Forward other DNS queries here (default: host's)\n");
+    printf("    --no-dns                         Do not serve DNS on the bridge\n");
+    printf("    --ksm-pages-to-scan <n>          Pages ksmd scans per batch\n");
+    printf("    --ksm-sleep-ms <ms>              Pause between ksmd batches\n");
+    printf("  help                               Show this help message\n");
 }
 
 int cmd_run(int argc, char *argv[]) {
-    if (argc < 4) {
-        fprintf(stderr, "Usage: minidocker run <image> <command>\n");
-        return 1;
-    }
-
-    // Validate arguments
-    if (!argv[2] || !argv[3]) {
-        fprintf(stderr, "Error: Invalid arguments\n");
+    container_t container;
+    if (parse_run_args(argc - 2, &argv[2], &container) != 0) {
         return 1;
     }
     
-    container_t container = {0};
-    container.image_path = argv[2];
-    container.command = argv[3];
-    container.args = &argv[3];
-    container.cpu_limit = 100;  // Default CPU shares
-    container.memory_limit = 128 * 1024 * 1024;  // Default 128MB
+    // Hand the request to the daemon when one is running
+    mdc_client_t *client = mdc_connect(NULL);
+    if (client) {
+        pid_t pid;
+        int ret = mdc_run(client, argc - 2, &argv[2], &pid);
+        mdc_close(client);
+        if (ret != 0) {
+            log_message(LOG_ERROR, "Failed to create container: %s", md_status_name(ret));
+            return 1;
+        }
+        log_message(LOG_INFO, "Container created with PID: %d", (int)pid);
+        return 0;
+    }
 
     log_message(LOG_INFO, "Creating container with image: %s", container.image_path);
     
     int result = create_container(&container);
     if (result != 0) {
         log_message(LOG_ERROR, "Failed to create container");
+        return result;
+    }
+    
+    // Health checks and restarts need a supervisor; stay in the
+    // foreground as one
+    if (container.health_cmd || container.restart_policy != RESTART_NO) {
+        if (!supervisor_watch(&container)) {
+            log_message(LOG_ERROR, "Failed to supervise container");
+            return 1;
+        }
+        return supervisor_run() == 0 ? 0 : 1;
     }
     return result;
 }
@@ -61,36 +120,445 @@ int cmd_stop(int argc, char *argv[]) {
     
     log_message(LOG_INFO, "Stopping container with PID: %d", (int)pid);
     
-    // TODO: Implement container stopping
+    mdc_client_t *client = mdc_connect(NULL);
+    if (client) {
+        int ret = mdc_stop(client, pid);
+        mdc_close(client);
+        if (ret != 0) {
+            log_message(LOG_ERROR, "Failed to stop container: %s", md_status_name(ret));
+            return 1;
+        }
+        return 0;
+    }
+    
     return stop_container(pid);
 }
 
+int cmd_exec(int argc, char *argv[]) {
+    int use_tty = 0;
+    int i = 2;
+    
+    if (i < argc && strcmp(argv[i], "-t") == 0) {
+        use_tty = 1;
+        i++;
+    }
+    
+    if (argc - i < 2) {
+        fprintf(stderr, "Usage: minidocker exec [-t] <container_id> <command> [args...]\n");
+        return 1;
+    }
+    
+    pid_t pid = (pid_t)atoi(argv[i]);
+    if (pid <= 0) {
+        fprintf(stderr, "Error: Invalid PID: %s\n", argv[i]);
+        return 1;
+    }
+    
+    int result = container_exec(pid, &argv[i + 1], use_tty);
+    if (result < 0) {
+        log_message(LOG_ERROR, "Failed to exec in container");
+        return 1;
+    }
+    return result;
+}
+
 int cmd_ps(void) {
     log_message(LOG_INFO, "Listing running containers");
     
-    // TODO: Implement container listing
+    // Served from the daemon's in-memory state when it is running
+    mdc_client_t *client = mdc_connect(NULL);
+    if (client) {
+        container_info_t *infos;
+        size_t count;
+        int ret = mdc_ps(client, &infos, &count);
+        mdc_close(client);
+        if (ret != 0) {
+            log_message(LOG_ERROR, "Failed to list containers: %s", md_status_name(ret));
+            return 1;
+        }
+        registry_print_header();
+        for (size_t i = 0; i < count; i++) {
+            registry_print_container(&infos[i]);
+        }
+        free(infos);
+        return 0;
+    }
+    
     return list_containers();
 }
 
+int cmd_gc(void) {
+    gc_stats_t stats;
+    int ret;
+    
+    // The daemon queues it behind any runs, so nothing is created meanwhile
+    mdc_client_t *client = mdc_connect(NULL);
+    if (client) {
+        ret = mdc_gc(client, &stats);
+        mdc_close(client);
+        if (ret != 0) {
+            log_message(LOG_ERROR, "Failed to collect garbage: %s", md_status_name(ret));
+            return 1;
+        }
+    } else {
+        ret = gc_collect(&stats);
+    }
+    
+    if (stats.reconciled > 0) {
+        printf("Marked %u dead containers exited\n", stats.reconciled);
+    }
+    for (int kind = 0; kind < GC_KIND_COUNT; kind++) {
+        if (stats.orphaned[kind] > 0) {
+            printf("Removed %u of %u orphaned %s\n", stats.removed[kind],
+                   stats.orphaned[kind], gc_kind_name((gc_kind_t)kind));
+        }
+    }
+    return ret == 0 ? 0 : 1;
+}
+
+int cmd_commit(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: minidocker commit <container_id> <name>\n");
+        return 1;
+    }
+    
+    pid_t pid = (pid_t)atoi(argv[2]);
+    if (pid <= 0) {
+        fprintf(stderr, "Error: Invalid PID: %s\n", argv[2]);
+        return 1;
+    }
+    
+    layer_stats_t stats;
+    if (layer_commit(pid, argv[3], &stats) != 0) {
+        return 1;
+    }
+    
+    printf("Committed container %d as %s: %u files (%.1f MB, %.1f MB new), "
+           "%u already stored, %u dirs, %u whiteouts\n",
+           (int)pid, argv[3], stats.files, stats.bytes / 1048576.0,
+           stats.bytes_stored / 1048576.0, stats.blobs_reused, stats.dirs, stats.whiteouts);
+    return 0;
+}
+
+static int print_stats(const container_info_t *info, void *arg) {
+    double page_mb = *(long *)arg / 1048576.0;
+    char path[128];
+    ksm_usage_t usage;
+    
+    if (strcmp(info->status, "running") != 0) {
+        return 0;
+    }
+    snprintf(path, sizeof(path), "/sys/fs/cgroup/minidocker_%d/memory.current", (int)info->pid);
+    char *content = read_file_content(path);
+    double memory_mb = content ? strtoull(content, NULL, 10) / 1048576.0 : 0;
+    free(content);
+    
+    if (ksm_container_usage(info->pid, &usage) != 0) {
+        memset(&usage, 0, sizeof(usage));
+    }
+    printf("%-12d\t%-16s\t%10.1f\t%-5s\t%10.1f\t%10.1f\n",
+           (int)info->pid, info->name[0] ? info->name : "-", memory_mb,
+           usage.merge_any > 0 ? "yes" : "no", usage.merging_pages * page_mb,
+           usage.profit / 1048576.0);
+    return 0;
+}
+
+// Memory per container and what same-page merging saves across them
+int cmd_stats(int argc, char *argv[]) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    
+    printf("CONTAINER ID\tNAME            \tMEMORY(MB)\tDEDUP\tMERGED(MB)\t SAVED(MB)\n");
+    if (argc > 2) {
+        for (int i = 2; i < argc; i++) {
+            container_info_t info;
+            if (registry_get_container((pid_t)atoi(argv[i]), &info) != 0) {
+                fprintf(stderr, "Error: No such container: %s\n", argv[i]);
+                return 1;
+            }
+            print_stats(&info, &page_size);
+        }
+    } else {
+        registry_foreach(print_stats, &page_size);
+    }
+    
+    ksm_host_t host;
+    if (ksm_host_usage(&host) == 0) {
+        printf("\nKSM %s: %llu pages shared by %llu more (%.1f MB saved), "
+               "%llu full scans, profit %.1f MB\n",
+               host.running ? "running" : "stopped",
+               (unsigned long long)host.pages_shared, (unsigned long long)host.pages_sharing,
+               host.pages_sharing * (page_size / 1048576.0),
+               (unsigned long long)host.full_scans, host.general_profit / 1048576.0);
+    }
+    return 0;
+}
+
+int cmd_image(int argc, char *argv[]) {
+    if (argc < 5 || strcmp(argv[2], "pack") != 0) {
+        fprintf(stderr, "Usage: minidocker image pack <rootfs_dir> <file> [--format erofs|squashfs]\n");
+        return 1;
+    }
+    
+    image_format_t format = IMAGE_EROFS;
+    for (int i = 5; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (parse_image_format(argv[++i], &format) != 0) {
+                fprintf(stderr, "Error: Unknown image format: %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Error: Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    
+    return image_pack(argv[3], argv[4], format) == 0 ? 0 : 1;
+}
+
+int cmd_inspect(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: minidocker inspect <container_id>\n");
+        return 1;
+    }
+    
+    pid_t pid = (pid_t)atoi(argv[2]);
+    if (pid <= 0) {
+        fprintf(stderr, "Error: Invalid PID: %s\n", argv[2]);
+        return 1;
+    }
+    
+    container_info_t info;
+    int ret;
+    mdc_client_t *client = mdc_connect(NULL);
+    if (client) {
+        ret = mdc_inspect(client, pid, &info);
+        mdc_close(client);
+    } else {
+        ret = registry_get_container(pid, &info) == 0 ? MD_OK : MD_ERR_NOT_FOUND;
+    }
+    if (ret != 0) {
+        fprintf(stderr, "Error: %s: %d\n", md_status_name(ret), (int)pid);
+        return 1;
+    }
+    
+    // Placement is kept outside the registry, in the CPU allocation map
+    char cpus[1024];
+    
+    printf("{\n");
+    printf("  \"pid\": %d,\n", (int)info.pid);
+    printf("  \"process_pid\": %d,\n", (int)info.process_pid);
+    printf("  \"name\": \"%s\",\n", info.name);
+    printf("  \"created_at\": %ld,\n", (long)info.created_at);
+    printf("  \"status\": \"%s\",\n", info.status);
+    printf("  \"restart\": \"%s\",\n", info.restart);
+    printf("  \"restarts\": %d,\n", info.restarts);
+    printf("  \"health\": \"%s\",\n", info.health);
+    printf("  \"image_path\": \"%s\",\n", info.image);
+    printf("  \"command\": \"%s\",\n", info.command);
+    printf("  \"network\": \"%s\",\n", info.network);
+    printf("  \"ip\": \"%s\",\n", info.ip);
+    printf("  \"ports\": \"%s\",\n", info.ports);
+    printf("  \"cpus\": \"%s\"\n", cpuset_lookup(info.pid, cpus, sizeof(cpus)) == 0 ? cpus : "");
+    printf("}\n");
+    return 0;
+}
+
+#define MAX_EVENT_FILTERS 16
+
+// Filters with the same key match any of their values; different keys
+// must all match
+typedef struct {
+    pid_t pids[MAX_EVENT_FILTERS];
+    int num_pids;
+    int types[MAX_EVENT_FILTERS];
+    int num_types;
+} event_filter_t;
+
+static int parse_event_filter(const char *spec, event_filter_t *filter) {
+    if (strncmp(spec, "container=", 10) == 0) {
+        pid_t pid = (pid_t)atoi(spec + 10);
+        if (pid <= 0 || filter->num_pids >= MAX_EVENT_FILTERS) {
+            return -1;
+        }
+        filter->pids[filter->num_pids++] = pid;
+        return 0;
+    }
+    if (strncmp(spec, "event=", 6) == 0) {
+        int type = parse_event_type(spec + 6);
+        if (type < 0 || filter->num_types >= MAX_EVENT_FILTERS) {
+            return -1;
+        }
+        filter->types[filter->num_types++] = type;
+        return 0;
+    }
+    return -1;
+}
+
+static int event_matches(const event_filter_t *filter, const event_t *event) {
+    int i, match;
+    
+    for (i = 0, match = filter->num_pids == 0; i < filter->num_pids && !match; i++) {
+        match = filter->pids[i] == event->pid;
+    }
+    if (!match) {
+        return 0;
+    }
+    for (i = 0, match = filter->num_types == 0; i < filter->num_types && !match; i++) {
+        match = filter->types[i] == event->type;
+    }
+    return match;
+}
+
+// A Unix timestamp, or a duration back from now ("10m")
+static int parse_event_since(const char *str, int64_t *since_ns) {
+    int duration_ms;
+    
+    if (*str && strspn(str, "0123456789") == strlen(str)) {
+        *since_ns = (int64_t)strtoll(str, NULL, 10) * 1000000000LL;
+        return 0;
+    }
+    if (parse_duration_ms(str, &duration_ms) != 0) {
+        return -1;
+    }
+    *since_ns = ((int64_t)time(NULL) * 1000 - duration_ms) * 1000000LL;
+    return 0;
+}
+
+static void print_event(const event_t *event) {
+    char when[32];
+    time_t secs = (time_t)(event->time_ns / 1000000000LL);
+    struct tm tm;
+    
+    localtime_r(&secs, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf("%s.%09ld container %s %d", when, (long)(event->time_ns % 1000000000LL),
+           event_type_name((event_type_t)event->type), (int)event->pid);
+    
+    switch (event->type) {
+    case EVENT_CREATE:
+        printf(" (command=%s)", event->detail);
+        break;
+    case EVENT_START:
+        printf(" (command=%s)", event->detail);
+        if (event->code > 0) {
+            printf(" (restarts=%d)", (int)event->code);
+        }
+        break;
+    case EVENT_EXIT:
+        if (event->code >= 0) {
+            printf(" (exitCode=%d)", (int)event->code);
+        }
+        break;
+    case EVENT_OOM:
+        printf(" (kills=%d)", (int)event->code);
+        break;
+    case EVENT_HEALTH:
+        printf(" (health=%s)", event->detail);
+        break;
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int cmd_events(int argc, char *argv[]) {
+    event_filter_t filter = {0};
+    int64_t since_ns = -1;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--since") == 0 && i + 1 < argc) {
+            if (parse_event_since(argv[++i], &since_ns) != 0) {
+                fprintf(stderr, "Error: Invalid --since value: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            if (parse_event_filter(argv[++i], &filter) != 0) {
+                fprintf(stderr, "Error: Invalid filter: %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Usage: minidocker events [--since <time>] [--filter key=value]...\n");
+            return 1;
+        }
+    }
+    
+    events_reader_t reader;
+    if (events_reader_open(&reader, since_ns) != 0) {
+        fprintf(stderr, "Error: Failed to open event stream: %s\n", strerror(errno));
+        return 1;
+    }
+    
+    // Follows the stream until interrupted
+    uint64_t lost = 0;
+    event_t event;
+    for (;;) {
+        int ret = events_read(&reader, &event);
+        if (reader.lost != lost) {
+            fprintf(stderr, "Warning: %lu events were overwritten before they were read\n",
+                    (unsigned long)(reader.lost - lost));
+            lost = reader.lost;
+        }
+        if (ret == 1) {
+            if (event_matches(&filter, &event)) {
+                print_event(&event);
+            }
+        } else if (ret < 0 || events_wait(&reader, -1) != 0) {
+            break;
+        }
+    }
+    
+    events_reader_close(&reader);
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
+    // Installed as a second name for the same binary
+    const char *name = strrchr(argv[0], '/');
+    name = name ? name + 1 : argv[0];
+    if (strcmp(name, "minidockerd") == 0) {
+        if (getuid() != 0) {
+            fprintf(stderr, "Error: minidockerd must be run as root\n");
+            return 1;
+        }
+        return daemon_main(argc, argv);
+    }
+    
     if (argc < 2) {
         print_usage(argv[0]);
         return 1;
     }
 
+    const char *command = argv[1];
+
+    // Reading events needs no privileges
+    if (strcmp(command, "events") == 0) {
+        return cmd_events(argc, argv);
+    }
+
     if (getuid() != 0) {
         fprintf(stderr, "Error: minidocker must be run as root\n");
         return 1;
     }
 
-    const char *command = argv[1];
-
     if (strcmp(command, "run") == 0) {
         return cmd_run(argc, argv);
     } else if (strcmp(command, "stop") == 0) {
         return cmd_stop(argc, argv);
+    } else if (strcmp(command, "daemon") == 0) {
+        return daemon_main(argc - 1, &argv[1]);
+    } else if (strcmp(command, "inspect") == 0) {
+        return cmd_inspect(argc, argv);
+    } else if (strcmp(command, "exec") == 0) {
+        return cmd_exec(argc, argv);
     } else if (strcmp(command, "ps") == 0) {
         return cmd_ps();
+    } else if (strcmp(command, "gc") == 0) {
+        return cmd_gc();
+    } else if (strcmp(command, "commit") == 0) {
+        return cmd_commit(argc, argv);
+    } else if (strcmp(command, "image") == 0) {
+        return cmd_image(argc, argv);
+    } else if (strcmp(command, "stats") == 0) {
+        return cmd_stats(argc, argv);
     } else if (strcmp(command, "help") == 0) {
         print_usage(argv[0]);
         return 0;
@@ -0,0 +1,398 @@
+#include "metrics.h"
+#include "supervisor.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+
+#define METRIC_BUCKETS 14      // 13 bounds plus +Inf
+
+// Histogram bucket bounds, in nanoseconds and as rendered
+static const uint64_t bucket_ns[METRIC_BUCKETS - 1] = {
+    1000000ULL, 2500000ULL, 5000000ULL, 10000000ULL, 25000000ULL, 50000000ULL,
+    100000000ULL, 250000000ULL, 500000000ULL, 1000000000ULL, 2500000000ULL,
+    5000000000ULL, 10000000000ULL
+};
+static const char *const bucket_le[METRIC_BUCKETS] = {
+    "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1",
+    "0.25", "0.5", "1", "2.5", "5", "10", "+Inf"
+};
+
+static const char *const phase_names[METRIC_PHASE_COUNT] = {
+    "setup", "clone", "network", "registry", "total",
+    "wait", "cleanup", "total"
+};
+
+typedef struct metrics_shard {
+    _Atomic uint64_t counters[METRIC_COUNTER_COUNT];
+    _Atomic uint64_t buckets[METRIC_PHASE_COUNT][METRIC_BUCKETS]; // Not cumulative
+    _Atomic uint64_t sum_ns[METRIC_PHASE_COUNT];
+    atomic_int in_use;         // Owned by a live thread
+    struct metrics_shard *next;
+} metrics_shard_t;
+
+static _Atomic(metrics_shard_t *) shards = NULL;
+static _Thread_local metrics_shard_t *local_shard = NULL;
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+
+// Per-container values gathered before rendering, since each metric
+// family has to be written out in one piece
+typedef struct {
+    pid_t pid;
+    uint64_t cpu_usec;
+    uint64_t memory_bytes;
+    uint64_t io_read_bytes;
+    uint64_t io_write_bytes;
+} container_sample_t;
+
+// Reused across scrapes; only grows
+static container_sample_t *samples = NULL;
+static size_t samples_cap = 0;
+static size_t samples_len = 0;
+
+static void release_shard(void *shard) {
+    atomic_store_explicit(&((metrics_shard_t *)shard)->in_use, 0, memory_order_release);
+}
+
+static void create_shard_key(void) {
+    pthread_key_create(&shard_key, release_shard);
+}
+
+// Shards are never freed: a thread that exits hands its shard, counts
+// included, to the next thread that needs one
+static metrics_shard_t *get_shard(void) {
+    if (local_shard) {
+        return local_shard;
+    }
+    
+    metrics_shard_t *shard;
+    for (shard = atomic_load_explicit(&shards, memory_order_acquire); shard; shard = shard->next) {
+        int idle = 0;
+        if (atomic_compare_exchange_strong(&shard->in_use, &idle, 1)) {
+            break;
+        }
+    }
+    
+    if (!shard) {
+        shard = calloc(1, sizeof(*shard));
+        if (!shard) {
+            return NULL;
+        }
+        atomic_init(&shard->in_use, 1);
+        shard->next = atomic_load_explicit(&shards, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&shards, &shard->next, shard,
+                                                      memory_order_release,
+                                                      memory_order_relaxed)) {
+        }
+    }
+    
+    pthread_once(&shard_key_once, create_shard_key);
+    pthread_setspecific(shard_key, shard);
+    local_shard = shard;
+    return shard;
+}
+
+// Only the owning thread writes to a shard, so this needs no locked
+// read-modify-write; the atomics just keep scrapes from tearing values
+static inline void shard_add(_Atomic uint64_t *slot, uint64_t value) {
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
+
+void metrics_add(metric_counter_t counter, uint64_t value) {
+    metrics_shard_t *shard = get_shard();
+    
+    if (shard && counter < METRIC_COUNTER_COUNT) {
+        shard_add(&shard->counters[counter], value);
+    }
+}
+
+void metrics_inc(metric_counter_t counter) {
+    metrics_add(counter, 1);
+}
+
+void metrics_observe(metric_phase_t phase, uint64_t duration_ns) {
+    metrics_shard_t *shard = get_shard();
+    int bucket = 0;
+    
+    if (!shard || phase >= METRIC_PHASE_COUNT) {
+        return;
+    }
+    while (bucket < METRIC_BUCKETS - 1 && duration_ns > bucket_ns[bucket]) {
+        bucket++;
+    }
+    shard_add(&shard->buckets[phase][bucket], 1);
+    shard_add(&shard->sum_ns[phase], duration_ns);
+}
+
+uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Formatting helpers; snprintf is a measurable share of a large scrape
+
+static void put(md_buffer_t *buf, const char *str) {
+    md_buffer_append(buf, str, strlen(str));
+}
+
+static void put_u64(md_buffer_t *buf, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    
+    do {
+        digits[sizeof(digits) - 1 - n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    md_buffer_append(buf, digits + sizeof(digits) - n, (size_t)n);
+}
+
+// value / 10^decimals, e.g. microseconds as seconds
+static void put_fixed(md_buffer_t *buf, uint64_t value, int decimals) {
+    uint64_t scale = 1;
+    char frac[20];
+    int i;
+    
+    for (i = 0; i < decimals; i++) {
+        scale *= 10;
+    }
+    put_u64(buf, value / scale);
+    
+    value %= scale;
+    for (i = decimals - 1; i >= 0; i--) {
+        frac[i] = (char)('0' + value % 10);
+        value /= 10;
+    }
+    frac[decimals] = '\0';
+    md_buffer_append(buf, ".", 1);
+    md_buffer_append(buf, frac, (size_t)decimals);
+}
+
+// OpenMetrics names a counter family without its _total suffix
+static void put_family(md_buffer_t *buf, const char *name, const char *type,
+                       const char *help, int openmetrics) {
+    const char *suffix = !openmetrics && strcmp(type, "counter") == 0 ? "_total" : "";
+    
+    put(buf, "# HELP ");
+    put(buf, name);
+    put(buf, suffix);
+    put(buf, " ");
+    put(buf, help);
+    put(buf, "\n# TYPE ");
+    put(buf, name);
+    put(buf, suffix);
+    put(buf, " ");
+    put(buf, type);
+    put(buf, "\n");
+}
+
+static void put_counter(md_buffer_t *buf, const char *name, const char *help,
+                        uint64_t value, int openmetrics) {
+    put_family(buf, name, "counter", help, openmetrics);
+    put(buf, name);
+    put(buf, "_total ");
+    put_u64(buf, value);
+    put(buf, "\n");
+}
+
+static void put_histogram(md_buffer_t *buf, const char *name, const char *help,
+                          metric_phase_t first, metric_phase_t last,
+                          uint64_t buckets[][METRIC_BUCKETS], const uint64_t *sum_ns,
+                          int openmetrics) {
+    put_family(buf, name, "histogram", help, openmetrics);
+    
+    for (int phase = (int)first; phase <= (int)last; phase++) {
+        uint64_t cumulative = 0;
+    
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += buckets[phase][b];
+            put(buf, name);
+            put(buf, "_bucket{phase=\"");
+            put(buf, phase_names[phase]);
+            put(buf, "\",le=\"");
+            put(buf, bucket_le[b]);
+            put(buf, "\"} ");
+            put_u64(buf, cumulative);
+            put(buf, "\n");
+        }
+        put(buf, name);
+        put(buf, "_sum{phase=\"");
+        put(buf, phase_names[phase]);
+        put(buf, "\"} ");
+        put_fixed(buf, sum_ns[phase], 9);
+        put(buf, "\n");
+        put(buf, name);
+        put(buf, "_count{phase=\"");
+        put(buf, phase_names[phase]);
+        put(buf, "\"} ");
+        put_u64(buf, cumulative);
+        put(buf, "\n");
+    }
+}
+
+// Opened on first use and kept, so a scrape costs one pread per file
+static int stat_fd(supervised_t *sc, int *fd, const char *name) {
+    if (*fd == -1) {
+        *fd = sc->cgroup_fd != -1 ? openat(sc->cgroup_fd, name, O_RDONLY | O_CLOEXEC) : -1;
+        if (*fd == -1) {
+            *fd = -2; // Don't retry every scrape
+        }
+    }
+    return *fd;
+}
+
+static ssize_t read_stat(int fd, char *buf, size_t len) {
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = pread(fd, buf, len - 1, 0);
+    buf[n > 0 ? n : 0] = '\0';
+    return n;
+}
+
+// Sum of every "<key><number>" in a flat-keyed or nested-keyed cgroup file
+static uint64_t sum_key(const char *text, const char *key) {
+    size_t key_len = strlen(key);
+    uint64_t total = 0;
+    
+    for (const char *p = strstr(text, key); p; p = strstr(p + key_len, key)) {
+        if (p == text || p[-1] == ' ' || p[-1] == '\n') {
+            total += strtoull(p + key_len, NULL, 10);
+        }
+    }
+    return total;
+}
+
+static void sample_container(supervised_t *sc, void *arg) {
+    (void)arg;
+    char text[4096];
+    
+    if (samples_len == samples_cap) {
+        size_t cap = samples_cap ? samples_cap * 2 : 256;
+        container_sample_t *grown = realloc(samples, cap * sizeof(*samples));
+        if (!grown) {
+            return;
+        }
+        samples = grown;
+        samples_cap = cap;
+    }
+    
+    container_sample_t *sample = &samples[samples_len++];
+    memset(sample, 0, sizeof(*sample));
+    sample->pid = sc->pid;
+    
+    if (read_stat(stat_fd(sc, &sc->cpu_stat_fd, "cpu.stat"), text, sizeof(text)) > 0) {
+        sample->cpu_usec = sum_key(text, "usage_usec ");
+    }
+    if (read_stat(stat_fd(sc, &sc->memory_fd, "memory.current"), text, sizeof(text)) > 0) {
+        sample->memory_bytes = strtoull(text, NULL, 10);
+    }
+    if (read_stat(stat_fd(sc, &sc->io_stat_fd, "io.stat"), text, sizeof(text)) > 0) {
+        sample->io_read_bytes = sum_key(text, "rbytes=");
+        sample->io_write_bytes = sum_key(text, "wbytes=");
+    }
+}
+
+static void put_container_series(md_buffer_t *buf, const char *name, const char *type,
+                                 const char *help, size_t field, int usec,
+                                 int openmetrics) {
+    put_family(buf, name, type, help, openmetrics);
+    
+    for (size_t i = 0; i < samples_len; i++) {
+        uint64_t value = *(const uint64_t *)((const char *)&samples[i] + field);
+    
+        put(buf, name);
+        put(buf, strcmp(type, "counter") == 0 ? "_total{id=\"" : "{id=\"");
+        put_u64(buf, (uint64_t)samples[i].pid);
+        put(buf, "\"} ");
+        if (usec) {
+            put_fixed(buf, value, 6);
+        } else {
+            put_u64(buf, value);
+        }
+        put(buf, "\n");
+    }
+}
+    
+int metrics_render(md_buffer_t *buf, int openmetrics) {
+    uint64_t counters[METRIC_COUNTER_COUNT] = {0};
+    uint64_t buckets[METRIC_PHASE_COUNT][METRIC_BUCKETS] = {{0}};
+    uint64_t sum_ns[METRIC_PHASE_COUNT] = {0};
+    
+    for (metrics_shard_t *shard = atomic_load_explicit(&shards, memory_order_acquire);
+         shard; shard = shard->next) {
+        for (int c = 0; c < METRIC_COUNTER_COUNT; c++) {
+            counters[c] += atomic_load_explicit(&shard->counters[c], memory_order_relaxed);
+        }
+        for (int p = 0; p < METRIC_PHASE_COUNT; p++) {
+            for (int b = 0; b < METRIC_BUCKETS; b++) {
+                buckets[p][b] += atomic_load_explicit(&shard->buckets[p][b], memory_order_relaxed);
+            }
+            sum_ns[p] += atomic_load_explicit(&shard->sum_ns[p], memory_order_relaxed);
+        }
+    }
+    
+    supervisor_stats_t stats;
+    supervisor_get_stats(&stats);
+    
+    buf->len = 0;
+    put_counter(buf, "minidocker_containers_created", "Containers created.",
+                counters[METRIC_CONTAINERS_CREATED], openmetrics);
+    put_counter(buf, "minidocker_container_create_failures", "Container creations that failed.",
+                counters[METRIC_CREATE_FAILURES], openmetrics);
+    put_counter(buf, "minidocker_containers_stopped", "Containers stopped on request.",
+                counters[METRIC_CONTAINERS_STOPPED], openmetrics);
+    put_counter(buf, "minidocker_containers_exited", "Containers that exited on their own.",
+                counters[METRIC_CONTAINERS_EXITED], openmetrics);
+    put_counter(buf, "minidocker_container_oom_kills", "Processes killed by a container memory limit.",
+                counters[METRIC_OOM_KILLS], openmetrics);
+    put_counter(buf, "minidocker_container_restarts", "Containers restarted by their restart policy.",
+                counters[METRIC_CONTAINER_RESTARTS], openmetrics);
+    put_counter(buf, "minidocker_health_checks", "Health checks run.",
+                stats.checks_run, openmetrics);
+    put_counter(buf, "minidocker_health_check_failures", "Health checks that failed.",
+                stats.checks_failed, openmetrics);
+    
+    put_family(buf, "minidocker_containers_running", "gauge", "Containers being supervised.",
+               openmetrics);
+    put(buf, "minidocker_containers_running ");
+    put_u64(buf, supervisor_count());
+    put(buf, "\n");
+    
+    put_family(buf, "minidocker_supervisor_cpu_seconds", "counter",
+               "CPU time spent dispatching supervisor events.", openmetrics);
+    put(buf, "minidocker_supervisor_cpu_seconds_total ");
+    put_fixed(buf, stats.sched_cpu_ns, 9);
+    put(buf, "\n");
+    
+    put_histogram(buf, "minidocker_create_phase_seconds", "Time spent in each container creation phase.",
+                  PHASE_CREATE_SETUP, PHASE_CREATE_TOTAL, buckets, sum_ns, openmetrics);
+    put_histogram(buf, "minidocker_stop_phase_seconds", "Time spent in each container stop phase.",
+                  PHASE_STOP_WAIT, PHASE_STOP_TOTAL, buckets, sum_ns, openmetrics);
+    
+    samples_len = 0;
+    supervisor_foreach(sample_container, NULL);
+    
+    put_container_series(buf, "minidocker_container_cpu_seconds", "counter",
+                         "CPU time used by the container's cgroup.",
+                         offsetof(container_sample_t, cpu_usec), 1, openmetrics);
+    put_container_series(buf, "minidocker_container_memory_bytes", "gauge",
+                         "Memory charged to the container's cgroup.",
+                         offsetof(container_sample_t, memory_bytes), 0, openmetrics);
+    put_container_series(buf, "minidocker_container_io_read_bytes", "counter",
+                         "Bytes read from block devices by the container.",
+                         offsetof(container_sample_t, io_read_bytes), 0, openmetrics);
+    put_container_series(buf, "minidocker_container_io_write_bytes", "counter",
+                         "Bytes written to block devices by the container.",
+                         offsetof(container_sample_t, io_write_bytes), 0, openmetrics);
+    
+    if (openmetrics) {
+        put(buf, "# EOF\n");
+    }
+    return buf->data ? 0 : -1;
+}
+    
\ No newline at end of file
@@ -7,15 +7,280 @@
 #include <sys/socket.h>
 #include <linux/if.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 
-#define BRIDGE_NAME "minidocker0"
-#define CONTAINER_NETNS_PATH "/var/run/netns"
-static int ip_counter = 2; // Start from 172.17.0.2
+#define NAT_TABLE "minidocker"
+#define IP_MAP "/var/lib/minidocker/ip.map"
+
+// One nftables table holds masquerading and every published port. Ports live
+// in verdict maps keyed by host port, so publishing is a single element insert
+// and the per-packet lookup is a hash lookup no matter how many are published.
+static const char *nat_ruleset =
+    "table ip " NAT_TABLE " {\n"
+    "    map tcp_ports { type inet_service : ipv4_addr . inet_service; }\n"
+    "    map udp_ports { type inet_service : ipv4_addr . inet_service; }\n"
+    "    chain prerouting {\n"
+    "        type nat hook prerouting priority dstnat; policy accept;\n"
+    "        fib daddr type local dnat ip to tcp dport map @tcp_ports\n"
+    "        fib daddr type local dnat ip to udp dport map @udp_ports\n"
+    "    }\n"
+    "    chain output {\n"
+    "        type nat hook output priority -100; policy accept;\n"
+    "        fib daddr type local dnat ip to tcp dport map @tcp_ports\n"
+    "        fib daddr type local dnat ip to udp dport map @udp_ports\n"
+    "    }\n"
+    "    chain postrouting {\n"
+    "        type nat hook postrouting priority srcnat; policy accept;\n"
+    "        ip saddr 172.17.0.0/16 oifname != \"" BRIDGE_NAME "\" masquerade\n"
+    "    }\n"
+    "}\n";
+
+static int setup_nat_table(void) {
+    if (system("nft list table ip " NAT_TABLE " >/dev/null 2>&1") == 0) {
+        return 0;
+    }
+    
+    log_message(LOG_DEBUG, "Loading nftables table: %s", NAT_TABLE);
+    
+    FILE *nft = popen("nft -f -", "w");
+    if (!nft) {
+        log_message(LOG_ERROR, "Failed to run nft");
+        return -1;
+    }
+    fputs(nat_ruleset, nft);
+    if (pclose(nft) != 0) {
+        log_message(LOG_ERROR, "Failed to load nftables table %s", NAT_TABLE);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// The host part of a bridge address: 2..65534 skips 172.17.0.0 (network),
+// .0.1 (bridge) and .255.255 (broadcast)
+#define IP_HOST_FIRST 2
+#define IP_HOST_LAST 65534
+
+static void format_ip(int host, char *buf, size_t len) {
+    snprintf(buf, len, "172.17.%d.%d", host >> 8, host & 0xff);
+}
+
+// An address stays taken while its container's network namespace exists;
+// a restart relinks it and cleanup removes it
+static int holds_address(pid_t id) {
+    char path[PATH_MAX];
+    struct stat st;
+    
+    snprintf(path, sizeof(path), "%s/%d", CONTAINER_NETNS_PATH, (int)id);
+    return stat(path, &st) == 0;
+}
+
+// Opens and locks the map and returns its lines minus those of release_id
+// and of containers that are gone, marking the addresses still in use.
+// The caller writes the lines back with save_ip_map().
+static int load_ip_map(pid_t release_id, unsigned char *used, char **lines_out) {
+    if (mkdir("/var/lib/minidocker", 0755) == -1 && errno != EEXIST) {
+        return -1;
+    }
+    int fd = open(IP_MAP, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 || flock(fd, LOCK_EX) == -1) {
+        log_message(LOG_ERROR, "Failed to lock %s: %s", IP_MAP, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    
+    struct stat st;
+    char *text = NULL, *lines = NULL;
+    if (fstat(fd, &st) == -1 || !(text = calloc(1, (size_t)st.st_size + 1)) ||
+        !(lines = calloc(1, (size_t)st.st_size + 1)) ||
+        pread(fd, text, (size_t)st.st_size, 0) != st.st_size) {
+        free(text);
+        free(lines);
+        close(fd);
+        return -1;
+    }
+    
+    char *save;
+    size_t kept = 0;
+    for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        int id, a, b;
+        if (sscanf(line, "%d 172.17.%d.%d", &id, &a, &b) != 3 ||
+            a < 0 || a > 255 || b < 0 || b > 255) {
+            continue;
+        }
+        // Only addresses allocate_container_ip() could have handed out
+        int host = a << 8 | b;
+        if (host < IP_HOST_FIRST || host > IP_HOST_LAST) {
+            continue;
+        }
+        if ((pid_t)id == release_id || !holds_address((pid_t)id)) {
+            continue;
+        }
+        if (used) {
+            used[host] = 1;
+        }
+        size_t len = strlen(line);
+        memcpy(lines + kept, line, len);
+        lines[kept + len] = '\n';
+        kept += len + 1;
+    }
+    
+    free(text);
+    *lines_out = lines;
+    return fd;
+}
+
+static int save_ip_map(int fd, const char *lines) {
+    size_t len = strlen(lines);
+    int ret = 0;
+    
+    if (ftruncate(fd, 0) == -1 || pwrite(fd, lines, len, 0) != (ssize_t)len) {
+        log_message(LOG_ERROR, "Failed to write %s: %s", IP_MAP, strerror(errno));
+        ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
+int allocate_container_ip(pid_t id, char *buf, size_t len) {
+    if (id <= 0 || !buf || len < 16) {
+        return -1;
+    }
+    
+    unsigned char *used = calloc(IP_HOST_LAST + 1, 1);
+    char *lines;
+    int fd = used ? load_ip_map(id, used, &lines) : -1;
+    if (fd == -1) {
+        free(used);
+        return -1;
+    }
+    
+    // Start where the ID points so addresses rarely move between runs,
+    // then take the next free one
+    int span = IP_HOST_LAST - IP_HOST_FIRST + 1;
+    int start = (int)(id % span);
+    int host = 0;
+    for (int i = 0; i < span; i++) {
+        int candidate = IP_HOST_FIRST + (start + i) % span;
+        if (!used[candidate]) {
+            host = candidate;
+            break;
+        }
+    }
+    free(used);
+    
+    int ret = -1;
+    char *grown;
+    if (!host) {
+        log_message(LOG_ERROR, "No free address left on %s", BRIDGE_NAME);
+    } else if ((grown = realloc(lines, strlen(lines) + 40))) {
+        lines = grown;
+        format_ip(host, buf, len);
+        sprintf(lines + strlen(lines), "%d %s\n", (int)id, buf);
+        ret = 0;
+    }
+    
+    if (save_ip_map(fd, lines) != 0) {
+        ret = -1;
+    }
+    free(lines);
+    return ret;
+}
+
+int release_container_ip(pid_t id) {
+    char *lines;
+    int fd = load_ip_map(id, NULL, &lines);
+    if (fd == -1) {
+        return -1;
+    }
+    
+    int ret = save_ip_map(fd, lines);
+    free(lines);
+    return ret;
+}
+
+int parse_port_mapping(const char *spec, port_mapping_t *mapping) {
+    if (!spec || !mapping) {
+        return -1;
+    }
+    
+    unsigned int host_port, container_port;
+    char protocol[8] = "tcp";
+    int consumed = 0;
+    
+    if (sscanf(spec, "%u:%u%n", &host_port, &container_port, &consumed) != 2) {
+        return -1;
+    }
+    if (spec[consumed] == '/') {
+        if (sscanf(spec + consumed, "/%7s", protocol) != 1) {
+            return -1;
+        }
+    } else if (spec[consumed] != '\0') {
+        return -1;
+    }
+    
+    if (host_port == 0 || host_port > 65535 ||
+        container_port == 0 || container_port > 65535) {
+        return -1;
+    }
+    if (strcmp(protocol, "tcp") != 0 && strcmp(protocol, "udp") != 0) {
+        return -1;
+    }
+    
+    mapping->host_port = (unsigned short)host_port;
+    mapping->container_port = (unsigned short)container_port;
+    snprintf(mapping->protocol, sizeof(mapping->protocol), "%s", protocol);
+    
+    return 0;
+}
+
+int publish_port(const char *ip, const port_mapping_t *mapping) {
+    char cmd[256];
+    
+    if (!mapping || !ip || !ip[0]) {
+        log_message(LOG_ERROR, "Invalid port mapping");
+        return -1;
+    }
+    
+    log_message(LOG_DEBUG, "Publishing port %u/%s -> %s:%u",
+                mapping->host_port, mapping->protocol, ip, mapping->container_port);
+    
+    // 'create' rather than 'add' so a port that is already taken is an error
+    snprintf(cmd, sizeof(cmd),
+             "nft create element ip %s %s_ports '{ %u : %s . %u }'",
+             NAT_TABLE, mapping->protocol, mapping->host_port, ip,
+             mapping->container_port);
+    if (system(cmd) != 0) {
+        log_message(LOG_ERROR, "Failed to publish port %u/%s (already in use?)",
+                    mapping->host_port, mapping->protocol);
+        return -1;
+    }
+    
+    return 0;
+}
+
+int unpublish_port(const port_mapping_t *mapping) {
+    char cmd[256];
+    
+    if (!mapping) {
+        return -1;
+    }
+    
+    snprintf(cmd, sizeof(cmd),
+             "nft delete element ip %s %s_ports '{ %u }' 2>/dev/null",
+             NAT_TABLE, mapping->protocol, mapping->host_port);
+    system(cmd); // Ignore errors as it might already be deleted
+    
+    return 0;
+}
 
 int setup_network_namespace(pid_t pid) {
     char netns_path[PATH_MAX];
-    char pid_str[16];
+    char pid_str[32];
     
     log_message(LOG_DEBUG, "Setting up network namespace for PID %d", pid);
     
@@ -34,6 +299,27 @@ int setup_network_namespace(pid_t pid) {
     return 0;
 }
 
+// Points /var/run/netns/<id> at a restarted container's new process
+int relink_network_namespace(pid_t id, pid_t pid) {
+    char netns_path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    char target[32];
+    
+    snprintf(netns_path, sizeof(netns_path), "%s/%d", CONTAINER_NETNS_PATH, id);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%d.tmp", CONTAINER_NETNS_PATH, id);
+    snprintf(target, sizeof(target), "/proc/%d/ns/net", pid);
+    
+    // Swap the link in one step so "ip netns exec" never finds it missing
+    unlink(tmp_path);
+    if (symlink(target, tmp_path) == -1 || rename(tmp_path, netns_path) == -1) {
+        log_message(LOG_ERROR, "Failed to relink netns for container %d", id);
+        unlink(tmp_path);
+        return -1;
+    }
+    
+    return 0;
+}
+
 int create_veth_pair(const char *veth_host, const char *veth_container) {
     char cmd[256];
     
@@ -55,6 +341,26 @@ int create_veth_pair(const char *veth_host, const char *veth_container) {
     return 0;
 }
 
+// Deletes many links with one "ip -batch" process instead of one "ip" per
+// link; names that no longer exist are skipped
+int delete_links(char *const names[], size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    
+    FILE *ip = popen("ip -force -batch - >/dev/null 2>&1", "w");
+    if (!ip) {
+        log_message(LOG_ERROR, "Failed to run ip");
+        return -1;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        fprintf(ip, "link delete %s\n", names[i]);
+    }
+    
+    return pclose(ip) == 0 ? 0 : -1;
+}
+
 int setup_bridge() {
     char cmd[256];
     
@@ -89,20 +395,18 @@ int setup_bridge() {
         if (system("echo 1 > /proc/sys/net/ipv4/ip_forward") != 0) {
             log_message(LOG_WARN, "Failed to enable IP forwarding");
         }
-        
-        // Setup NAT
-        snprintf(cmd, sizeof(cmd), 
-                 "iptables -t nat -A POSTROUTING -s 172.17.0.0/16 ! -o %s -j MASQUERADE",
-                 BRIDGE_NAME);
-        if (system(cmd) != 0) {
-            log_message(LOG_WARN, "Failed to setup NAT");
-        }
+    }
+    
+    // Setup NAT (only loaded once, survives bridge recreation)
+    if (setup_nat_table() != 0) {
+        log_message(LOG_WARN, "Failed to setup NAT");
     }
     
     return 0;
 }
 
-int configure_container_network(pid_t pid, const char *veth_host, const char *veth_container) {
+int configure_container_network(pid_t pid, const char *veth_host, const char *veth_container,
+                                const char *ip) {
     char cmd[256];
     
     log_message(LOG_DEBUG, "Configuring container network for PID %d", pid);
@@ -132,8 +436,8 @@ int configure_container_network(pid_t pid, const char *veth_host, const char *ve
     
     // Configure container network
     snprintf(cmd, sizeof(cmd), 
-             "ip netns exec %d ip addr add 172.17.0.%d/16 dev %s",
-             pid, ip_counter++, veth_container);
+             "ip netns exec %d ip addr add %s/16 dev %s",
+             pid, ip, veth_container);
     if (system(cmd) != 0) {
         log_message(LOG_ERROR, "Failed to set container IP");
         return -1;
@@ -148,10 +452,7 @@ int configure_container_network(pid_t pid, const char *veth_host, const char *ve
     }
     
     // Set container loopback up
-    snprintf(cmd, sizeof(cmd), 
-             "ip netns exec %d ip link set lo up", pid);
-    if (system(cmd) != 0) {
-        log_message(LOG_ERROR, "Failed to enable container loopback");
+    if (configure_container_loopback(pid) != 0) {
         return -1;
     }
     
@@ -166,20 +467,154 @@ int configure_container_network(pid_t pid, const char *veth_host, const char *ve
     return 0;
 }
 
+int parse_network_mode(const char *spec, network_mode_t *mode, char *parent, size_t parent_len) {
+    if (!spec || !mode || !parent || parent_len == 0) {
+        return -1;
+    }
+    
+    parent[0] = '\0';
+    
+    if (strcmp(spec, "bridge") == 0) {
+        *mode = NETWORK_BRIDGE;
+        return 0;
+    } else if (strcmp(spec, "host") == 0) {
+        *mode = NETWORK_HOST;
+        return 0;
+    } else if (strcmp(spec, "none") == 0) {
+        *mode = NETWORK_NONE;
+        return 0;
+    }
+    
+    // macvlan:<parent> or ipvlan:<parent>
+    const char *sep = strchr(spec, ':');
+    if (!sep || sep[1] == '\0') {
+        return -1;
+    }
+    if (strncmp(spec, "macvlan", sep - spec) == 0 && sep - spec == 7) {
+        *mode = NETWORK_MACVLAN;
+    } else if (strncmp(spec, "ipvlan", sep - spec) == 0 && sep - spec == 6) {
+        *mode = NETWORK_IPVLAN;
+    } else {
+        return -1;
+    }
+    
+    // Parent goes on an ip(8) command line, so only accept interface names
+    const char *name = sep + 1;
+    if (strlen(name) >= parent_len || strlen(name) >= IFNAMSIZ ||
+        strspn(name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-") != strlen(name)) {
+        return -1;
+    }
+    snprintf(parent, parent_len, "%s", name);
+    
+    return 0;
+}
+
+const char *network_mode_name(network_mode_t mode) {
+    switch (mode) {
+    case NETWORK_BRIDGE:  return "bridge";
+    case NETWORK_HOST:    return "host";
+    case NETWORK_NONE:    return "none";
+    case NETWORK_MACVLAN: return "macvlan";
+    case NETWORK_IPVLAN:  return "ipvlan";
+    }
+    return "unknown";
+}
+
+int configure_container_loopback(pid_t pid) {
+    char cmd[256];
+    
+    snprintf(cmd, sizeof(cmd), 
+             "ip netns exec %d ip link set lo up", pid);
+    if (system(cmd) != 0) {
+        log_message(LOG_ERROR, "Failed to enable container loopback");
+        return -1;
+    }
+    
+    return 0;
+}
+
+int attach_container_to_parent(pid_t pid, network_mode_t mode, const char *parent,
+                               const char *ip_cidr) {
+    char cmd[256];
+    char ifname[IFNAMSIZ];
+    
+    if (!parent || (mode != NETWORK_MACVLAN && mode != NETWORK_IPVLAN)) {
+        log_message(LOG_ERROR, "Invalid parent interface attachment");
+        return -1;
+    }
+    
+    log_message(LOG_DEBUG, "Attaching PID %d to %s via %s",
+                pid, parent, network_mode_name(mode));
+    
+    // Create the child interface directly on the parent NIC; no bridge or NAT
+    snprintf(ifname, sizeof(ifname), "%s%d", mode == NETWORK_MACVLAN ? "mv" : "iv", pid);
+    if (mode == NETWORK_MACVLAN) {
+        snprintf(cmd, sizeof(cmd),
+                 "ip link add %s link %s type macvlan mode bridge", ifname, parent);
+    } else {
+        snprintf(cmd, sizeof(cmd),
+                 "ip link add %s link %s type ipvlan mode l2", ifname, parent);
+    }
+    if (system(cmd) != 0) {
+        log_message(LOG_ERROR, "Failed to create %s interface on %s",
+                    network_mode_name(mode), parent);
+        return -1;
+    }
+    
+    // Move it into the container and name it eth0 there
+    snprintf(cmd, sizeof(cmd), "ip link set %s netns %d", ifname, pid);
+    if (system(cmd) != 0) {
+        log_message(LOG_ERROR, "Failed to move %s to container namespace", ifname);
+        snprintf(cmd, sizeof(cmd), "ip link delete %s 2>/dev/null", ifname);
+        system(cmd);
+        return -1;
+    }
+    
+    snprintf(cmd, sizeof(cmd),
+             "ip netns exec %d ip link set %s name eth0", pid, ifname);
+    if (system(cmd) != 0) {
+        log_message(LOG_ERROR, "Failed to rename container interface");
+        return -1;
+    }
+    
+    if (ip_cidr) {
+        snprintf(cmd, sizeof(cmd),
+                 "ip netns exec %d ip addr add %s dev eth0", pid, ip_cidr);
+        if (system(cmd) != 0) {
+            log_message(LOG_ERROR, "Failed to set container IP");
+            return -1;
+        }
+    } else {
+        log_message(LOG_WARN, "No --ip given, eth0 is up without an address");
+    }
+    
+    snprintf(cmd, sizeof(cmd),
+             "ip netns exec %d ip link set eth0 up", pid);
+    if (system(cmd) != 0) {
+        log_message(LOG_ERROR, "Failed to enable container interface");
+        return -1;
+    }
+    
+    return configure_container_loopback(pid);
+}
+
 int cleanup_container_network(pid_t pid) {
     char netns_path[PATH_MAX];
     char cmd[256];
     
     log_message(LOG_DEBUG, "Cleaning up network for PID %d", pid);
     
-    // Remove veth pair (will be auto-removed when namespace is deleted)
+    // Removing the host end removes the pair
     snprintf(cmd, sizeof(cmd), 
-             "ip link delete veth%d 2>/dev/null", pid);
+             "ip link delete veth%dh 2>/dev/null", pid);
     system(cmd); // Ignore errors as it might already be deleted
     
     // Remove netns symlink
     snprintf(netns_path, sizeof(netns_path), "%s/%d", CONTAINER_NETNS_PATH, pid);
     unlink(netns_path); // Ignore errors
     
+    // The address is free again once the namespace link is gone
+    release_container_ip(pid);
+    
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "protocol.h"
+#include "utils.h"
+
+int md_buffer_append(md_buffer_t *buf, const void *data, size_t len) {
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + len) {
+            cap *= 2;
+        }
+        char *grown = realloc(buf->data, cap);
+        if (!grown) {
+            return -1;
+        }
+        buf->data = grown;
+        buf->cap = cap;
+    }
+    
+    if (len > 0) {
+        memcpy(buf->data + buf->len, data, len);
+        buf->len += len;
+    }
+    return 0;
+}
+
+void md_buffer_consume(md_buffer_t *buf, size_t len) {
+    if (len >= buf->len) {
+        buf->len = 0;
+        return;
+    }
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+void md_buffer_free(md_buffer_t *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+// Appends a header with a zero length; md_frame_end() fills it in
+size_t md_frame_begin(md_buffer_t *buf, uint32_t seq, uint16_t op, uint16_t status) {
+    md_header_t header = { 0, seq, op, status };
+    size_t start = buf->len;
+    
+    md_buffer_append(buf, &header, sizeof(header));
+    return start;
+}
+
+void md_frame_end(md_buffer_t *buf, size_t frame_start) {
+    uint32_t length = (uint32_t)(buf->len - frame_start - sizeof(md_header_t));
+    memcpy(buf->data + frame_start, &length, sizeof(length));
+}
+
+// 1 if a whole frame is buffered, 0 if more bytes are needed, -1 if invalid
+int md_frame_complete(const md_buffer_t *buf, md_header_t *header) {
+    if (buf->len < sizeof(md_header_t)) {
+        return 0;
+    }
+    
+    memcpy(header, buf->data, sizeof(*header));
+    if (header->length > MD_MAX_FRAME) {
+        return -1;
+    }
+    return buf->len >= sizeof(md_header_t) + header->length ? 1 : 0;
+}
+
+// Strings are never cut short, so a client shows exactly what the registry
+// holds; one that does not fit is an error on either side
+static int encode_string(md_buffer_t *buf, const char *str) {
+    size_t len = strlen(str);
+    uint16_t len16 = (uint16_t)len;
+    
+    if (len > UINT16_MAX || md_buffer_append(buf, &len16, sizeof(len16)) != 0) {
+        return -1;
+    }
+    return md_buffer_append(buf, str, len);
+}
+
+static int decode_string(const char *data, size_t len, size_t *offset, char *out, size_t out_len) {
+    uint16_t str_len;
+    
+    if (*offset + sizeof(str_len) > len) {
+        return -1;
+    }
+    memcpy(&str_len, data + *offset, sizeof(str_len));
+    if (*offset + sizeof(str_len) + str_len > len || str_len >= out_len) {
+        return -1;
+    }
+    
+    memcpy(out, data + *offset + sizeof(str_len), str_len);
+    out[str_len] = '\0';
+    *offset += sizeof(str_len) + str_len;
+    return 0;
+}
+
+// pid (i32), created_at (i64), process_pid (i32), restarts (i32), then
+// strings, each a u16 length and that many bytes
+int md_encode_info(md_buffer_t *buf, const container_info_t *info) {
+    int32_t pid = (int32_t)info->pid;
+    int64_t created_at = (int64_t)info->created_at;
+    int32_t counts[2] = { (int32_t)info->process_pid, (int32_t)info->restarts };
+    
+    if (md_buffer_append(buf, &pid, sizeof(pid)) != 0 ||
+        md_buffer_append(buf, &created_at, sizeof(created_at)) != 0 ||
+        md_buffer_append(buf, counts, sizeof(counts)) != 0 ||
+        encode_string(buf, info->status) != 0 ||
+        encode_string(buf, info->health) != 0 ||
+        encode_string(buf, info->network) != 0 ||
+        encode_string(buf, info->ip) != 0 ||
+        encode_string(buf, info->image) != 0 ||
+        encode_string(buf, info->command) != 0 ||
+        encode_string(buf, info->ports) != 0 ||
+        encode_string(buf, info->restart) != 0 ||
+        encode_string(buf, info->name) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int md_decode_info(const char *data, size_t len, size_t *offset, container_info_t *info) {
+    int32_t pid;
+    int64_t created_at;
+    int32_t counts[2];
+    
+    if (*offset + sizeof(pid) + sizeof(created_at) + sizeof(counts) > len) {
+        return -1;
+    }
+    memcpy(&pid, data + *offset, sizeof(pid));
+    memcpy(&created_at, data + *offset + sizeof(pid), sizeof(created_at));
+    memcpy(counts, data + *offset + sizeof(pid) + sizeof(created_at), sizeof(counts));
+    *offset += sizeof(pid) + sizeof(created_at) + sizeof(counts);
+    
+    memset(info, 0, sizeof(*info));
+    info->pid = (pid_t)pid;
+    info->created_at = (time_t)created_at;
+    info->process_pid = (pid_t)counts[0];
+    info->restarts = counts[1];
+    
+    if (decode_string(data, len, offset, info->status, sizeof(info->status)) != 0 ||
+        decode_string(data, len, offset, info->health, sizeof(info->health)) != 0 ||
+        decode_string(data, len, offset, info->network, sizeof(info->network)) != 0 ||
+        decode_string(data, len, offset, info->ip, sizeof(info->ip)) != 0 ||
+        decode_string(data, len, offset, info->image, sizeof(info->image)) != 0 ||
+        decode_string(data, len, offset, info->command, sizeof(info->command)) != 0 ||
+        decode_string(data, len, offset, info->ports, sizeof(info->ports)) != 0 ||
+        decode_string(data, len, offset, info->restart, sizeof(info->restart)) != 0 ||
+        decode_string(data, len, offset, info->name, sizeof(info->name)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+const char *md_status_name(int status) {
+    switch (status) {
+    case MD_OK:            return "ok";
+    case MD_ERR_INVALID:   return "invalid request";
+    case MD_ERR_NOT_FOUND: return "no such container";
+    case MD_ERR_FAILED:    return "operation failed";
+    case MD_ERR_DENIED:    return "permission denied";
+    }
+    return "connection error";
+}
@@ -1,34 +1,149 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
 #include <json-c/json.h>
 #include "../include/registry.h"
+#include "../include/utils.h"
 
 #define REGISTRY_FILE "/var/lib/minidocker/containers.json"
 #define REGISTRY_DIR "/var/lib/minidocker"
 
+// Set by long-running processes (the daemon) to keep the registry parsed in
+// memory; every change is still written through to REGISTRY_FILE
+static struct json_object *cache = NULL;
+
+// Held from load_registry() to release_registry(), as the daemon's creator
+// thread and its event loop share the cache. Recursive, since
+// registry_foreach() callbacks may look up other entries.
+static pthread_mutex_t registry_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
 static void ensure_registry_dir() {
     mkdir(REGISTRY_DIR, 0755);
 }
 
-int registry_add_container(container_t *container) {
-    ensure_registry_dir();
+static struct json_object *load_registry(void) {
+    pthread_mutex_lock(&registry_lock);
+    if (cache) {
+        return cache;
+    }
+    
+    struct json_object *root = NULL;
+    char *content = read_file_content(REGISTRY_FILE);
+    if (content) {
+        root = json_tokener_parse(content);
+        free(content);
+    }
     
-    struct json_object *root = json_object_new_object();
     struct json_object *containers;
+    if (!root || !json_object_object_get_ex(root, "containers", &containers)) {
+        if (root) {
+            json_object_put(root);
+        }
+        root = json_object_new_object();
+        json_object_object_add(root, "containers", json_object_new_array());
+    }
+    
+    return root;
+}
+
+static void release_registry(struct json_object *root) {
+    if (root != cache) {
+        json_object_put(root);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static int save_registry(struct json_object *root) {
+    ensure_registry_dir();
+    
+    FILE *f = fopen(REGISTRY_FILE, "w");
+    if (!f) return -1;
+    fputs(json_object_to_json_string(root), f);
+    fclose(f);
+    
+    return 0;
+}
+
+// Newest entry first, in case the PID has been reused
+static struct json_object *find_container(struct json_object *root, pid_t pid) {
+    struct json_object *containers = json_object_object_get(root, "containers");
+    
+    int i;
+    for (i = (int)json_object_array_length(containers) - 1; i >= 0; i--) {
+        struct json_object *cont = json_object_array_get_idx(containers, i);
+        struct json_object *cont_pid;
+    
+        if (json_object_object_get_ex(cont, "pid", &cont_pid) &&
+            json_object_get_int(cont_pid) == pid) {
+            return cont;
+        }
+    }
     
-    // Read existing registry
-    FILE *f = fopen(REGISTRY_FILE, "r");
-    if (f) {
-        char buffer[4096];
-        fread(buffer, 1, sizeof(buffer), f);
-        fclose(f);
-        root = json_tokener_parse(buffer);
-        containers = json_object_object_get(root, "containers");
+    return NULL;
+}
+
+static void copy_field(struct json_object *cont, const char *key, char *buf, size_t len) {
+    struct json_object *value;
+    
+    if (json_object_object_get_ex(cont, key, &value)) {
+        snprintf(buf, len, "%s", json_object_get_string(value));
     } else {
-        containers = json_object_new_array();
+        snprintf(buf, len, "-");
+    }
+}
+
+static void fill_info(struct json_object *cont, container_info_t *info) {
+    struct json_object *value;
+    
+    memset(info, 0, sizeof(*info));
+    if (json_object_object_get_ex(cont, "pid", &value)) {
+        info->pid = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(cont, "created_at", &value)) {
+        info->created_at = (time_t)json_object_get_int64(value);
     }
+    info->process_pid = info->pid;
+    if (json_object_object_get_ex(cont, "process_pid", &value)) {
+        info->process_pid = json_object_get_int(value);
+    }
+    if (json_object_object_get_ex(cont, "restarts", &value)) {
+        info->restarts = json_object_get_int(value);
+    }
+    copy_field(cont, "restart", info->restart, sizeof(info->restart));
+    copy_field(cont, "name", info->name, sizeof(info->name));
+    copy_field(cont, "status", info->status, sizeof(info->status));
+    copy_field(cont, "health", info->health, sizeof(info->health));
+    copy_field(cont, "network", info->network, sizeof(info->network));
+    copy_field(cont, "ip", info->ip, sizeof(info->ip));
+    copy_field(cont, "image_path", info->image, sizeof(info->image));
+    copy_field(cont, "command", info->command, sizeof(info->command));
+    
+    // Ports are kept as an array of "host:container/proto" strings
+    size_t used = 0;
+    if (json_object_object_get_ex(cont, "ports", &value)) {
+        int j;
+        for (j = 0; j < (int)json_object_array_length(value) && used < sizeof(info->ports); j++) {
+            used += snprintf(info->ports + used, sizeof(info->ports) - used, "%s%s",
+                             j ? "," : "",
+                             json_object_get_string(json_object_array_get_idx(value, j)));
+        }
+    }
+}
+
+int registry_enable_cache(void) {
+    struct json_object *root = load_registry();
+    
+    cache = root;
+    release_registry(root);
+    return cache ? 0 : -1;
+}
+
+int registry_add_container(container_t *container) {
+    struct json_object *root = load_registry();
+    struct json_object *containers = json_object_object_get(root, "containers");
     
     // Create new container entry
     struct json_object *cont = json_object_new_object();
@@ -37,81 +152,228 @@ int registry_add_container(container_t *container) {
     json_object_object_add(cont, "command", json_object_new_string(container->command));
     json_object_object_add(cont, "created_at", json_object_new_int64(time(NULL)));
     json_object_object_add(cont, "status", json_object_new_string("running"));
+    if (container->name) {
+        json_object_object_add(cont, "name", json_object_new_string(container->name));
+    }
+    
+    json_object_object_add(cont, "network",
+                           json_object_new_string(network_mode_name(container->network_mode)));
+    
+    if (container->network_mode == NETWORK_BRIDGE && container->bridge_ip[0]) {
+        json_object_object_add(cont, "ip", json_object_new_string(container->bridge_ip));
+    } else if (container->network_ip) {
+        json_object_object_add(cont, "ip", json_object_new_string(container->network_ip));
+    }
+    
+    struct json_object *ports = json_object_new_array();
+    int i;
+    for (i = 0; i < container->num_ports; i++) {
+        char spec[32];
+        snprintf(spec, sizeof(spec), "%u:%u/%s",
+                 container->ports[i].host_port,
+                 container->ports[i].container_port,
+                 container->ports[i].protocol);
+        json_object_array_add(ports, json_object_new_string(spec));
+    }
+    json_object_object_add(cont, "ports", ports);
+    
+    // What exec needs to confine its processes like the container's own
+    json_object_object_add(cont, "seccomp", json_object_new_string(container->seccomp_digest));
+    json_object_object_add(cont, "cap_bset", json_object_new_int64((int64_t)container->cap_bset));
+    
+    char restart[24];
+    format_restart_policy(container->restart_policy, container->restart_max,
+                          restart, sizeof(restart));
+    json_object_object_add(cont, "restart", json_object_new_string(restart));
+    json_object_object_add(cont, "restarts", json_object_new_int(0));
+    
+    // Keep the run arguments so a restarted daemon can rebuild the container
+    if (container->run_argv) {
+        struct json_object *run_args = json_object_new_array();
+        for (i = 0; i < container->run_argc; i++) {
+            json_object_array_add(run_args, json_object_new_string(container->run_argv[i]));
+        }
+        json_object_object_add(cont, "run_args", run_args);
+    }
     
     // Add to array and save
     json_object_array_add(containers, cont);
-    json_object_object_add(root, "containers", containers);
     
-    f = fopen(REGISTRY_FILE, "w");
-    if (!f) return -1;
-    fputs(json_object_to_json_string(root), f);
-    fclose(f);
+    int ret = save_registry(root);
+    release_registry(root);
+    return ret;
+}
+
+static int registry_update_container_field(pid_t pid, const char *key, const char *value) {
+    struct json_object *root = load_registry();
+    struct json_object *cont = find_container(root, pid);
     
-    return 0;
+    if (!cont) {
+        release_registry(root);
+        return -1;
+    }
+    
+    json_object_object_add(cont, key, json_object_new_string(value));
+    
+    int ret = save_registry(root);
+    release_registry(root);
+    return ret;
 }
 
 int registry_update_container_status(pid_t pid, const char *status) {
-    ensure_registry_dir();
+    return registry_update_container_field(pid, "status", status);
+}
+
+int registry_update_container_health(pid_t pid, const char *health) {
+    return registry_update_container_field(pid, "health", health);
+}
+
+// Records a restart: the container keeps its ID, the process is new
+int registry_update_container_restart(pid_t pid, pid_t process_pid, int restarts) {
+    struct json_object *root = load_registry();
+    struct json_object *cont = find_container(root, pid);
     
-    struct json_object *root;
-    FILE *f = fopen(REGISTRY_FILE, "r");
-    if (!f) return -1;
+    if (!cont) {
+        release_registry(root);
+        return -1;
+    }
     
-    char buffer[4096];
-    fread(buffer, 1, sizeof(buffer), f);
-    fclose(f);
+    json_object_object_add(cont, "status", json_object_new_string("running"));
+    json_object_object_add(cont, "process_pid", json_object_new_int(process_pid));
+    json_object_object_add(cont, "restarts", json_object_new_int(restarts));
+    
+    int ret = save_registry(root);
+    release_registry(root);
+    return ret;
+}
+
+// Returns the stored run arguments as a copy_argv() vector for the caller
+// to free, or NULL
+char **registry_get_run_args(pid_t pid, int *argc) {
+    struct json_object *root = load_registry();
+    struct json_object *cont = find_container(root, pid);
+    struct json_object *run_args;
+    char **argv = NULL;
+    
+    if (cont && json_object_object_get_ex(cont, "run_args", &run_args)) {
+        int count = (int)json_object_array_length(run_args);
+        const char **strings = calloc((size_t)count + 1, sizeof(char *));
+    
+        if (strings) {
+            int j;
+            for (j = 0; j < count; j++) {
+                strings[j] = json_object_get_string(json_object_array_get_idx(run_args, j));
+            }
+            argv = copy_argv(count, strings);
+            free(strings);
+        }
+        if (argv) {
+            *argc = count;
+        }
+    }
+    
+    release_registry(root);
+    return argv;
+}
+
+int registry_get_container(pid_t pid, container_info_t *info) {
+    struct json_object *root = load_registry();
+    struct json_object *cont = find_container(root, pid);
+    
+    if (cont && info) {
+        fill_info(cont, info);
+    }
+    
+    release_registry(root);
+    return cont ? 0 : -1;
+}
+
+// Fails for entries written before the registry recorded confinement
+int registry_get_security(pid_t pid, char *digest, size_t len, uint64_t *cap_bset) {
+    struct json_object *root = load_registry();
+    struct json_object *cont = find_container(root, pid);
+    struct json_object *seccomp, *caps;
+    int ret = -1;
     
-    root = json_tokener_parse(buffer);
+    if (cont && json_object_object_get_ex(cont, "seccomp", &seccomp) &&
+        json_object_object_get_ex(cont, "cap_bset", &caps)) {
+        snprintf(digest, len, "%s", json_object_get_string(seccomp));
+        *cap_bset = (uint64_t)json_object_get_int64(caps);
+        ret = 0;
+    }
+    
+    release_registry(root);
+    return ret;
+}
+
+int registry_foreach(int (*callback)(const container_info_t *info, void *arg), void *arg) {
+    struct json_object *root = load_registry();
     struct json_object *containers = json_object_object_get(root, "containers");
+    container_info_t info;
+    int ret = 0;
     
     int i;
-    for (i = 0; i < json_object_array_length(containers); i++) {
-        struct json_object *cont = json_object_array_get_idx(containers, i);
-        struct json_object *cont_pid;
-        json_object_object_get_ex(cont, "pid", &cont_pid);
-        
-        if (json_object_get_int(cont_pid) == pid) {
-            json_object_object_add(cont, "status", json_object_new_string(status));
+    for (i = 0; i < (int)json_object_array_length(containers); i++) {
+        fill_info(json_object_array_get_idx(containers, i), &info);
+        if ((ret = callback(&info, arg)) != 0) {
             break;
         }
     }
     
-    f = fopen(REGISTRY_FILE, "w");
-    if (!f) return -1;
-    fputs(json_object_to_json_string(root), f);
-    fclose(f);
+    release_registry(root);
+    return ret;
+}
+
+void registry_print_header(void) {
+    printf("CONTAINER ID\tSTATUS\t\tHEALTH\t\tCOMMAND\t\tPORTS\n");
+}
+
+void registry_print_container(const container_info_t *info) {
+    char status[32];
     
+    // Restarted containers show how often, e.g. "crashloop (7)"
+    if (info->restarts > 0) {
+        snprintf(status, sizeof(status), "%s (%d)", info->status, info->restarts);
+    } else {
+        snprintf(status, sizeof(status), "%s", info->status);
+    }
+    printf("%d\t\t%s\t\t%s\t\t%s\t\t%s\n",
+           (int)info->pid, status, info->health, info->command, info->ports);
+}
+
+static int print_container(const container_info_t *info, void *arg) {
+    (void)arg;
+    registry_print_container(info);
     return 0;
 }
 
 void registry_list_containers() {
-    FILE *f = fopen(REGISTRY_FILE, "r");
-    if (!f) {
+    if (!cache && !file_exists(REGISTRY_FILE)) {
         printf("No containers found\n");
         return;
     }
     
-    char buffer[4096];
-    fread(buffer, 1, sizeof(buffer), f);
-    fclose(f);
-    
-    struct json_object *root = json_tokener_parse(buffer);
-    struct json_object *containers = json_object_object_get(root, "containers");
+    registry_print_header();
+    registry_foreach(print_container, NULL);
+}
+
+int registry_get_ports(pid_t pid, port_mapping_t *ports, int max_ports) {
+    struct json_object *root = load_registry();
+    struct json_object *cont = find_container(root, pid);
+    struct json_object *cont_ports;
+    int count = 0;
     
-    printf("CONTAINER ID\tSTATUS\t\tCOMMAND\n");
+    if (cont && json_object_object_get_ex(cont, "ports", &cont_ports)) {
+        int j;
+        for (j = 0; j < (int)json_object_array_length(cont_ports) && count < max_ports; j++) {
+            const char *spec = json_object_get_string(
+                json_object_array_get_idx(cont_ports, j));
+            if (parse_port_mapping(spec, &ports[count]) == 0) {
+                count++;
+            }
+        }
+    }
     
-    int i;
-    for (i = 0; i < json_object_array_length(containers); i++) {
-        struct json_object *cont = json_object_array_get_idx(containers, i);
-        struct json_object *pid, *status, *command;
-        
-        json_object_object_get_ex(cont, "pid", &pid);
-        json_object_object_get_ex(cont, "status", &status);
-        json_object_object_get_ex(cont, "command", &command);
-        
-        printf("%d\t\t%s\t\t%s\n",
-               json_object_get_int(pid),
-               json_object_get_string(status),
-               json_object_get_string(command));
-    }
-}
\ No newline at end of file
+    release_registry(root);
+    return count;
+}
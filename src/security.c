@@ -0,0 +1,485 @@
+#include "security.h"
+#include "sha256.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <seccomp.h>
+#include <strings.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <json-c/json.h>
+#include <linux/capability.h>
+#include <linux/filter.h>
+#include <linux/limits.h>
+#include <linux/seccomp.h>
+
+// Optimization level 2 makes libseccomp lay the filter out as a binary
+// search tree over syscall numbers instead of one comparison per rule
+#define SECCOMP_OPTIMIZE_BINARY_TREE 2
+
+static const char *const capability_names[] = {
+    "CHOWN", "DAC_OVERRIDE", "DAC_READ_SEARCH", "FOWNER", "FSETID", "KILL",
+    "SETGID", "SETUID", "SETPCAP", "LINUX_IMMUTABLE", "NET_BIND_SERVICE",
+    "NET_BROADCAST", "NET_ADMIN", "NET_RAW", "IPC_LOCK", "IPC_OWNER",
+    "SYS_MODULE", "SYS_RAWIO", "SYS_CHROOT", "SYS_PTRACE", "SYS_PACCT",
+    "SYS_ADMIN", "SYS_BOOT", "SYS_NICE", "SYS_RESOURCE", "SYS_TIME",
+    "SYS_TTY_CONFIG", "MKNOD", "LEASE", "AUDIT_WRITE", "AUDIT_CONTROL",
+    "SETFCAP", "MAC_OVERRIDE", "MAC_ADMIN", "SYSLOG", "WAKE_ALARM",
+    "BLOCK_SUSPEND", "AUDIT_READ", "PERFMON", "BPF", "CHECKPOINT_RESTORE"
+};
+#define CAPABILITY_COUNT ((int)(sizeof(capability_names) / sizeof(capability_names[0])))
+
+// Same set Docker keeps: enough to run ordinary services as root, nothing
+// that reaches outside the container's namespaces
+static const int default_caps[] = {
+    CAP_CHOWN, CAP_DAC_OVERRIDE, CAP_FSETID, CAP_FOWNER, CAP_MKNOD, CAP_NET_RAW,
+    CAP_SETGID, CAP_SETUID, CAP_SETFCAP, CAP_SETPCAP, CAP_NET_BIND_SERVICE,
+    CAP_SYS_CHROOT, CAP_KILL, CAP_AUDIT_WRITE
+};
+
+// Allow-list modelled on Docker's default profile. Namespace creation via
+// clone is refused, and clone3 reports ENOSYS so libc falls back to clone,
+// whose flags a filter can inspect.
+static const char default_profile[] =
+    "{\"defaultAction\": \"SCMP_ACT_ERRNO\", \"defaultErrnoRet\": 1, \"syscalls\": ["
+    "{\"action\": \"SCMP_ACT_ALLOW\", \"names\": ["
+    "\"accept\", \"accept4\", \"access\", \"adjtimex\", \"alarm\", \"arch_prctl\", \"bind\", "
+    "\"brk\", \"cachestat\", \"capget\", \"capset\", \"chdir\", \"chmod\", \"chown\", "
+    "\"clock_adjtime\", \"clock_getres\", \"clock_gettime\", \"clock_nanosleep\", \"close\", "
+    "\"close_range\", \"connect\", \"copy_file_range\", \"creat\", \"dup\", \"dup2\", \"dup3\", "
+    "\"epoll_create\", \"epoll_create1\", \"epoll_ctl\", \"epoll_pwait\", \"epoll_pwait2\", "
+    "\"epoll_wait\", \"eventfd\", \"eventfd2\", \"execve\", \"execveat\", \"exit\", "
+    "\"exit_group\", \"faccessat\", \"faccessat2\", \"fadvise64\", \"fallocate\", "
+    "\"fanotify_mark\", \"fchdir\", \"fchmod\", \"fchmodat\", \"fchmodat2\", \"fchown\", "
+    "\"fchownat\", \"fcntl\", \"fdatasync\", \"fgetxattr\", \"flistxattr\", \"flock\", "
+    "\"fork\", \"fremovexattr\", \"fsetxattr\", \"fstat\", \"fstatfs\", \"fsync\", "
+    "\"ftruncate\", \"futex\", \"futex_requeue\", \"futex_wait\", \"futex_waitv\", "
+    "\"futex_wake\", \"futimesat\", \"getcpu\", \"getcwd\", \"getdents\", \"getdents64\", "
+    "\"getegid\", \"geteuid\", \"getgid\", \"getgroups\", \"getitimer\", \"getpeername\", "
+    "\"getpgid\", \"getpgrp\", \"getpid\", \"getppid\", \"getpriority\", \"getrandom\", "
+    "\"getresgid\", \"getresuid\", \"getrlimit\", \"get_robust_list\", \"getrusage\", "
+    "\"getsid\", \"getsockname\", \"getsockopt\", \"gettid\", \"gettimeofday\", \"getuid\", "
+    "\"getxattr\", \"inotify_add_watch\", \"inotify_init\", \"inotify_init1\", "
+    "\"inotify_rm_watch\", \"io_cancel\", \"ioctl\", \"io_destroy\", \"io_getevents\", "
+    "\"io_pgetevents\", \"ioprio_get\", \"ioprio_set\", \"io_setup\", \"io_submit\", "
+    "\"io_uring_enter\", \"io_uring_register\", \"io_uring_setup\", \"kill\", "
+    "\"landlock_add_rule\", \"landlock_create_ruleset\", \"landlock_restrict_self\", "
+    "\"lchown\", \"lgetxattr\", \"link\", \"linkat\", \"listen\", \"listxattr\", "
+    "\"llistxattr\", \"lremovexattr\", \"lseek\", \"lsetxattr\", \"lstat\", \"madvise\", "
+    "\"map_shadow_stack\", \"membarrier\", \"memfd_create\", \"memfd_secret\", \"mincore\", "
+    "\"mkdir\", \"mkdirat\", \"mknod\", \"mknodat\", \"mlock\", \"mlock2\", \"mlockall\", "
+    "\"mmap\", \"modify_ldt\", \"mprotect\", \"mq_getsetattr\", \"mq_notify\", \"mq_open\", "
+    "\"mq_timedreceive\", \"mq_timedsend\", \"mq_unlink\", \"mremap\", \"msgctl\", "
+    "\"msgget\", \"msgrcv\", \"msgsnd\", \"msync\", \"munlock\", \"munlockall\", \"munmap\", "
+    "\"name_to_handle_at\", \"nanosleep\", \"newfstatat\", \"open\", \"openat\", "
+    "\"openat2\", \"pause\", \"pidfd_getfd\", \"pidfd_open\", \"pidfd_send_signal\", "
+    "\"pipe\", \"pipe2\", \"pkey_alloc\", \"pkey_free\", \"pkey_mprotect\", \"poll\", "
+    "\"ppoll\", \"prctl\", \"pread64\", \"preadv\", \"preadv2\", \"prlimit64\", "
+    "\"process_mrelease\", \"pselect6\", \"pwrite64\", \"pwritev\", \"pwritev2\", \"read\", "
+    "\"readahead\", \"readlink\", \"readlinkat\", \"readv\", \"recvfrom\", \"recvmmsg\", "
+    "\"recvmsg\", \"remap_file_pages\", \"removexattr\", \"rename\", \"renameat\", "
+    "\"renameat2\", \"restart_syscall\", \"rmdir\", \"rseq\", \"rt_sigaction\", "
+    "\"rt_sigpending\", \"rt_sigprocmask\", \"rt_sigqueueinfo\", \"rt_sigreturn\", "
+    "\"rt_sigsuspend\", \"rt_sigtimedwait\", \"rt_tgsigqueueinfo\", \"sched_getaffinity\", "
+    "\"sched_getattr\", \"sched_getparam\", \"sched_get_priority_max\", "
+    "\"sched_get_priority_min\", \"sched_getscheduler\", \"sched_rr_get_interval\", "
+    "\"sched_setaffinity\", \"sched_setattr\", \"sched_setparam\", \"sched_setscheduler\", "
+    "\"sched_yield\", \"seccomp\", \"select\", \"semctl\", \"semget\", \"semop\", "
+    "\"semtimedop\", \"sendfile\", \"sendmmsg\", \"sendmsg\", \"sendto\", \"setfsgid\", "
+    "\"setfsuid\", \"setgid\", \"setgroups\", \"setitimer\", \"setpgid\", \"setpriority\", "
+    "\"setregid\", \"setresgid\", \"setresuid\", \"setreuid\", \"setrlimit\", "
+    "\"set_robust_list\", \"setsid\", \"setsockopt\", \"set_tid_address\", \"setuid\", "
+    "\"setxattr\", \"shmat\", \"shmctl\", \"shmdt\", \"shmget\", \"shutdown\", "
+    "\"sigaltstack\", \"signalfd\", \"signalfd4\", \"socket\", \"socketpair\", \"splice\", "
+    "\"stat\", \"statfs\", \"statx\", \"symlink\", \"symlinkat\", \"sync\", "
+    "\"sync_file_range\", \"syncfs\", \"sysinfo\", \"tee\", \"tgkill\", \"time\", "
+    "\"timer_create\", \"timer_delete\", \"timer_getoverrun\", \"timer_gettime\", "
+    "\"timer_settime\", \"timerfd_create\", \"timerfd_gettime\", \"timerfd_settime\", "
+    "\"times\", \"tkill\", \"truncate\", \"umask\", \"uname\", \"unlink\", \"unlinkat\", "
+    "\"utime\", \"utimensat\", \"utimes\", \"vfork\", \"vmsplice\", \"wait4\", \"waitid\", "
+    "\"write\", \"writev\"]},"
+    "{\"action\": \"SCMP_ACT_ALLOW\", \"names\": [\"personality\"], \"args\": "
+    "[{\"index\": 0, \"value\": 0, \"op\": \"SCMP_CMP_EQ\"}]},"
+    "{\"action\": \"SCMP_ACT_ALLOW\", \"names\": [\"personality\"], \"args\": "
+    "[{\"index\": 0, \"value\": 8, \"op\": \"SCMP_CMP_EQ\"}]},"
+    "{\"action\": \"SCMP_ACT_ALLOW\", \"names\": [\"personality\"], \"args\": "
+    "[{\"index\": 0, \"value\": 4294967295, \"op\": \"SCMP_CMP_EQ\"}]},"
+    "{\"action\": \"SCMP_ACT_ALLOW\", \"names\": [\"clone\"], \"args\": "
+    "[{\"index\": 0, \"value\": 2114060288, \"valueTwo\": 0, \"op\": \"SCMP_CMP_MASKED_EQ\"}]},"
+    "{\"action\": \"SCMP_ACT_ERRNO\", \"errnoRet\": 38, \"names\": [\"clone3\"]}"
+    "]}";
+
+uint64_t default_capabilities(void) {
+    uint64_t caps = 0;
+    
+    for (size_t i = 0; i < sizeof(default_caps) / sizeof(default_caps[0]); i++) {
+        caps |= 1ULL << default_caps[i];
+    }
+    return caps;
+}
+
+// "NET_ADMIN", "cap_net_admin" or "ALL" (-1)
+int parse_capability(const char *name, int *cap) {
+    if (strncasecmp(name, "CAP_", 4) == 0) {
+        name += 4;
+    }
+    if (strcasecmp(name, "ALL") == 0) {
+        *cap = -1;
+        return 0;
+    }
+    for (int i = 0; i < CAPABILITY_COUNT; i++) {
+        if (strcasecmp(name, capability_names[i]) == 0) {
+            *cap = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int parse_action(struct json_object *rule, const char *key, const char *errno_key,
+                        uint32_t *action) {
+    struct json_object *value;
+    int errno_ret = EPERM;
+    
+    if (!json_object_object_get_ex(rule, key, &value)) {
+        return -1;
+    }
+    const char *name = json_object_get_string(value);
+    if (json_object_object_get_ex(rule, errno_key, &value)) {
+        errno_ret = json_object_get_int(value);
+    }
+    
+    if (strcmp(name, "SCMP_ACT_ALLOW") == 0) {
+        *action = SCMP_ACT_ALLOW;
+    } else if (strcmp(name, "SCMP_ACT_ERRNO") == 0) {
+        *action = SCMP_ACT_ERRNO(errno_ret);
+    } else if (strcmp(name, "SCMP_ACT_KILL") == 0 || strcmp(name, "SCMP_ACT_KILL_THREAD") == 0) {
+        *action = SCMP_ACT_KILL_THREAD;
+    } else if (strcmp(name, "SCMP_ACT_KILL_PROCESS") == 0) {
+        *action = SCMP_ACT_KILL_PROCESS;
+    } else if (strcmp(name, "SCMP_ACT_TRAP") == 0) {
+        *action = SCMP_ACT_TRAP;
+    } else if (strcmp(name, "SCMP_ACT_LOG") == 0) {
+        *action = SCMP_ACT_LOG;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_compare(const char *name, enum scmp_compare *op) {
+    static const struct { const char *name; enum scmp_compare op; } ops[] = {
+        { "SCMP_CMP_NE", SCMP_CMP_NE }, { "SCMP_CMP_LT", SCMP_CMP_LT },
+        { "SCMP_CMP_LE", SCMP_CMP_LE }, { "SCMP_CMP_EQ", SCMP_CMP_EQ },
+        { "SCMP_CMP_GE", SCMP_CMP_GE }, { "SCMP_CMP_GT", SCMP_CMP_GT },
+        { "SCMP_CMP_MASKED_EQ", SCMP_CMP_MASKED_EQ }
+    };
+    
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strcmp(name, ops[i].name) == 0) {
+            *op = ops[i].op;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// One entry of "syscalls": the same action and argument checks for every
+// name listed. Names this architecture lacks are skipped.
+static int add_rule(scmp_filter_ctx ctx, struct json_object *rule, uint32_t default_action) {
+    uint32_t action;
+    if (parse_action(rule, "action", "errnoRet", &action) != 0) {
+        return -1;
+    }
+    
+    struct scmp_arg_cmp args[6];
+    unsigned int arg_count = 0;
+    struct json_object *list, *value;
+    if (json_object_object_get_ex(rule, "args", &list) && list) {
+        size_t n = json_object_array_length(list);
+        if (n > 6) {
+            return -1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            struct json_object *arg = json_object_array_get_idx(list, i);
+            struct scmp_arg_cmp *cmp = &args[arg_count++];
+            memset(cmp, 0, sizeof(*cmp));
+            if (!json_object_object_get_ex(arg, "index", &value)) {
+                return -1;
+            }
+            cmp->arg = (unsigned int)json_object_get_int(value);
+            if (!json_object_object_get_ex(arg, "value", &value)) {
+                return -1;
+            }
+            cmp->datum_a = (scmp_datum_t)json_object_get_int64(value);
+            if (json_object_object_get_ex(arg, "valueTwo", &value)) {
+                cmp->datum_b = (scmp_datum_t)json_object_get_int64(value);
+            }
+            if (!json_object_object_get_ex(arg, "op", &value) ||
+                parse_compare(json_object_get_string(value), &cmp->op) != 0 || cmp->arg > 5) {
+                return -1;
+            }
+        }
+    }
+    
+    // Docker profiles use "names"; older ones a single "name"
+    struct json_object *names = NULL;
+    if (!json_object_object_get_ex(rule, "names", &names) &&
+        !json_object_object_get_ex(rule, "name", &names)) {
+        return -1;
+    }
+    size_t count = json_object_is_type(names, json_type_array) ? json_object_array_length(names) : 1;
+    for (size_t i = 0; i < count; i++) {
+        struct json_object *name = json_object_is_type(names, json_type_array) ?
+                            json_object_array_get_idx(names, i) : names;
+        int nr = seccomp_syscall_resolve_name(json_object_get_string(name));
+        if (nr == __NR_SCMP_ERROR) {
+            continue;
+        }
+        // A rule repeating the default action is redundant, not an error
+        if (action == default_action) {
+            continue;
+        }
+        int rc = seccomp_rule_add_array(ctx, action, nr, arg_count, args);
+        if (rc < 0) {
+            log_message(LOG_ERROR, "Bad seccomp rule for %s: %s",
+                        json_object_get_string(name), strerror(-rc));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int compile_profile(const char *text, const char *cache_path) {
+    struct json_object *root = json_tokener_parse(text);
+    if (!root) {
+        log_message(LOG_ERROR, "Seccomp profile is not valid JSON");
+        return -1;
+    }
+    
+    int ret = -1;
+    scmp_filter_ctx ctx = NULL;
+    uint32_t default_action;
+    struct json_object *rules;
+    if (parse_action(root, "defaultAction", "defaultErrnoRet", &default_action) != 0) {
+        log_message(LOG_ERROR, "Seccomp profile has no valid defaultAction");
+        goto out;
+    }
+    
+    ctx = seccomp_init(default_action);
+    if (!ctx || seccomp_attr_set(ctx, SCMP_FLTATR_CTL_OPTIMIZE, SECCOMP_OPTIMIZE_BINARY_TREE) != 0) {
+        log_message(LOG_ERROR, "Failed to set up seccomp filter");
+        goto out;
+    }
+    
+    if (json_object_object_get_ex(root, "syscalls", &rules) && rules) {
+        for (size_t i = 0; i < json_object_array_length(rules); i++) {
+            if (add_rule(ctx, json_object_array_get_idx(rules, i), default_action) != 0) {
+                log_message(LOG_ERROR, "Invalid seccomp rule %zu", i);
+                goto out;
+            }
+        }
+    }
+    
+    // Written under a temporary name so a concurrent run never loads half
+    // a program
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", cache_path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        log_message(LOG_ERROR, "Failed to create %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+    int rc = seccomp_export_bpf(ctx, fd);
+    close(fd);
+    if (rc != 0 || rename(tmp, cache_path) == -1) {
+        log_message(LOG_ERROR, "Failed to write seccomp program %s", cache_path);
+        unlink(tmp);
+        goto out;
+    }
+    ret = 0;
+    
+out:
+    if (ctx) {
+        seccomp_release(ctx);
+    }
+    json_object_put(root);
+    return ret;
+}
+
+// Highest capability the kernel knows. security_apply() runs in a cloned
+// child that must not allocate, so the parent reads it while preparing.
+static int last_cap = CAP_LAST_CAP;
+static pthread_once_t last_cap_once = PTHREAD_ONCE_INIT;
+
+static void read_last_capability(void) {
+    char *content = read_file_content("/proc/sys/kernel/cap_last_cap");
+    int last = content ? atoi(content) : CAP_LAST_CAP;
+    
+    free(content);
+    if (last > 0 && last < 64) {
+        last_cap = last;
+    }
+}
+
+static int load_program(const char *path, container_t *container) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    
+    size_t len = (size_t)st.st_size / sizeof(struct sock_filter);
+    if (st.st_size == 0 || st.st_size % sizeof(struct sock_filter) != 0 || len > BPF_MAXINSNS) {
+        log_message(LOG_ERROR, "Corrupt seccomp program %s", path);
+        close(fd);
+        return -1;
+    }
+    
+    struct sock_filter *filter = malloc((size_t)st.st_size);
+    if (!filter || read(fd, filter, (size_t)st.st_size) != st.st_size) {
+        free(filter);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    
+    container->seccomp_filter = filter;
+    container->seccomp_len = (unsigned short)len;
+    return 0;
+}
+
+int security_prepare(container_t *container) {
+    pthread_once(&last_cap_once, read_last_capability);
+    container->seccomp_filter = NULL;
+    container->seccomp_len = 0;
+    container->seccomp_digest[0] = '\0';
+    if (container->seccomp_profile && strcmp(container->seccomp_profile, SECCOMP_UNCONFINED) == 0) {
+        return 0;
+    }
+    
+    char *custom = NULL;
+    const char *text = default_profile;
+    if (container->seccomp_profile) {
+        custom = read_file_content(container->seccomp_profile);
+        if (!custom) {
+            log_message(LOG_ERROR, "Cannot read seccomp profile %s", container->seccomp_profile);
+            return -1;
+        }
+        text = custom;
+    }
+    
+    // The program depends on the library and architecture as well as on
+    // the profile, so all three make up the cache key
+    const struct scmp_version *version = seccomp_version();
+    uint32_t arch = seccomp_arch_native();
+    sha256_ctx_t ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    sha256_init(&ctx);
+    sha256_update(&ctx, text, strlen(text));
+    sha256_update(&ctx, version, sizeof(*version));
+    sha256_update(&ctx, &arch, sizeof(arch));
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, hex);
+    
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.bpf", SECCOMP_CACHE_DIR, hex);
+    
+    int ret = 0;
+    if (access(path, F_OK) != 0) {
+        if ((mkdir("/var/lib/minidocker", 0755) == -1 && errno != EEXIST) ||
+            (mkdir(SECCOMP_CACHE_DIR, 0755) == -1 && errno != EEXIST)) {
+            log_message(LOG_ERROR, "Failed to create %s", SECCOMP_CACHE_DIR);
+            ret = -1;
+        } else {
+            log_message(LOG_DEBUG, "Compiling seccomp profile %s",
+                        container->seccomp_profile ? container->seccomp_profile : "(default)");
+            ret = compile_profile(text, path);
+        }
+    }
+    if (ret == 0) {
+        ret = load_program(path, container);
+    }
+    if (ret == 0) {
+        memcpy(container->seccomp_digest, hex, sizeof(hex));
+    }
+    
+    free(custom);
+    return ret;
+}
+
+int security_load(const char *digest, container_t *container) {
+    pthread_once(&last_cap_once, read_last_capability);
+    container->seccomp_filter = NULL;
+    container->seccomp_len = 0;
+    if (digest[0] == '\0') {
+        return 0;
+    }
+    
+    // The digest names a file, so it must be nothing but a hash
+    if (strlen(digest) != SHA256_HEX_SIZE - 1 ||
+        strspn(digest, "0123456789abcdef") != SHA256_HEX_SIZE - 1) {
+        log_message(LOG_ERROR, "Invalid seccomp program digest %s", digest);
+        return -1;
+    }
+    
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.bpf", SECCOMP_CACHE_DIR, digest);
+    if (load_program(path, container) != 0) {
+        log_message(LOG_ERROR, "Cannot load seccomp program %s", path);
+        return -1;
+    }
+    snprintf(container->seccomp_digest, sizeof(container->seccomp_digest), "%s", digest);
+    return 0;
+}
+
+void security_release(container_t *container) {
+    free(container->seccomp_filter);
+    container->seccomp_filter = NULL;
+    container->seccomp_len = 0;
+}
+
+int security_apply(const container_t *container) {
+    uint64_t keep = container->cap_bset;
+    
+    // Shrink the bounding set first; it caps what any exec can regain
+    for (int cap = 0; cap <= last_cap; cap++) {
+        if (!(keep & (1ULL << cap)) && prctl(PR_CAPBSET_DROP, cap, 0, 0, 0) == -1) {
+            log_child(LOG_ERROR, "Failed to drop capability %d: %s", cap, strerrordesc_np(errno));
+            return -1;
+        }
+    }
+    prctl(PR_CAP_AMBIENT, PR_CAP_AMBIENT_CLEAR_ALL, 0, 0, 0);
+    
+    // Installing a filter without no_new_privs needs CAP_SYS_ADMIN, which
+    // is still effective here; the filter must then allow capset
+    if (container->seccomp_filter) {
+        struct sock_fprog prog = {
+            .len = container->seccomp_len,
+            .filter = container->seccomp_filter
+        };
+        if (syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &prog) == -1) {
+            log_child(LOG_ERROR, "Failed to install seccomp filter: %s", strerrordesc_np(errno));
+            return -1;
+        }
+    }
+    
+    struct __user_cap_header_struct header = { .version = _LINUX_CAPABILITY_VERSION_3, .pid = 0 };
+    struct __user_cap_data_struct data[2];
+    memset(data, 0, sizeof(data));
+    for (int i = 0; i < 2; i++) {
+        data[i].effective = (uint32_t)(keep >> (32 * i));
+        data[i].permitted = (uint32_t)(keep >> (32 * i));
+    }
+    if (syscall(SYS_capset, &header, data) == -1) {
+        log_child(LOG_ERROR, "Failed to set capabilities: %s", strerrordesc_np(errno));
+        return -1;
+    }
+    
+    return 0;
+}
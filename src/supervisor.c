@@ -0,0 +1,723 @@
+#include "supervisor.h"
+#include "cgroup.h"
+#include "cpuset.h"
+#include "events.h"
+#include "exec.h"
+#include "metrics.h"
+#include "network.h"
+#include "registry.h"
+#include "security.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+#define SUPERVISOR_TICK_MS 10
+#define MAX_EVENTS 64
+
+// Restart delays double from RESTART_BACKOFF_MIN_MS up to
+// RESTART_BACKOFF_MAX_MS and start over once a run lasts RESTART_RESET_MS.
+// CRASHLOOP_EXITS short runs in a row mark the container crash-looping.
+#define RESTART_BACKOFF_MIN_MS 100
+#define RESTART_BACKOFF_MAX_MS (60 * 1000)
+#define RESTART_RESET_MS (10 * 1000)
+#define CRASHLOOP_EXITS 3
+
+enum {
+    WATCH_TIMER,
+    WATCH_EXIT,
+    WATCH_CHECK,
+    WATCH_OOM
+};
+
+// One supervisor per process: a single epoll set and a single timing wheel,
+// however many containers are watched
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static timer_wheel_t wheel;
+static supervisor_watch_t timer_watch = { WATCH_TIMER, NULL };
+static supervised_t *watched = NULL;
+static size_t watched_count = 0;
+static supervisor_stats_t stats;
+static supervisor_exit_hook_t exit_hook = NULL;
+
+static void container_done(supervised_t *sc, int status);
+
+const char *health_status_name(health_status_t health) {
+    switch (health) {
+    case HEALTH_NONE:      return "none";
+    case HEALTH_STARTING:  return "starting";
+    case HEALTH_HEALTHY:   return "healthy";
+    case HEALTH_UNHEALTHY: return "unhealthy";
+    }
+    return "unknown";
+}
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int supervisor_init(void) {
+    if (epoll_fd != -1) {
+        return 0;
+    }
+    
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        log_message(LOG_ERROR, "Failed to create supervisor epoll: %s", strerror(errno));
+        return -1;
+    }
+    
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        log_message(LOG_ERROR, "Failed to create supervisor timer: %s", strerror(errno));
+        close(epoll_fd);
+        epoll_fd = -1;
+        return -1;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &timer_watch };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1) {
+        log_message(LOG_ERROR, "Failed to watch supervisor timer: %s", strerror(errno));
+        close(timer_fd);
+        close(epoll_fd);
+        timer_fd = epoll_fd = -1;
+        return -1;
+    }
+    
+    timer_wheel_init(&wheel, SUPERVISOR_TICK_MS, monotonic_ms());
+    memset(&stats, 0, sizeof(stats));
+    
+    return 0;
+}
+
+int supervisor_fd(void) {
+    return epoll_fd;
+}
+
+size_t supervisor_count(void) {
+    return watched_count;
+}
+
+void supervisor_foreach(void (*callback)(supervised_t *sc, void *arg), void *arg) {
+    for (supervised_t *sc = watched; sc; sc = sc->next) {
+        callback(sc, arg);
+    }
+}
+
+void supervisor_get_stats(supervisor_stats_t *out) {
+    if (out) {
+        *out = stats;
+    }
+}
+
+// Program the timerfd for the wheel's next expiry (or disarm it)
+static void rearm_timer(void) {
+    struct itimerspec its = {0};
+    int timeout = timer_wheel_next_timeout(&wheel, monotonic_ms());
+    
+    if (timeout == 0) {
+        its.it_value.tv_nsec = 1;
+    } else if (timeout > 0) {
+        its.it_value.tv_sec = timeout / 1000;
+        its.it_value.tv_nsec = (long)(timeout % 1000) * 1000000L;
+    }
+    timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+// Only transitions touch the registry
+static void set_health(supervised_t *sc, health_status_t next) {
+    if (next != sc->health) {
+        log_message(LOG_INFO, "Container %d is %s", (int)sc->pid, health_status_name(next));
+        sc->health = next;
+        registry_update_container_health(sc->pid, health_status_name(next));
+        events_emit(EVENT_HEALTH, sc->pid, 0, health_status_name(next));
+    }
+}
+
+static void record_check_result(supervised_t *sc, int ok) {
+    health_status_t next = sc->health;
+    
+    stats.checks_run++;
+    if (ok) {
+        sc->failures = 0;
+        next = HEALTH_HEALTHY;
+    } else {
+        stats.checks_failed++;
+        if (++sc->failures >= sc->health_retries) {
+            next = HEALTH_UNHEALTHY;
+        }
+    }
+    
+    set_health(sc, next);
+}
+
+static void start_health_check(supervised_t *sc) {
+    char *argv[] = { "/bin/sh", "-c", sc->health_cmd, NULL };
+    
+    // Looked up and loaded once, not by every check's shim; a failure
+    // counts as a failed check and is retried next time
+    if (!sc->confine_loaded && container_load_confinement(sc->pid, &sc->confine) == 0) {
+        sc->confine_loaded = 1;
+    }
+    
+    sc->check_pid = sc->confine_loaded ?
+        container_exec_spawn(&sc->confine, sc->process_pid, argv, &sc->check_pidfd) : -1;
+    if (sc->check_pid <= 0) {
+        sc->check_pid = 0;
+        record_check_result(sc, 0);
+        timer_wheel_add(&wheel, &sc->health_timer, monotonic_ms() + sc->health_interval_ms);
+        return;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &sc->check_watch };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sc->check_pidfd, &ev);
+    
+    // The same timer now guards the check's deadline
+    timer_wheel_add(&wheel, &sc->health_timer, monotonic_ms() + sc->health_timeout_ms);
+}
+
+static void health_timer_fired(timer_entry_t *timer, void *data) {
+    (void)timer;
+    supervised_t *sc = (supervised_t *)data;
+    
+    stats.timers_fired++;
+    
+    if (sc->check_pid > 0) {
+        // Timed out; the kill is reported as a failed check on completion
+        log_message(LOG_DEBUG, "Health check for %d timed out", (int)sc->pid);
+        kill(sc->check_pid, SIGKILL);
+        return;
+    }
+    
+    start_health_check(sc);
+}
+
+static void handle_check_done(supervised_t *sc) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    waitid((idtype_t)P_PIDFD, (id_t)sc->check_pidfd, &info, WEXITED | WNOHANG);
+    if (info.si_pid == 0) {
+        return; // Spurious wakeup
+    }
+    
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sc->check_pidfd, NULL);
+    close(sc->check_pidfd);
+    sc->check_pidfd = -1;
+    sc->check_pid = 0;
+    
+    record_check_result(sc, info.si_code == CLD_EXITED && info.si_status == 0);
+    timer_wheel_add(&wheel, &sc->health_timer, monotonic_ms() + sc->health_interval_ms);
+}
+
+static void stop_timer_fired(timer_entry_t *timer, void *data) {
+    (void)timer;
+    supervised_t *sc = (supervised_t *)data;
+    
+    stats.timers_fired++;
+    
+    // Stopped between restarts: there is no process left to kill
+    if (sc->process_pid == 0) {
+        container_done(sc, -1);
+        return;
+    }
+    
+    log_message(LOG_WARN, "Container %d didn't stop gracefully, forcing kill", (int)sc->pid);
+    kill(sc->process_pid, SIGKILL);
+}
+
+static void check_oom(supervised_t *sc) {
+    long kills = cgroup_read_oom_kills(sc->oom_fd);
+    
+    if (kills > sc->oom_kills) {
+        log_message(LOG_WARN, "Container %d hit its memory limit (%ld OOM kills)",
+                    (int)sc->pid, kills);
+        events_emit(EVENT_OOM, sc->pid, (int)(kills - sc->oom_kills), NULL);
+        metrics_add(METRIC_OOM_KILLS, (uint64_t)(kills - sc->oom_kills));
+        sc->oom_kills = kills;
+    }
+}
+
+// Forget the container's current process and its health check
+static void release_process(supervised_t *sc) {
+    timer_wheel_cancel(&wheel, &sc->health_timer);
+    
+    if (sc->check_pid > 0) {
+        kill(sc->check_pid, SIGKILL);
+        waitpid(sc->check_pid, NULL, 0);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sc->check_pidfd, NULL);
+        close(sc->check_pidfd);
+        sc->check_pid = 0;
+        sc->check_pidfd = -1;
+    }
+    
+    if (sc->pidfd != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sc->pidfd, NULL);
+        close(sc->pidfd);
+        sc->pidfd = -1;
+    }
+    sc->process_pid = 0;
+}
+
+static void unwatch(supervised_t *sc) {
+    release_process(sc);
+    timer_wheel_cancel(&wheel, &sc->stop_timer);
+    timer_wheel_cancel(&wheel, &sc->restart_timer);
+    
+    if (sc->oom_fd != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sc->oom_fd, NULL);
+        close(sc->oom_fd);
+    }
+    if (sc->cgroup_fd != -1) close(sc->cgroup_fd);
+    if (sc->cpu_stat_fd >= 0) close(sc->cpu_stat_fd);
+    if (sc->memory_fd >= 0) close(sc->memory_fd);
+    if (sc->io_stat_fd >= 0) close(sc->io_stat_fd);
+    if (sc->netns_fd != -1) close(sc->netns_fd);
+    
+    supervised_t **link = &watched;
+    while (*link && *link != sc) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = sc->next;
+        watched_count--;
+    }
+    
+    if (sc->confine_loaded) {
+        security_release(&sc->confine);
+    }
+    free(sc->health_cmd);
+    free(sc->run_argv);
+    free(sc);
+}
+
+// Final bookkeeping once a container is finished with; frees sc
+static void container_done(supervised_t *sc, int status) {
+    pid_t pid = sc->pid;
+    
+    if (sc->stop_requested) {
+        uint64_t exited_ns = metrics_now_ns();
+        registry_update_container_status(pid, "stopped");
+        cleanup_container_resources(pid);
+        events_emit(EVENT_STOP, pid, 0, NULL);
+    
+        uint64_t done_ns = metrics_now_ns();
+        metrics_inc(METRIC_CONTAINERS_STOPPED);
+        metrics_observe(PHASE_STOP_WAIT, exited_ns - sc->stop_started_ns);
+        metrics_observe(PHASE_STOP_CLEANUP, done_ns - exited_ns);
+        metrics_observe(PHASE_STOP_TOTAL, done_ns - sc->stop_started_ns);
+    } else {
+        registry_update_container_status(pid, "exited");
+        cpuset_release(pid);
+        metrics_inc(METRIC_CONTAINERS_EXITED);
+    }
+    unwatch(sc);
+    
+    if (exit_hook) {
+        exit_hook(pid, status);
+    }
+}
+
+// A CLI stopping the container marks it first and cleans up itself
+static int stopped_elsewhere(supervised_t *sc) {
+    container_info_t info;
+    
+    return registry_get_container(sc->pid, &info) == 0 &&
+           (strcmp(info.status, "stopping") == 0 || strcmp(info.status, "stopped") == 0);
+}
+
+static void forget_container(supervised_t *sc, int status) {
+    pid_t pid = sc->pid;
+    
+    unwatch(sc);
+    if (exit_hook) {
+        exit_hook(pid, status);
+    }
+}
+
+// An unknown exit status (-1) counts as a failure
+static int should_restart(supervised_t *sc, int status) {
+    switch (sc->restart_policy) {
+    case RESTART_ALWAYS:
+    case RESTART_UNLESS_STOPPED:
+        return sc->run_argv != NULL;
+    case RESTART_ON_FAILURE:
+        return sc->run_argv != NULL && status != 0 &&
+               (sc->restart_max == 0 || sc->restarts < sc->restart_max);
+    default:
+        return 0;
+    }
+}
+
+static uint32_t next_jitter(supervised_t *sc) {
+    uint32_t x = sc->jitter_state;
+    
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return sc->jitter_state = x;
+}
+
+// Drops the exited process but keeps the cgroup and network namespace, and
+// restarts once the backoff has passed
+static void schedule_restart(supervised_t *sc) {
+    uint64_t now = monotonic_ms();
+    
+    if (now - sc->started_ms >= RESTART_RESET_MS) {
+        sc->quick_exits = 0;
+        sc->backoff_ms = RESTART_BACKOFF_MIN_MS;
+    } else {
+        sc->quick_exits++;
+    }
+    
+    // Equal jitter: half the backoff is fixed so restarts still slow down,
+    // the other half random so containers that failed together spread out
+    int half = sc->backoff_ms / 2;
+    int delay = half + (int)(next_jitter(sc) % (uint32_t)(half + 1));
+    sc->backoff_ms = sc->backoff_ms > RESTART_BACKOFF_MAX_MS / 2 ?
+                     RESTART_BACKOFF_MAX_MS : sc->backoff_ms * 2;
+    
+    if (sc->quick_exits == CRASHLOOP_EXITS) {
+        log_message(LOG_WARN, "Container %d is crash-looping", (int)sc->pid);
+    }
+    log_message(LOG_INFO, "Restarting container %d in %d ms", (int)sc->pid, delay);
+    registry_update_container_status(sc->pid,
+                                     sc->quick_exits >= CRASHLOOP_EXITS ? "crashloop" : "restarting");
+    
+    release_process(sc);
+    timer_wheel_add(&wheel, &sc->restart_timer, now + (uint64_t)delay);
+}
+
+static void restart_timer_fired(timer_entry_t *timer, void *data) {
+    (void)timer;
+    supervised_t *sc = (supervised_t *)data;
+    
+    stats.timers_fired++;
+    
+    if (stopped_elsewhere(sc)) {
+        forget_container(sc, -1);
+        return;
+    }
+    
+    sc->restarts++;
+    metrics_inc(METRIC_CONTAINER_RESTARTS);
+    
+    int pidfd;
+    pid_t pid = respawn_container(&sc->config, sc->netns_fd, sc->cgroup_fd, &pidfd);
+    sc->started_ms = monotonic_ms();
+    if (pid == -1) {
+        // Same as a run that failed at once
+        if (should_restart(sc, -1)) {
+            schedule_restart(sc);
+        } else {
+            container_done(sc, -1);
+        }
+        return;
+    }
+    
+    sc->process_pid = pid;
+    sc->pidfd = pidfd;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &sc->exit_watch };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sc->pidfd, &ev);
+    
+    log_message(LOG_INFO, "Restarted container %d as PID %d (restart %d)",
+                (int)sc->pid, (int)pid, sc->restarts);
+    registry_update_container_restart(sc->pid, pid, sc->restarts);
+    if (sc->netns_fd != -1) {
+        relink_network_namespace(sc->pid, pid);
+    }
+    events_emit(EVENT_START, sc->pid, sc->restarts, sc->config.command);
+    
+    if (sc->health_cmd) {
+        sc->failures = 0;
+        set_health(sc, HEALTH_STARTING);
+        timer_wheel_add(&wheel, &sc->health_timer, sc->started_ms + sc->health_interval_ms);
+    }
+}
+
+static void handle_container_exit(supervised_t *sc) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    
+    // Only reapable if we cloned it; otherwise the exit code is unknown
+    int status = -1;
+    if (waitid((idtype_t)P_PIDFD, (id_t)sc->pidfd, &info, WEXITED | WNOHANG) == 0 &&
+        info.si_pid != 0) {
+        status = info.si_code == CLD_EXITED ? info.si_status : 128 + info.si_status;
+        log_message(LOG_INFO, "Container %d exited with %s %d", (int)sc->pid,
+                    info.si_code == CLD_EXITED ? "code" : "signal", info.si_status);
+    } else {
+        log_message(LOG_INFO, "Container %d exited", (int)sc->pid);
+    }
+    
+    // The OOM notification may still be queued behind the exit
+    if (sc->oom_fd != -1) {
+        check_oom(sc);
+    }
+    
+    events_emit(EVENT_EXIT, sc->pid, status, NULL);
+    if (sc->stop_requested) {
+        container_done(sc, status);
+    } else if (stopped_elsewhere(sc)) {
+        forget_container(sc, status);
+    } else if (should_restart(sc, status)) {
+        schedule_restart(sc);
+    } else {
+        container_done(sc, status);
+    }
+}
+
+void supervisor_set_exit_hook(supervisor_exit_hook_t hook) {
+    exit_hook = hook;
+}
+
+supervised_t *supervisor_find(pid_t pid) {
+    supervised_t *sc;
+    for (sc = watched; sc; sc = sc->next) {
+        if (sc->pid == pid) {
+            return sc;
+        }
+    }
+    return NULL;
+}
+
+// Asynchronous counterpart of stop_container(): SIGTERM now, SIGKILL after
+// grace_ms, cleanup once the exit is seen
+int supervisor_stop(pid_t pid, int grace_ms) {
+    supervised_t *sc = supervisor_find(pid);
+    
+    if (!sc) {
+        container_t container = { .pid = pid };
+        sc = supervisor_watch(&container);
+        if (!sc) {
+            return -1;
+        }
+    }
+    if (sc->stop_requested) {
+        return 0;
+    }
+    
+    log_message(LOG_INFO, "Stopping container with PID: %d", (int)pid);
+    
+    // Waiting to restart: skip the backoff and finish on the next tick
+    if (sc->process_pid == 0) {
+        timer_wheel_cancel(&wheel, &sc->restart_timer);
+        grace_ms = 0;
+    } else if (kill(sc->process_pid, SIGTERM) == -1) {
+        log_message(LOG_ERROR, "Failed to send SIGTERM to PID %d", (int)sc->process_pid);
+        return -1;
+    }
+    
+    sc->stop_requested = 1;
+    sc->stop_started_ns = metrics_now_ns();
+    timer_wheel_add(&wheel, &sc->stop_timer, monotonic_ms() + grace_ms);
+    rearm_timer();
+    return 0;
+}
+
+// The caller's arguments need not outlive supervisor_watch() (the daemon
+// parses them straight out of a request), so restarts work from a copy
+static int keep_run_config(supervised_t *sc, const container_t *container) {
+    if (!container->run_argv) {
+        return -1;
+    }
+    
+    sc->run_argv = copy_argv(container->run_argc, (const char *const *)container->run_argv);
+    if (!sc->run_argv || parse_run_args(container->run_argc, sc->run_argv, &sc->config) != 0) {
+        goto fail;
+    }
+    // The ID names the container's directory, which a restart reuses
+    sc->config.pid = sc->pid;
+    sc->config.use_dns = container->use_dns;
+    memcpy(sc->config.bridge_ip, container->bridge_ip, sizeof(sc->config.bridge_ip));
+    
+    // Restarted processes join the original network namespace
+    if (sc->config.network_mode != NETWORK_HOST) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/ns/net", (int)sc->process_pid);
+        sc->netns_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (sc->netns_fd == -1) {
+            goto fail;
+        }
+    }
+    
+    sc->restart_policy = sc->config.restart_policy;
+    sc->restart_max = sc->config.restart_max;
+    sc->backoff_ms = RESTART_BACKOFF_MIN_MS;
+    sc->jitter_state = ((uint32_t)sc->pid * 2654435761u) ^ (uint32_t)sc->started_ms;
+    if (sc->jitter_state == 0) {
+        sc->jitter_state = 1;
+    }
+    return 0;
+    
+fail:
+    free(sc->run_argv);
+    sc->run_argv = NULL;
+    return -1;
+}
+
+supervised_t *supervisor_watch(const container_t *container) {
+    if (!container || container->pid <= 0) {
+        log_message(LOG_ERROR, "Invalid container to supervise");
+        return NULL;
+    }
+    if (supervisor_init() != 0) {
+        return NULL;
+    }
+    
+    supervised_t *sc = calloc(1, sizeof(*sc));
+    if (!sc) {
+        log_message(LOG_ERROR, "Failed to allocate supervisor entry");
+        return NULL;
+    }
+    
+    sc->pid = container->pid;
+    sc->process_pid = container->pid;
+    sc->started_ms = monotonic_ms();
+    sc->netns_fd = -1;
+    sc->check_pidfd = -1;
+    sc->cgroup_fd = -1;
+    sc->oom_fd = -1;
+    sc->cpu_stat_fd = sc->memory_fd = sc->io_stat_fd = -1;
+    sc->exit_watch.kind = WATCH_EXIT;
+    sc->exit_watch.owner = sc;
+    sc->check_watch.kind = WATCH_CHECK;
+    sc->check_watch.owner = sc;
+    sc->oom_watch.kind = WATCH_OOM;
+    sc->oom_watch.owner = sc;
+    timer_init(&sc->health_timer, health_timer_fired, sc);
+    timer_init(&sc->stop_timer, stop_timer_fired, sc);
+    timer_init(&sc->restart_timer, restart_timer_fired, sc);
+    
+    // An adopted container may already have been restarted
+    container_info_t info;
+    if (registry_get_container(sc->pid, &info) == 0 && info.process_pid > 0) {
+        sc->process_pid = info.process_pid;
+        sc->restarts = info.restarts;
+    }
+    
+    sc->pidfd = open_pidfd(sc->process_pid);
+    if (sc->pidfd == -1) {
+        log_message(LOG_ERROR, "Failed to open pidfd for container %d", (int)sc->pid);
+        free(sc);
+        return NULL;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &sc->exit_watch };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sc->pidfd, &ev) == -1) {
+        log_message(LOG_ERROR, "Failed to watch container %d", (int)sc->pid);
+        close(sc->pidfd);
+        free(sc);
+        return NULL;
+    }
+    
+    // memory.events signals EPOLLPRI on change; a rising oom_kill is an OOM
+    sc->cgroup_fd = open_process_cgroup(sc->process_pid);
+    if (sc->cgroup_fd != -1) {
+        sc->oom_fd = openat(sc->cgroup_fd, "memory.events", O_RDONLY | O_CLOEXEC);
+    }
+    if (sc->oom_fd != -1) {
+        sc->oom_kills = cgroup_read_oom_kills(sc->oom_fd);
+        ev.events = EPOLLPRI;
+        ev.data.ptr = &sc->oom_watch;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sc->oom_fd, &ev) == -1) {
+            close(sc->oom_fd);
+            sc->oom_fd = -1;
+        }
+    }
+    
+    if (container->restart_policy != RESTART_NO && keep_run_config(sc, container) != 0) {
+        log_message(LOG_WARN, "Container %d will not be restarted", (int)sc->pid);
+    }
+    
+    if (container->health_cmd) {
+        sc->health_cmd = strdup(container->health_cmd);
+        sc->health_interval_ms = container->health_interval_ms;
+        sc->health_timeout_ms = container->health_timeout_ms;
+        sc->health_retries = container->health_retries > 0 ? container->health_retries : 1;
+        sc->health = HEALTH_STARTING;
+        registry_update_container_health(sc->pid, health_status_name(sc->health));
+    
+        // Spread first checks over one interval so containers started
+        // together don't check together
+        uint64_t phase = ((uint32_t)sc->pid * 2654435761u) %
+                         (uint32_t)(sc->health_interval_ms > 0 ? sc->health_interval_ms : 1);
+        timer_wheel_add(&wheel, &sc->health_timer, monotonic_ms() + phase);
+        rearm_timer();
+    }
+    
+    sc->next = watched;
+    watched = sc;
+    watched_count++;
+    
+    log_message(LOG_DEBUG, "Supervising container %d", (int)sc->pid);
+    return sc;
+}
+
+int supervisor_dispatch(int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    
+    if (epoll_fd == -1) {
+        return -1;
+    }
+    
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (n == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+    
+    uint64_t cpu_start = thread_cpu_ns();
+    
+    for (int i = 0; i < n; i++) {
+        supervisor_watch_t *watch = (supervisor_watch_t *)events[i].data.ptr;
+    
+        switch (watch->kind) {
+        case WATCH_TIMER: {
+            uint64_t expirations;
+            while (read(timer_fd, &expirations, sizeof(expirations)) > 0) {
+            }
+            break;
+        }
+        case WATCH_CHECK:
+            handle_check_done(watch->owner);
+            break;
+        case WATCH_OOM:
+            check_oom(watch->owner);
+            break;
+        case WATCH_EXIT:
+            handle_container_exit(watch->owner);
+            // Later events in this batch may point at the freed entry
+            n = 0;
+            break;
+        }
+    }
+    
+    timer_wheel_advance(&wheel, monotonic_ms());
+    rearm_timer();
+    
+    stats.sched_cpu_ns += thread_cpu_ns() - cpu_start;
+    return 0;
+}
+
+int supervisor_run(void) {
+    while (watched_count > 0) {
+        if (supervisor_dispatch(-1) != 0) {
+            log_message(LOG_ERROR, "Supervisor wait failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+    
+    log_message(LOG_DEBUG, "Supervisor: %lu checks (%lu failed), %lu timers, %.3f ms CPU",
+                (unsigned long)stats.checks_run, (unsigned long)stats.checks_failed,
+                (unsigned long)stats.timers_fired, stats.sched_cpu_ns / 1e6);
+    return 0;
+}
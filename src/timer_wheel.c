@@ -0,0 +1,168 @@
+#include "timer_wheel.h"
+
+static void list_init(timer_entry_t *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_del(timer_entry_t *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static void list_add_tail(timer_entry_t *head, timer_entry_t *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+// Move a whole slot onto a private list so callbacks may re-add timers
+static void list_splice(timer_entry_t *from, timer_entry_t *to) {
+    list_init(to);
+    if (from->next == from) {
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, unsigned int tick_ms, uint64_t now_ms) {
+    wheel->tick_ms = tick_ms ? tick_ms : 1;
+    wheel->current = now_ms / wheel->tick_ms;
+    wheel->count = 0;
+    
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SIZE; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+void timer_init(timer_entry_t *timer, timer_callback_t callback, void *data) {
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->data = data;
+}
+
+int timer_pending(const timer_entry_t *timer) {
+    return timer->next != NULL;
+}
+
+// Pick the level whose span covers the distance to expiry. Cascaded timers
+// may expire on the current tick, whose level 0 slot is processed next.
+static void wheel_insert(timer_wheel_t *wheel, timer_entry_t *timer) {
+    uint64_t delta = timer->expires - wheel->current;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           delta >= ((uint64_t)1 << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    
+    int slot = (int)((timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    list_add_tail(&wheel->slots[level][slot], timer);
+}
+
+void timer_wheel_add(timer_wheel_t *wheel, timer_entry_t *timer, uint64_t expires_ms) {
+    if (timer_pending(timer)) {
+        timer_wheel_cancel(wheel, timer);
+    }
+    
+    uint64_t max_delta = ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    
+    // Round up so a timer never fires early; the current tick is already done
+    timer->expires = (expires_ms + wheel->tick_ms - 1) / wheel->tick_ms;
+    if (timer->expires <= wheel->current) {
+        timer->expires = wheel->current + 1;
+    } else if (timer->expires - wheel->current > max_delta) {
+        timer->expires = wheel->current + max_delta;
+    }
+    wheel_insert(wheel, timer);
+    wheel->count++;
+}
+
+void timer_wheel_cancel(timer_wheel_t *wheel, timer_entry_t *timer) {
+    if (!timer_pending(timer)) {
+        return;
+    }
+    list_del(timer);
+    wheel->count--;
+}
+
+// Re-file the timers of an upper-level slot now that they are closer
+static void wheel_cascade(timer_wheel_t *wheel, int level, int slot) {
+    timer_entry_t pending;
+    list_splice(&wheel->slots[level][slot], &pending);
+    
+    while (pending.next != &pending) {
+        timer_entry_t *timer = pending.next;
+        list_del(timer);
+        wheel_insert(wheel, timer);
+    }
+}
+
+size_t timer_wheel_advance(timer_wheel_t *wheel, uint64_t now_ms) {
+    uint64_t target = now_ms / wheel->tick_ms;
+    size_t fired = 0;
+    
+    // Nothing to expire, so skip ahead instead of stepping every tick
+    if (wheel->count == 0) {
+        if (target > wheel->current) {
+            wheel->current = target;
+        }
+        return 0;
+    }
+    
+    while (wheel->current < target) {
+        wheel->current++;
+    
+        int slot = (int)(wheel->current & WHEEL_MASK);
+        for (int level = 1; level < WHEEL_LEVELS && slot == 0; level++) {
+            slot = (int)((wheel->current >> (WHEEL_BITS * level)) & WHEEL_MASK);
+            wheel_cascade(wheel, level, slot);
+        }
+    
+        timer_entry_t expired;
+        list_splice(&wheel->slots[0][wheel->current & WHEEL_MASK], &expired);
+    
+        while (expired.next != &expired) {
+            timer_entry_t *timer = expired.next;
+            list_del(timer);
+            wheel->count--;
+            fired++;
+            timer->callback(timer, timer->data);
+        }
+    }
+    
+    return fired;
+}
+
+int timer_wheel_next_timeout(const timer_wheel_t *wheel, uint64_t now_ms) {
+    if (wheel->count == 0) {
+        return -1;
+    }
+    
+    // Earliest non-empty level 0 slot, otherwise wake for the next cascade
+    uint64_t next = wheel->current + (WHEEL_SIZE - (wheel->current & WHEEL_MASK));
+    for (uint64_t tick = wheel->current + 1; tick < next; tick++) {
+        const timer_entry_t *head = &wheel->slots[0][tick & WHEEL_MASK];
+        if (head->next != head) {
+            next = tick;
+            break;
+        }
+    }
+    
+    uint64_t next_ms = next * wheel->tick_ms;
+    if (next_ms <= now_ms) {
+        return 0;
+    }
+    uint64_t timeout = next_ms - now_ms;
+    return timeout > 60000 ? 60000 : (int)timeout;
+}
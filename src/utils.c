@@ -1,21 +1,51 @@
 #include "utils.h"
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <time.h>
+#include <sys/syscall.h>
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD 0x00001000
+#endif
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL
+#endif
+
+// struct clone_args as of Linux 5.7 (CLONE_ARGS_SIZE_VER2)
+struct clone3_args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+static const char *const level_str[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+// Local time offset seen by the last log_message(), for log_child()
+static atomic_long utc_offset;
 
 void log_message(log_level_t level, const char *format, ...) {
     if (!format) {
         return;
     }
     
-    const char *level_str[] = {"DEBUG", "INFO", "WARN", "ERROR"};
-    
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
+    struct tm tm;
+    struct tm *tm_info = localtime_r(&now, &tm);
     
     if (!tm_info) {
         fprintf(stderr, "Error: Failed to get local time\n");
         return;
     }
+    atomic_store_explicit(&utc_offset, tm_info->tm_gmtoff, memory_order_relaxed);
     
     if (level < 0 || level >= (int)(sizeof(level_str)/sizeof(level_str[0]))) {
         level = LOG_ERROR;
@@ -32,6 +62,101 @@ void log_message(log_level_t level, const char *format, ...) {
     printf("\n");
 }
 
+static void append_text(char *buf, size_t len, size_t *used, const char *text) {
+    for (; *text; text++, (*used)++) {
+        if (*used + 1 < len) {
+            buf[*used] = *text;
+        }
+    }
+}
+
+// Understands %s, %d and %% only, and keeps to the stack
+static size_t format_args(char *buf, size_t len, const char *format, va_list args) {
+    size_t used = 0;
+    
+    for (const char *p = format; *p; p++) {
+        char text[16];
+        if (*p != '%' || (p[1] != 's' && p[1] != 'd')) {
+            text[0] = *p;
+            text[1] = '\0';
+            if (*p == '%' && p[1] == '%') {
+                p++;
+            }
+            append_text(buf, len, &used, text);
+            continue;
+        }
+    
+        if (*++p == 's') {
+            const char *value = va_arg(args, const char *);
+            append_text(buf, len, &used, value ? value : "(null)");
+            continue;
+        }
+        int value = va_arg(args, int);
+        unsigned int magnitude = value < 0 ? 0U - (unsigned int)value : (unsigned int)value;
+        char *digit = text + sizeof(text) - 1;
+        *digit = '\0';
+        do {
+            *--digit = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude > 0);
+        if (value < 0) {
+            *--digit = '-';
+        }
+        append_text(buf, len, &used, digit);
+    }
+    if (len > 0) {
+        buf[used < len ? used : len - 1] = '\0';
+    }
+    return used;
+}
+
+int format_string(char *buf, size_t len, const char *format, ...) {
+    va_list args;
+    
+    va_start(args, format);
+    size_t used = format_args(buf, len, format, args);
+    va_end(args);
+    return (int)used;
+}
+
+void log_child(log_level_t level, const char *format, ...) {
+    char line[1024];
+    struct timespec now;
+    
+    if (level < 0 || level >= (int)(sizeof(level_str)/sizeof(level_str[0]))) {
+        level = LOG_ERROR;
+    }
+    
+    // Same layout as log_message(), from the offset it last saw
+    clock_gettime(CLOCK_REALTIME, &now);
+    long secs = (long)((now.tv_sec + atomic_load_explicit(&utc_offset, memory_order_relaxed)) % 86400);
+    if (secs < 0) {
+        secs += 86400;
+    }
+    char stamp[] = "[00:00:00] [";
+    stamp[1] = (char)(stamp[1] + secs / 36000);
+    stamp[2] = (char)(stamp[2] + secs / 3600 % 10);
+    stamp[4] = (char)(stamp[4] + secs / 60 % 60 / 10);
+    stamp[5] = (char)(stamp[5] + secs / 60 % 10);
+    stamp[7] = (char)(stamp[7] + secs % 60 / 10);
+    stamp[8] = (char)(stamp[8] + secs % 10);
+    
+    size_t used = (size_t)format_string(line, sizeof(line), "%s%s] ", stamp, level_str[level]);
+    va_list args;
+    va_start(args, format);
+    used += format_args(line + used, sizeof(line) - used, format, args);
+    va_end(args);
+    
+    // Truncated lines still end the line
+    if (used > sizeof(line) - 2) {
+        used = sizeof(line) - 2;
+    }
+    line[used++] = '\n';
+    if (write(STDOUT_FILENO, line, used) == -1) {
+        return;
+    }
+}
+
 void die(const char *msg) {
     if (msg) {
         log_message(LOG_ERROR, "Fatal error: %s", msg);
@@ -83,4 +208,87 @@ char *read_file_content(const char *path) {
     
     fclose(file);
     return content;
-}
\ No newline at end of file
+}
+
+int open_pidfd(pid_t pid) {
+    if (pid <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    // No glibc wrapper before 2.36
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+// fork()-like clone3: returns 0 in the child. The child starts in
+// cgroup_fd's cgroup unless it is -1; *pidfd receives a pidfd for it.
+pid_t clone_into_cgroup(uint64_t flags, int cgroup_fd, int *pidfd) {
+    struct clone3_args args = {
+        .flags = flags | CLONE_PIDFD | (cgroup_fd != -1 ? CLONE_INTO_CGROUP : 0),
+        .pidfd = (uint64_t)(uintptr_t)pidfd,
+        .exit_signal = SIGCHLD,
+        .cgroup = cgroup_fd != -1 ? (uint64_t)cgroup_fd : 0,
+    };
+    return (pid_t)syscall(SYS_clone3, &args, sizeof(args));
+}
+
+uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Copies an argument vector into one allocation (the NULL-terminated array
+// followed by the strings), released with a single free()
+char **copy_argv(int argc, const char *const argv[]) {
+    size_t size = (size_t)(argc + 1) * sizeof(char *);
+    int i;
+    
+    for (i = 0; i < argc; i++) {
+        size += strlen(argv[i]) + 1;
+    }
+    
+    char **copy = malloc(size);
+    if (!copy) {
+        return NULL;
+    }
+    
+    char *strings = (char *)(copy + argc + 1);
+    for (i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        memcpy(strings, argv[i], len);
+        copy[i] = strings;
+        strings += len;
+    }
+    copy[argc] = NULL;
+    return copy;
+}
+
+int parse_duration_ms(const char *str, int *duration_ms) {
+    if (!str || !duration_ms) {
+        return -1;
+    }
+    
+    // "500ms", "30s", "2m"; a bare number is seconds
+    char *end;
+    long value = strtol(str, &end, 10);
+    if (end == str || value < 0) {
+        return -1;
+    }
+    
+    long scale;
+    if (strcmp(end, "ms") == 0) {
+        scale = 1;
+    } else if (strcmp(end, "s") == 0 || *end == '\0') {
+        scale = 1000;
+    } else if (strcmp(end, "m") == 0) {
+        scale = 60 * 1000;
+    } else {
+        return -1;
+    }
+    
+    if (value > 24L * 60 * 60 * 1000 / scale) {
+        return -1;
+    }
+    *duration_ms = (int)(value * scale);
+    return 0;
+}